@@ -36,6 +36,7 @@
 #include <hardware/flash.h>
 #include <pico/multicore.h>
 #include "rp2040_fpga.h"
+#include "rp2040_sdio.h"
 #include <strings.h>
 #include <SerialUSB.h>
 #include <class/cdc/cdc_device.h>
@@ -326,6 +327,7 @@ static void usb_log_poll();
 void platform_emergency_log_save()
 {
     platform_set_sd_callback(NULL, NULL);
+    log_deferred_flush();
 
     SD.begin(SD_CONFIG_CRASH);
     FsFile crashfile = SD.open(CRASHFILE, O_WRONLY | O_CREAT | O_TRUNC);
@@ -640,11 +642,15 @@ bool install_license(char *buf)
 
     usb_log_poll();
 
-    // Write to RP2040 flash
+    // Write to RP2040 flash.
+    // If core1 is running SD transfers, it has to be paused because flash is not accessible during write.
+    bool core1_lockout = platform_sd_core1_active();
+    if (core1_lockout) multicore_lockout_start_blocking();
     __disable_irq();
     flash_range_erase(PLATFORM_LICENSE_KEY_OFFSET, PLATFORM_FLASH_PAGE_SIZE);
     flash_range_program(PLATFORM_LICENSE_KEY_OFFSET, key, 256);
     __enable_irq();
+    if (core1_lockout) multicore_lockout_end_blocking();
 
     if (memcmp(key, PLATFORM_LICENSE_KEY_ADDR, 32) == 0)
     {
@@ -734,7 +740,7 @@ void platform_poll()
     prev_poll_time = time_now;
 
     // Check if there is license file on SD card
-    if (!license_from_sd_done && g_sdcard_present)
+    if (!license_from_sd_done && g_sdcard_present && !platform_sd_core1_busy())
     {
         license_from_sd_done = true;
 
@@ -777,6 +783,12 @@ void platform_poll()
         license_log_done = true;
     }
 
+    // Release SD card from multi-block read that has not continued
+    if (!platform_sd_core1_busy())
+    {
+        sdio_stream_poll();
+    }
+
     // Monitor supply voltage and process USB events
     adc_poll();
     usb_log_poll();
@@ -892,6 +904,9 @@ void zuluide_setup(void)
     rp2040.idleOtherCore();
     multicore_reset_core1();
     dbgmsg("No Zulu Control board or I2C server found, disabling 2nd core");
+
+    // Use the free core for SD card transfers if enabled in config
+    platform_sd_core1_start();
   }
 }
 
@@ -34,6 +34,7 @@
 #include <zuluide/status/system_status.h>
 #include <zuluide/status/device_control_safe.h>
 
+#include <pico/platform.h>
 #include <pico/util/queue.h>
 
 /* These are used in debug output and default SCSI strings */
@@ -51,6 +52,14 @@ extern const char *g_platform_name;
 void platform_log(const char *s);
 void platform_emergency_log_save();
 
+// String literals are stored in flash and stay valid, so deferred debug
+// messages can refer to them by pointer instead of copying.
+#define PLATFORM_LOG_IS_CONST_STR(p) ((uintptr_t)(p) >= 0x10000000 && (uintptr_t)(p) < 0x10000000 + PLATFORM_FLASH_TOTAL_SIZE)
+
+// Log buffer and deferred debug message ring are written only from core0.
+// SD card transfers running on core1 report errors back as status codes.
+#define PLATFORM_LOG_ALLOWED() (get_core_num() == 0)
+
 // Timing and delay functions.
 // Arduino platform already provides these
 // unsigned long millis(void);
@@ -101,6 +110,23 @@ void platform_poll();
 typedef void (*sd_callback_t)(uint32_t bytes_complete);
 void platform_set_sd_callback(sd_callback_t func, const uint8_t *buffer);
 
+// SD card transfers on the second core.
+// When core1 is not needed for the control board UI, it can execute queued
+// sector transfers while core0 handles the IDE bus. Requests are executed
+// in order and progress is reported as total number of bytes transferred
+// since platform_sd_core1_reset(). Other SD card access must wait until
+// platform_sd_core1_busy() returns false.
+#ifndef SD_CORE1_QUEUE_SIZE
+#define SD_CORE1_QUEUE_SIZE 8
+#endif
+void platform_sd_core1_request(bool enable); // Set from configuration before zuluide_setup()
+void platform_sd_core1_start(); // Called by zuluide_setup() when core1 is free
+bool platform_sd_core1_active();
+bool platform_sd_core1_busy();
+bool platform_sd_core1_submit(bool write, uint32_t sector, uint8_t *buf, uint32_t count);
+uint32_t platform_sd_core1_bytes_done(bool *error);
+bool platform_sd_core1_reset(); // Wait for queue to empty and clear progress counter
+
 /**
    Attempts to determine whether the hardware UI or the web service is attached to the device.
  */
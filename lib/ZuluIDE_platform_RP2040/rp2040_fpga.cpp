@@ -29,6 +29,7 @@
 #include <hardware/dma.h>
 #include <hardware/clocks.h>
 #include <hardware/structs/iobank0.h>
+#include <hardware/sync.h>
 #include "fpga_bitstream.h"
 #include "rp2040_fpga_qspi.pio.h"
 
@@ -46,6 +47,20 @@ static struct {
 
     dma_channel_config dma_tx_cfg;   // Transmit from unaligned buffer
     dma_channel_config dma_rx_cfg;   // Receive to unaligned buffer
+
+    // Asynchronous DMA transfer that has been started but not yet finished.
+    bool dma_pending;
+    uint8_t dma_cmd;
+    fpga_cmd_handle_t dma_handle;
+    uint32_t *dma_crc;
+
+    // Buffer location is read by SD card driver, possibly from the other core.
+    // Written only by fpga_publish_dma(), dma_seq is odd while an update is in progress.
+    volatile uint32_t dma_seq;
+    const uint8_t * volatile dma_buf;
+    volatile size_t dma_len;
+    volatile bool dma_started;
+    uint32_t dma_dummy; // Target for unused direction of DMA transfer
 } g_fpga_qspi;
 
 static void fpga_io_as_spi()
@@ -119,6 +134,7 @@ static void fpga_qspi_pio_init()
             pio_sm_config cfg = fpga_qspi_transfer_program_get_default_config(g_fpga_qspi.pio_offset_qspi_transfer);
             sm_config_set_in_pins(&cfg, FPGA_QSPI_D0);
             sm_config_set_out_pins(&cfg, FPGA_QSPI_D0, 4);
+            sm_config_set_set_pins(&cfg, FPGA_QSPI_D0, 4); // Only used for pin direction changes
             sm_config_set_sideset_pins(&cfg, FPGA_QSPI_SCK);
             sm_config_set_in_shift(&cfg, true, true, 8);
             sm_config_set_out_shift(&cfg, true, true, 8);
@@ -152,6 +168,33 @@ static void fpga_qspi_pio_init()
             g_fpga_qspi.dma_rx_cfg = cfg;
         }
     }
+
+    // Full state machine configuration is done only once here.
+    // After that commands only switch the shift thresholds.
+    gpio_put(FPGA_SS, 1);
+    pio_sm_init(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM,
+                g_fpga_qspi.pio_offset_qspi_transfer,
+                &g_fpga_qspi.pio_cfg_qspi_transfer_8bit);
+    pio_sm_set_consecutive_pindirs(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, FPGA_QSPI_SCK, 1, true);
+    pio_sm_set_consecutive_pindirs(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, FPGA_QSPI_D0, 4, false);
+}
+
+// Restart the state machine from beginning of program with given transfer width.
+// This is much faster than pio_sm_init(), which rewrites all of the configuration.
+static inline void fpga_qspi_restart(const pio_sm_config *cfg)
+{
+    pio_sm_set_enabled(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, false);
+    FPGA_QSPI_PIO->sm[FPGA_QSPI_PIO_SM].shiftctrl = cfg->shiftctrl;
+    pio_sm_clear_fifos(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM);
+    pio_sm_restart(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM);
+    pio_sm_exec(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, pio_encode_jmp(g_fpga_qspi.pio_offset_qspi_transfer));
+    pio_sm_set_enabled(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, true);
+}
+
+// Set QSPI data pin direction with a single SET instruction
+static inline void fpga_qspi_data_dir(bool output)
+{
+    pio_sm_exec(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, pio_encode_set(pio_pindirs, output ? 0x0F : 0x00));
 }
 
 bool fpga_selftest()
@@ -216,8 +259,12 @@ bool fpga_selftest()
     return true;
 }
 
+static void fpga_finish_dma();
+
 bool fpga_init(bool force_reinit, bool do_auth)
 {
+    fpga_finish_dma();
+
     // Enable clock output to FPGA
     // 15.6 MHz for now, resulting in FPGA clock of 60MHz.
     gpio_set_function(FPGA_CLK, GPIO_FUNC_GPCK);
@@ -302,30 +349,137 @@ bool fpga_init(bool force_reinit, bool do_auth)
     return true;
 }
 
-static void fpga_start_cmd(uint8_t cmd)
+static void fpga_release()
 {
-    // Prepare for start of new command, raise chip select and init PIO in 8-bit write mode
     gpio_put(FPGA_SS, 1);
-    pio_sm_init(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM,
-                g_fpga_qspi.pio_offset_qspi_transfer,
-                &g_fpga_qspi.pio_cfg_qspi_transfer_8bit);
-    pio_sm_set_consecutive_pindirs(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, FPGA_QSPI_SCK, 1, true);
-    pio_sm_set_consecutive_pindirs(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, FPGA_QSPI_D0, 4, true);
-    pio_sm_set_enabled(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, true);
+    pio_sm_set_enabled(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, false);
+    fpga_qspi_data_dir(false);
+}
+
+// Update the buffer location of the pending DMA, for fpga_wait_buffer()
+static void fpga_publish_dma(const uint8_t *buf, size_t len, bool started)
+{
+    g_fpga_qspi.dma_seq++;
+    __dmb();
+    g_fpga_qspi.dma_buf = buf;
+    g_fpga_qspi.dma_len = len;
+    g_fpga_qspi.dma_started = started;
+    __dmb();
+    g_fpga_qspi.dma_seq++;
+}
+
+// Wait for DMA transfer of an asynchronous command to complete and end the command
+static void fpga_finish_dma()
+{
+    if (!g_fpga_qspi.dma_pending)
+    {
+        return;
+    }
+
+    uint32_t start = millis();
+    while (dma_channel_is_busy(FPGA_QSPI_DMA_RX))
+    {
+        if ((uint32_t)(millis() - start) > 100)
+        {
+            logmsg("FPGA command ", g_fpga_qspi.dma_cmd, " DMA timeout, ctrl:", dma_hw->ch[FPGA_QSPI_DMA_RX].al1_ctrl,
+                   " length: ", (int)g_fpga_qspi.dma_len);
+            break;
+        }
+    }
+
+    dma_channel_abort(FPGA_QSPI_DMA_RX);
+    dma_channel_abort(FPGA_QSPI_DMA_TX);
+    dma_sniffer_disable();
+
+    if (g_fpga_qspi.dma_crc) *g_fpga_qspi.dma_crc = (uint16_t)dma_hw->sniff_data;
+
+    g_fpga_qspi.dma_pending = false;
+    fpga_publish_dma(nullptr, 0, false);
+    fpga_release();
+}
+
+// Record the DMA transfer that will be finished by fpga_finish_dma().
+// Call fpga_publish_dma(buf, len, true) after the DMA has been started.
+static fpga_cmd_handle_t fpga_set_dma_pending(uint8_t cmd, const uint8_t *buf, size_t len, uint32_t *crc)
+{
+    g_fpga_qspi.dma_pending = true;
+    g_fpga_qspi.dma_cmd = cmd;
+    g_fpga_qspi.dma_crc = crc;
+    fpga_publish_dma(buf, len, false);
+    return ++g_fpga_qspi.dma_handle;
+}
+
+void fpga_wait_cmd(fpga_cmd_handle_t handle)
+{
+    if (g_fpga_qspi.dma_pending && g_fpga_qspi.dma_handle == handle)
+    {
+        fpga_finish_dma();
+    }
+}
+
+bool fpga_cmd_is_done(fpga_cmd_handle_t handle)
+{
+    return !g_fpga_qspi.dma_pending || g_fpga_qspi.dma_handle != handle ||
+           !dma_channel_is_busy(FPGA_QSPI_DMA_RX);
+}
+
+void fpga_wait_buffer(const void *buf, size_t len)
+{
+    uint32_t start = millis();
+    while (true)
+    {
+        // Take a consistent copy of the record, retry if it changed while reading
+        uint32_t seq = g_fpga_qspi.dma_seq;
+        __dmb();
+        const uint8_t *dma_buf = g_fpga_qspi.dma_buf;
+        size_t dma_len = g_fpga_qspi.dma_len;
+        bool started = g_fpga_qspi.dma_started;
+        __dmb();
+        if ((seq & 1) || seq != g_fpga_qspi.dma_seq)
+        {
+            continue;
+        }
+
+        if (dma_buf == nullptr ||
+            (const uint8_t*)buf >= dma_buf + dma_len ||
+            (const uint8_t*)buf + len <= dma_buf)
+        {
+            return;
+        }
+
+        // Channel busy state is only meaningful once the DMA has been started
+        if (started || (uint32_t)(millis() - start) > 100)
+        {
+            break;
+        }
+    }
+
+    // Only poll the DMA channel state, the command itself is finished
+    // by the core that started it.
+    while (dma_channel_is_busy(FPGA_QSPI_DMA_RX) &&
+           (uint32_t)(millis() - start) <= 100);
+}
+
+static void fpga_start_cmd(uint8_t cmd)
+{
+    // Previous asynchronous command must complete before the next one
+    fpga_finish_dma();
+
+    // Prepare for start of new command, restart PIO in 8-bit write mode
+    fpga_qspi_restart(&g_fpga_qspi.pio_cfg_qspi_transfer_8bit);
+    fpga_qspi_data_dir(true);
 
     // Activate chip select and transfer command
     gpio_put(FPGA_SS, 0);
     pio_sm_put_blocking(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, cmd);
 }
 
-static void fpga_release()
+void fpga_wrcmd(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint32_t *crc)
 {
-    gpio_put(FPGA_SS, 1);
-    pio_sm_set_enabled(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, false);
-    pio_sm_set_consecutive_pindirs(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, FPGA_QSPI_D0, 4, false);
+    fpga_wait_cmd(fpga_wrcmd_async(cmd, payload, payload_len, crc));
 }
 
-void fpga_wrcmd(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint32_t *crc)
+fpga_cmd_handle_t fpga_wrcmd_async(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint32_t *crc)
 {
     // Expecting a write-mode command
     assert(cmd & 0x80);
@@ -352,19 +506,16 @@ void fpga_wrcmd(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint32_
     else
     {
         // Configure in 32-bit mode for data transfer
-        pio_sm_set_enabled(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, false);
-        pio_sm_init(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM,
-                g_fpga_qspi.pio_offset_qspi_transfer,
-                &g_fpga_qspi.pio_cfg_qspi_transfer_32bit);
-        pio_sm_set_enabled(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, true);
+        fpga_qspi_restart(&g_fpga_qspi.pio_cfg_qspi_transfer_32bit);
 
-        // Transmit 32 bits at a time using DMA
+        // Transmit 32 bits at a time using DMA.
+        // Transfer completes in background and is finished by fpga_finish_dma().
         uint32_t num_words = payload_len / 4;
-        uint32_t dummy = 0;
+        fpga_cmd_handle_t handle = fpga_set_dma_pending(cmd, payload, payload_len, crc);
         dma_channel_config cfg_dummy_rx = g_fpga_qspi.dma_rx_cfg;
         channel_config_set_write_increment(&cfg_dummy_rx, false);
         dma_channel_configure(FPGA_QSPI_DMA_RX,
-            &cfg_dummy_rx, &dummy, &FPGA_QSPI_PIO->rxf[FPGA_QSPI_PIO_SM],
+            &cfg_dummy_rx, &g_fpga_qspi.dma_dummy, &FPGA_QSPI_PIO->rxf[FPGA_QSPI_PIO_SM],
             num_words, true);
 
         dma_hw->sniff_data = 0x4ABA; // ATA CRC16 initialization value
@@ -373,28 +524,20 @@ void fpga_wrcmd(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint32_
             num_words, false);
         dma_sniffer_enable(FPGA_QSPI_DMA_TX, 0x03, true);
         dma_channel_start(FPGA_QSPI_DMA_TX);
-
-        uint32_t start = millis();
-        while (dma_channel_is_busy(FPGA_QSPI_DMA_RX))
-        {
-            if ((uint32_t)(millis() - start) > 100)
-            {
-                logmsg("fpga_wrcmd() DMA timeout, ctrl:", dma_hw->ch[FPGA_QSPI_DMA_RX].al1_ctrl, " payload_len: ", (int)payload_len);
-                break;
-            }
-        }
-
-        dma_channel_abort(FPGA_QSPI_DMA_RX);
-        dma_channel_abort(FPGA_QSPI_DMA_TX);
-        dma_sniffer_disable();
-
-        if (crc) *crc = (uint16_t)dma_hw->sniff_data;
+        fpga_publish_dma(payload, payload_len, true);
+        return handle;
     }
 
     fpga_release();
+    return ++g_fpga_qspi.dma_handle;
 }
 
 void fpga_rdcmd(uint8_t cmd, uint8_t *result, size_t result_len, uint32_t *crc, bool slow)
+{
+    fpga_wait_cmd(fpga_rdcmd_async(cmd, result, result_len, crc, slow));
+}
+
+fpga_cmd_handle_t fpga_rdcmd_async(uint8_t cmd, uint8_t *result, size_t result_len, uint32_t *crc, bool slow)
 {
     // Expecting a read-mode command
     assert(!(cmd & 0x80));
@@ -404,7 +547,7 @@ void fpga_rdcmd(uint8_t cmd, uint8_t *result, size_t result_len, uint32_t *crc,
 
     // Change to read mode with bus turnaround byte
     pio_sm_get_blocking(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM);
-    pio_sm_set_consecutive_pindirs(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, FPGA_QSPI_D0, 4, false);
+    fpga_qspi_data_dir(false);
     pio_sm_put_blocking(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, 0xFF);
     pio_sm_get_blocking(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM);
 
@@ -435,14 +578,12 @@ void fpga_rdcmd(uint8_t cmd, uint8_t *result, size_t result_len, uint32_t *crc,
     else
     {
         // Configure in 32-bit mode for data transfer
-        pio_sm_set_enabled(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, false);
-        pio_sm_init(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM,
-                g_fpga_qspi.pio_offset_qspi_transfer,
-                &g_fpga_qspi.pio_cfg_qspi_transfer_32bit);
-        pio_sm_set_enabled(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, true);
+        fpga_qspi_restart(&g_fpga_qspi.pio_cfg_qspi_transfer_32bit);
 
-        // Receive 32 bits at a time using DMA
+        // Receive 32 bits at a time using DMA.
+        // Transfer completes in background and is finished by fpga_finish_dma().
         uint32_t num_words = result_len / 4;
+        fpga_cmd_handle_t handle = fpga_set_dma_pending(cmd, result, result_len, crc);
         dma_hw->sniff_data = 0x4ABA; // ATA CRC16 initialization value
         dma_channel_configure(FPGA_QSPI_DMA_RX,
             &g_fpga_qspi.dma_rx_cfg, result, &FPGA_QSPI_PIO->rxf[FPGA_QSPI_PIO_SM],
@@ -450,31 +591,34 @@ void fpga_rdcmd(uint8_t cmd, uint8_t *result, size_t result_len, uint32_t *crc,
         dma_sniffer_enable(FPGA_QSPI_DMA_RX, 0x03, true);
         dma_channel_start(FPGA_QSPI_DMA_RX);
 
-        uint32_t dummy = 0;
+        g_fpga_qspi.dma_dummy = 0;
         dma_channel_config cfg_dummy_tx = g_fpga_qspi.dma_tx_cfg;
         channel_config_set_read_increment(&cfg_dummy_tx, false);
         dma_channel_configure(FPGA_QSPI_DMA_TX,
-            &g_fpga_qspi.dma_tx_cfg, &FPGA_QSPI_PIO->txf[FPGA_QSPI_PIO_SM], &dummy,
+            &cfg_dummy_tx, &FPGA_QSPI_PIO->txf[FPGA_QSPI_PIO_SM], &g_fpga_qspi.dma_dummy,
             num_words, true);
+        fpga_publish_dma(result, result_len, true);
+        return handle;
+    }
 
-        uint32_t start = millis();
-        while (dma_channel_is_busy(FPGA_QSPI_DMA_RX))
-        {
-            if ((uint32_t)(millis() - start) > 100)
-            {
-                logmsg("fpga_rdcmd() DMA timeout, ctrl:", dma_hw->ch[FPGA_QSPI_DMA_RX].al1_ctrl, " result_len: ", (int)result_len);
-                break;
-            }
-        }
+    fpga_release();
+    return ++g_fpga_qspi.dma_handle;
+}
 
-        dma_channel_abort(FPGA_QSPI_DMA_RX);
-        dma_channel_abort(FPGA_QSPI_DMA_TX);
-        dma_sniffer_disable();
+uint8_t fpga_read_status()
+{
+    fpga_start_cmd(FPGA_CMD_READ_STATUS);
+    pio_sm_get_blocking(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM);
 
-        if (crc) *crc = (uint16_t)dma_hw->sniff_data;
-    }
+    // Queue turnaround and status bytes together, FIFO has room for both
+    fpga_qspi_data_dir(false);
+    pio_sm_put(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, 0xFF);
+    pio_sm_put(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM, 0xFF);
+    pio_sm_get_blocking(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM);
+    uint8_t status = pio_sm_get_blocking(FPGA_QSPI_PIO, FPGA_QSPI_PIO_SM) >> 24;
 
     fpga_release();
+    return status;
 }
 
 void fpga_dump_ide_regs()
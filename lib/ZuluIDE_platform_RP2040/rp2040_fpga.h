@@ -165,6 +165,29 @@ void fpga_wrcmd(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint32_
 // Optionally calculate UltraDMA CRC of the data (only for aligned buffers)
 void fpga_rdcmd(uint8_t cmd, uint8_t *result, size_t result_len, uint32_t *crc = nullptr, bool slow = false);
 
+// Asynchronous variants of the above commands.
+// For aligned buffers, the payload is transferred by DMA in the background
+// and the buffer must not be modified (write) or accessed (read) until the
+// command has finished. The command finishes when fpga_wait_cmd() is called
+// with the returned handle, or implicitly when the next command is started.
+// CRC value is stored when the command finishes.
+typedef uint32_t fpga_cmd_handle_t;
+fpga_cmd_handle_t fpga_wrcmd_async(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint32_t *crc = nullptr);
+fpga_cmd_handle_t fpga_rdcmd_async(uint8_t cmd, uint8_t *result, size_t result_len, uint32_t *crc = nullptr, bool slow = false);
+void fpga_wait_cmd(fpga_cmd_handle_t handle);
+
+// Check without blocking whether the background DMA of an asynchronous command
+// has completed. The command still ends only with fpga_wait_cmd() or the next command.
+bool fpga_cmd_is_done(fpga_cmd_handle_t handle);
+
+// Wait until any background FPGA transfer overlapping the buffer has completed.
+// Can be called from either core before reusing a buffer for other DMA transfers.
+void fpga_wait_buffer(const void *buf, size_t len);
+
+// Read FPGA status byte (FPGA_CMD_READ_STATUS).
+// Equivalent to fpga_rdcmd() with 1 byte length, but has less overhead.
+uint8_t fpga_read_status();
+
 // Dump IDE register values
 void fpga_dump_ide_regs();
 
@@ -23,10 +23,32 @@
 #include <ide_constants.h>
 #include "rp2040_fpga.h"
 #include <assert.h>
+#include <stddef.h>
+#include <string.h>
 #include <ZuluIDE_log.h>
 #include <hardware/gpio.h>
 #include "ZuluIDE_platform.h"
 
+// FPGA status read less than this many microseconds ago is reused
+// instead of issuing a new QSPI transaction.
+#ifndef IDE_PHY_STATUS_MAX_AGE_US
+#define IDE_PHY_STATUS_MAX_AGE_US 10
+#endif
+
+// Decoded FPGA status flags
+struct ide_phy_status_t {
+    bool valid;
+    uint32_t time;
+    uint8_t raw;
+    bool data_dir;      // Data buffer in write to IDE direction
+    bool rx_done;       // Received data block is ready for reading
+    bool tx_canwrite;   // Data buffer has space for next block
+    bool tx_done;       // Host has read all data
+    bool ide_rst;       // IDE bus reset has occurred
+    bool ide_srst;      // IDE software reset has occurred
+    bool ide_cmd;       // IDE command register has been written
+};
+
 static struct {
     ide_phy_config_t config;
     bool transfer_running;
@@ -36,12 +58,60 @@ static struct {
     int crc_errors;
     uint32_t block_crc0;
     uint32_t block_crc1;
+
+    // Data block transfer to FPGA started by ide_phy_write_block_async()
+    bool write_pending;
+    fpga_cmd_handle_t write_handle;
+    uint32_t write_crc;
+
+    // Status snapshot shared by the helpers below, invalidated by every
+    // command that can change FPGA status.
+    ide_phy_status_t status;
+    ide_phy_status_stats_t status_stats;
 } g_ide_phy;
 
 #define BLOCK_CRC_VALID 0x10000
 
 extern bool g_ignore_cmd_interrupt;
 
+// Get FPGA status, reading it only if the previous snapshot is not recent
+static const ide_phy_status_t &get_status()
+{
+    ide_phy_status_t &st = g_ide_phy.status;
+    uint32_t now = micros();
+    if (st.valid && (uint32_t)(now - st.time) < IDE_PHY_STATUS_MAX_AGE_US)
+    {
+        g_ide_phy.status_stats.saved++;
+        return st;
+    }
+
+    uint8_t status = fpga_read_status();
+    g_ide_phy.status_stats.reads++;
+    st.valid = true;
+    st.time = now;
+    st.raw = status;
+    st.data_dir    = (status & FPGA_STATUS_DATA_DIR);
+    st.rx_done     = (status & FPGA_STATUS_RX_DONE);
+    st.tx_canwrite = (status & FPGA_STATUS_TX_CANWRITE);
+    st.tx_done     = (status & FPGA_STATUS_TX_DONE);
+    st.ide_rst     = (status & FPGA_STATUS_IDE_RST);
+    st.ide_srst    = (status & FPGA_STATUS_IDE_SRST);
+    st.ide_cmd     = (status & FPGA_STATUS_IDE_CMD);
+    return st;
+}
+
+// Send command to FPGA and invalidate the status snapshot
+static void phy_wrcmd(uint8_t cmd, const uint8_t *payload, size_t payload_len)
+{
+    g_ide_phy.status.valid = false;
+    fpga_wrcmd(cmd, payload, payload_len);
+}
+
+void ide_phy_get_status_stats(ide_phy_status_stats_t *stats)
+{
+    *stats = g_ide_phy.status_stats;
+}
+
 // Compare the CRC we calculated with DMA when writing to FPGA
 // against the CRC received from the host in UltraDMA mode.
 static void verify_crc(uint32_t *block_crc)
@@ -63,6 +133,33 @@ static void verify_crc(uint32_t *block_crc)
     *block_crc = 0;
 }
 
+// Wait for previous ide_phy_write_block_async() to complete and store its CRC
+static void finish_write_block()
+{
+    if (!g_ide_phy.write_pending)
+    {
+        return;
+    }
+
+    fpga_wait_cmd(g_ide_phy.write_handle);
+    g_ide_phy.write_pending = false;
+
+    if (g_ide_phy.write_crc != 0xDEADBEEF)
+    {
+        // There can be up to two blocks in FPGA buffers, so store their CRCs separately.
+        // Note: for unaligned buffers crc will stay 0xDEADBEEF, ignore it.
+        g_ide_phy.block_crc1 = g_ide_phy.block_crc0;
+        g_ide_phy.block_crc0 = g_ide_phy.write_crc | BLOCK_CRC_VALID;
+    }
+}
+
+// Reading FPGA status would block on the QSPI bus until the data block
+// DMA started by ide_phy_write_block_async() has completed.
+static bool write_in_flight()
+{
+    return g_ide_phy.write_pending && !fpga_cmd_is_done(g_ide_phy.write_handle);
+}
+
 static ide_phy_capabilities_t g_ide_phy_capabilities = {
     // ICE5LP1K has 8 kB of RAM, we use it as 2x 4096 byte buffers
     .max_blocksize = 4096,
@@ -73,6 +170,10 @@ static ide_phy_capabilities_t g_ide_phy_capabilities = {
     .min_pio_cycletime_with_iordy = 180,
 
     .max_udma_mode = 0,
+
+    // FPGA protocol version 5 only keeps the latest value written to each register,
+    // so the high order bytes of 48-bit commands are not available.
+    .supports_lba48 = false,
 };
 
 // Reset the IDE phy
@@ -80,6 +181,7 @@ void ide_phy_reset(const ide_phy_config_t* config)
 {
     g_ide_phy.config = *config;
     g_ide_phy.watchdog_error = false;
+    finish_write_block();
 
     uint8_t cfg = 0;
     if (config->enable_dev0)       cfg |= 0x01;
@@ -88,7 +190,7 @@ void ide_phy_reset(const ide_phy_config_t* config)
     if (config->atapi_dev0)        cfg |= 0x08;
     if (config->atapi_dev1)        cfg |= 0x10;
     if (config->disable_iordy)     cfg |= 0x20;
-    fpga_wrcmd(FPGA_CMD_SET_IDE_PHY_CFG, &cfg, 1);
+    phy_wrcmd(FPGA_CMD_SET_IDE_PHY_CFG, &cfg, 1);
 }
 
 void ide_phy_reset_from_watchdog()
@@ -100,44 +202,43 @@ void ide_phy_reset_from_watchdog()
 // Returns IDE_EVENT_NONE if no new events.
 ide_event_t ide_phy_get_events()
 {
-    uint8_t status;
-    fpga_rdcmd(FPGA_CMD_READ_STATUS, &status, 1);
+    const ide_phy_status_t &status = get_status();
 
     if (g_ide_phy.watchdog_error)
     {
         ide_phy_reset(&g_ide_phy.config);
         return IDE_EVENT_HWRST;
     }
-    else if (status & FPGA_STATUS_IDE_RST)
+    else if (status.ide_rst)
     {
         uint8_t clrmask = FPGA_STATUS_IDE_RST;
-        fpga_wrcmd(FPGA_CMD_CLR_IRQ_FLAGS, &clrmask, 1);
+        phy_wrcmd(FPGA_CMD_CLR_IRQ_FLAGS, &clrmask, 1);
         return IDE_EVENT_HWRST;
     }
-    else if (status & FPGA_STATUS_IDE_SRST)
+    else if (status.ide_srst)
     {
         // Check if software reset state has ended
         ide_registers_t regs;
-        fpga_rdcmd(FPGA_CMD_READ_IDE_REGS, (uint8_t*)&regs, sizeof(regs));
+        fpga_rdcmd(FPGA_CMD_READ_IDE_REGS, (uint8_t*)&regs, offsetof(ide_registers_t, hob));
 
         if (!(regs.device_control & IDE_DEVCTRL_SRST))
         {
             uint8_t clrmask = FPGA_STATUS_IDE_SRST;
-            fpga_wrcmd(FPGA_CMD_CLR_IRQ_FLAGS, &clrmask, 1);
+            phy_wrcmd(FPGA_CMD_CLR_IRQ_FLAGS, &clrmask, 1);
             return IDE_EVENT_SWRST;
         }
     }
-    else if (status & FPGA_STATUS_IDE_CMD)
+    else if (status.ide_cmd)
     {
         uint8_t clrmask = FPGA_STATUS_IDE_CMD;
-        fpga_wrcmd(FPGA_CMD_CLR_IRQ_FLAGS, &clrmask, 1);
+        phy_wrcmd(FPGA_CMD_CLR_IRQ_FLAGS, &clrmask, 1);
         return IDE_EVENT_CMD;
     }
     else if (g_ide_phy.transfer_running)
     {
-        if (status & FPGA_STATUS_DATA_DIR)
+        if (status.data_dir)
         {
-            if (status & FPGA_STATUS_TX_DONE)
+            if (status.tx_done)
             {
                 g_ide_phy.transfer_running = false;
                 return IDE_EVENT_DATA_TRANSFER_DONE;
@@ -145,7 +246,7 @@ ide_event_t ide_phy_get_events()
         }
         else
         {
-            if (status & FPGA_STATUS_RX_DONE)
+            if (status.rx_done)
             {
                 g_ide_phy.transfer_running = false;
                 return IDE_EVENT_DATA_TRANSFER_DONE;
@@ -159,39 +260,41 @@ ide_event_t ide_phy_get_events()
 bool ide_phy_is_command_interrupted()
 {
     if (g_ide_phy.watchdog_error) return true;
+    if (write_in_flight()) return false;
 
-    uint8_t status;
-    fpga_rdcmd(FPGA_CMD_READ_STATUS, &status, 1);
+    const ide_phy_status_t &status = get_status();
 
-    if (status & FPGA_STATUS_IDE_RST) return true;
-    if (status & FPGA_STATUS_IDE_SRST) return true;
-    if (!g_ignore_cmd_interrupt && (status & FPGA_STATUS_IDE_CMD)) return true;
+    if (status.ide_rst) return true;
+    if (status.ide_srst) return true;
+    if (!g_ignore_cmd_interrupt && status.ide_cmd) return true;
     return false;
 }
 
 // Get current state of IDE registers
 void ide_phy_get_regs(ide_registers_t *regs)
 {
-    fpga_rdcmd(FPGA_CMD_READ_IDE_REGS, (uint8_t*)regs, sizeof(*regs));
+    fpga_rdcmd(FPGA_CMD_READ_IDE_REGS, (uint8_t*)regs, offsetof(ide_registers_t, hob));
+    memset(&regs->hob, 0, sizeof(regs->hob));
     // dbgmsg("ide_phy_get_regs(", bytearray((const uint8_t*)regs, sizeof(*regs)), ")");
 }
 
 // Set current state of IDE registers
 void ide_phy_set_regs(const ide_registers_t *regs)
 {
-    fpga_wrcmd(FPGA_CMD_WRITE_IDE_REGS, (const uint8_t*)regs, sizeof(*regs));
+    phy_wrcmd(FPGA_CMD_WRITE_IDE_REGS, (const uint8_t*)regs, offsetof(ide_registers_t, hob));
 }
 
 // Data writes to IDE bus
 void ide_phy_start_write(uint32_t blocklen, int udma_mode)
 {
+    finish_write_block();
     // dbgmsg("ide_phy_start_write(", (int)blocklen, ", ", udma_mode, ")");
     g_ide_phy.crc_errors = 0;
     g_ide_phy.block_crc1 = g_ide_phy.block_crc0 = 0;
     uint16_t last_word_idx = (blocklen + 1) / 2 - 1;
     if (udma_mode < 0)
     {
-        fpga_wrcmd(FPGA_CMD_START_WRITE, (const uint8_t*)&last_word_idx, 2);
+        phy_wrcmd(FPGA_CMD_START_WRITE, (const uint8_t*)&last_word_idx, 2);
         g_ide_phy.udma_mode = -1;
     }
     else
@@ -199,37 +302,48 @@ void ide_phy_start_write(uint32_t blocklen, int udma_mode)
         uint8_t arg[3] = {(uint8_t)udma_mode,
                           (uint8_t)(last_word_idx),
                           (uint8_t)((last_word_idx) >> 8)};
-        fpga_wrcmd(FPGA_CMD_START_UDMA_WRITE, arg, 3);
+        phy_wrcmd(FPGA_CMD_START_UDMA_WRITE, arg, 3);
         g_ide_phy.udma_mode = udma_mode;
     }
 }
 
 bool ide_phy_can_write_block()
 {
-    uint8_t status;
-    fpga_rdcmd(FPGA_CMD_READ_STATUS, &status, 1);
+    if (write_in_flight())
+    {
+        // Let the caller do other work, status is checked on the next poll
+        return false;
+    }
+
+    const ide_phy_status_t &status = get_status();
 
-    if (!(status & FPGA_STATUS_DATA_DIR))
+    if (!status.data_dir)
     {
-        if (status & (FPGA_STATUS_IDE_RST | FPGA_STATUS_IDE_SRST | FPGA_STATUS_IDE_CMD))
+        if (status.ide_rst || status.ide_srst || status.ide_cmd)
         {
-            dbgmsg("---- ide_phy_can_write_block(): Host aborted request, FPGA status ", status);
+            dbgmsg("---- ide_phy_can_write_block(): Host aborted request, FPGA status ", status.raw);
         }
         else
         {
-            logmsg("---- ide_phy_can_write_block(): Wrong data buffer direction, FPGA status ", status);
+            logmsg("---- ide_phy_can_write_block(): Wrong data buffer direction, FPGA status ", status.raw);
         }
 
         return false;
     }
 
-    assert(status & FPGA_STATUS_DATA_DIR);
-    return (status & FPGA_STATUS_TX_CANWRITE);
+    return status.tx_canwrite;
 }
 
 void ide_phy_write_block(const uint8_t *buf, uint32_t blocklen)
+{
+    ide_phy_write_block_async(buf, blocklen);
+    finish_write_block();
+}
+
+void ide_phy_write_block_async(const uint8_t *buf, uint32_t blocklen)
 {
     // dbgmsg("ide_phy_write_block(", bytearray(buf, blocklen), ")");
+    finish_write_block();
 
     if (g_ide_phy.udma_mode >= 0 && (g_ide_phy.block_crc1 & BLOCK_CRC_VALID))
     {
@@ -244,24 +358,27 @@ void ide_phy_write_block(const uint8_t *buf, uint32_t blocklen)
         blocklen++;
     }
 
-    uint32_t crc = 0xDEADBEEF;
-    fpga_wrcmd(FPGA_CMD_WRITE_DATABUF, buf, blocklen, &crc);
+    // CRC is stored when the FPGA command finishes
+    g_ide_phy.write_crc = 0xDEADBEEF;
+    g_ide_phy.status.valid = false;
+    g_ide_phy.write_handle = fpga_wrcmd_async(FPGA_CMD_WRITE_DATABUF, buf, blocklen, &g_ide_phy.write_crc);
+    g_ide_phy.write_pending = true;
     g_ide_phy.transfer_running = true;
+}
 
-    if (crc != 0xDEADBEEF)
+void ide_phy_wait_buffer(const uint8_t *buf, uint32_t len)
+{
+    if (g_ide_phy.write_pending)
     {
-        // There can be up to two blocks in FPGA buffers, so store their CRCs separately.
-        // Note: for unaligned buffers crc will stay 0xDEADBEEF, ignore it.
-        g_ide_phy.block_crc1 = g_ide_phy.block_crc0;
-        g_ide_phy.block_crc0 = crc | BLOCK_CRC_VALID;
+        fpga_wait_buffer(buf, len);
     }
 }
 
 bool ide_phy_is_write_finished()
 {
-    uint8_t status;
-    fpga_rdcmd(FPGA_CMD_READ_STATUS, &status, 1);
-    if (!(status & FPGA_STATUS_DATA_DIR) || (status & FPGA_STATUS_TX_DONE))
+    finish_write_block();
+    const ide_phy_status_t &status = get_status();
+    if (!status.data_dir || status.tx_done)
     {
         // dbgmsg("ide_phy_is_write_finished() => true");
 
@@ -284,13 +401,14 @@ bool ide_phy_is_write_finished()
 void ide_phy_start_read(uint32_t blocklen, int udma_mode)
 {
     // dbgmsg("ide_phy_start_read(", (int)blocklen, ", ", udma_mode, ")");
+    finish_write_block();
     g_ide_phy.crc_errors = 0;
     g_ide_phy.block_crc1 = g_ide_phy.block_crc0 = 0;
     uint16_t last_word_idx = (blocklen + 1) / 2 - 1;
     if (udma_mode < 0)
     {
         // Transfer in PIO mode
-        fpga_wrcmd(FPGA_CMD_START_READ, (const uint8_t*)&last_word_idx, 2);
+        phy_wrcmd(FPGA_CMD_START_READ, (const uint8_t*)&last_word_idx, 2);
         g_ide_phy.udma_mode = -1;
         ide_phy_assert_irq(IDE_STATUS_DEVRDY | IDE_STATUS_DATAREQ);
     }
@@ -300,7 +418,7 @@ void ide_phy_start_read(uint32_t blocklen, int udma_mode)
         uint8_t arg[3] = {(uint8_t)udma_mode,
                           (uint8_t)(last_word_idx),
                           (uint8_t)((last_word_idx) >> 8)};
-        fpga_wrcmd(FPGA_CMD_START_UDMA_READ, arg, 3);
+        phy_wrcmd(FPGA_CMD_START_UDMA_READ, arg, 3);
         g_ide_phy.udma_mode = udma_mode;
     }
 
@@ -309,10 +427,9 @@ void ide_phy_start_read(uint32_t blocklen, int udma_mode)
 
 bool ide_phy_can_read_block()
 {
-    uint8_t status;
-    fpga_rdcmd(FPGA_CMD_READ_STATUS, &status, 1);
-    assert(!(status & FPGA_STATUS_DATA_DIR));
-    return (status & FPGA_STATUS_RX_DONE);
+    const ide_phy_status_t &status = get_status();
+    assert(!status.data_dir);
+    return status.rx_done;
 }
 
 void ide_phy_read_block(uint8_t *buf, uint32_t blocklen, bool continue_transfer)
@@ -320,6 +437,7 @@ void ide_phy_read_block(uint8_t *buf, uint32_t blocklen, bool continue_transfer)
     // dbgmsg("ide_phy_read_block, cont = ", (int)continue_transfer);
     uint8_t cmd = continue_transfer ? FPGA_CMD_READ_DATABUF_CONT : FPGA_CMD_READ_DATABUF;
     uint32_t our_crc = 0xDEADBEEF;
+    g_ide_phy.status.valid = false;
     fpga_rdcmd(cmd, buf, blocklen, &our_crc);
     // dbgmsg("ide_phy_read_block(", bytearray(buf, blocklen), ")");
 
@@ -338,9 +456,11 @@ void ide_phy_read_block(uint8_t *buf, uint32_t blocklen, bool continue_transfer)
 
 void ide_phy_stop_transfers(int *crc_errors)
 {
+    finish_write_block();
+
     // Configure buffer in write mode but don't write any data => transfer stopped
     uint16_t arg = 65535;
-    fpga_wrcmd(FPGA_CMD_START_WRITE, (const uint8_t*)&arg, 2);
+    phy_wrcmd(FPGA_CMD_START_WRITE, (const uint8_t*)&arg, 2);
     // dbgmsg("ide_phy_stop_transfers()");
     g_ide_phy.transfer_running = false;
     g_ide_phy.udma_mode = -1;
@@ -351,13 +471,13 @@ void ide_phy_stop_transfers(int *crc_errors)
 // Assert IDE interrupt and set status register
 void ide_phy_assert_irq(uint8_t ide_status)
 {
-    fpga_wrcmd(FPGA_CMD_ASSERT_IRQ, &ide_status, 1);
+    phy_wrcmd(FPGA_CMD_ASSERT_IRQ, &ide_status, 1);
     // dbgmsg("ide_phy_assert_irq(", ide_status, ")");
 }
 
 void ide_phy_set_signals(uint8_t signals)
 {
-    fpga_wrcmd(FPGA_CMD_WRITE_IDE_SIGNALS, &signals, 1);
+    phy_wrcmd(FPGA_CMD_WRITE_IDE_SIGNALS, &signals, 1);
 }
 
 uint8_t ide_phy_get_signals()
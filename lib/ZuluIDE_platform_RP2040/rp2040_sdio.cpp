@@ -42,6 +42,7 @@
 #define SDIO_DATA_SM 1
 #define SDIO_DMA_CH 0
 #define SDIO_DMA_CHB 1
+#define SDIO_DMA_CHC 4
 
 // Maximum number of 512 byte blocks to transfer in one request
 #define SDIO_MAX_BLOCKS 256
@@ -58,10 +59,12 @@ static struct {
     sdio_transfer_state_t transfer_state;
     uint32_t transfer_start_time;
     uint32_t *data_buf;
+    uint32_t block_size; // Block size of current reception in bytes
     uint32_t blocks_done; // Number of blocks transferred so far
     uint32_t total_blocks; // Total number of blocks to transfer
     uint32_t blocks_checksumed; // Number of blocks that have had CRC calculated
     uint32_t checksum_errors; // Number of checksum errors detected
+    bool pause_at_end; // SD clock is stopped after last block of reception
 
     // Variables for block writes
     uint64_t next_wr_block_checksum;
@@ -79,6 +82,10 @@ static struct {
         uint32_t top;
         uint32_t bottom;
     } received_checksums[SDIO_MAX_BLOCKS];
+
+    // Written by third DMA channel to PIO CTRL clear alias after each
+    // block descriptor. The entry for the end marker stops the SD clock.
+    uint32_t clock_stop_masks[SDIO_MAX_BLOCKS * 2 + 1];
 } g_sdio;
 
 void rp2040_sdio_dma_irq();
@@ -115,46 +122,62 @@ static const uint8_t crc7_table[256] = {
 // When the SDIO bus operates in 4-bit mode, the CRC16 algorithm
 // is applied to each line separately and generates total of
 // 4 x 16 = 64 bits of checksum.
+// Process one 32-bit word, which contains 8 bits for each of the 4 lines.
+// The 64-bit CRC state is kept in two 32-bit halves because Cortex-M0+
+// has no 64-bit shifts. With the state written as hi:lo, the update is:
+//   out = hi ^ (hi >> 16) ^ (in >> 16)  - outgoing bits fed back with 4 bit delay
+//   x   = out ^ in
+//   crc = (crc << 32) ^ x ^ (x << 20) ^ (x << 48)  - taps of x^16 + x^12 + x^5 + 1
+static inline __attribute__((always_inline))
+void sdio_crc16_4bit_update(uint32_t &hi, uint32_t &lo, uint32_t word)
+{
+    // Reverse the bytes because SDIO protocol is big-endian.
+    uint32_t data_in = __builtin_bswap32(word);
+    uint32_t x = hi ^ (hi >> 16) ^ (data_in >> 16) ^ data_in;
+    hi = lo ^ (x >> 12) ^ (x << 16);
+    lo = x ^ (x << 20);
+}
+
 __attribute__((optimize("O3")))
 uint64_t sdio_crc16_4bit_checksum(uint32_t *data, uint32_t num_words)
 {
-    uint64_t crc = 0;
+    uint32_t hi = 0;
+    uint32_t lo = 0;
     uint32_t *end = data + num_words;
-    while (data < end)
+    while (data + 4 <= end)
     {
-        for (int unroll = 0; unroll < 4; unroll++)
-        {
-            // Each 32-bit word contains 8 bits per line.
-            // Reverse the bytes because SDIO protocol is big-endian.
-            uint32_t data_in = __builtin_bswap32(*data++);
-
-            // Shift out 8 bits for each line
-            uint32_t data_out = crc >> 32;
-            crc <<= 32;
-
-            // XOR outgoing data to itself with 4 bit delay
-            data_out ^= (data_out >> 16);
-
-            // XOR incoming data to outgoing data with 4 bit delay
-            data_out ^= (data_in >> 16);
+        sdio_crc16_4bit_update(hi, lo, data[0]);
+        sdio_crc16_4bit_update(hi, lo, data[1]);
+        sdio_crc16_4bit_update(hi, lo, data[2]);
+        sdio_crc16_4bit_update(hi, lo, data[3]);
+        data += 4;
+    }
 
-            // XOR outgoing and incoming data to accumulator at each tap
-            uint64_t xorred = data_out ^ data_in;
-            crc ^= xorred;
-            crc ^= xorred << (5 * 4);
-            crc ^= xorred << (12 * 4);
-        }
+    // Short register reads such as SCR are not a multiple of 4 words
+    while (data < end)
+    {
+        sdio_crc16_4bit_update(hi, lo, *data++);
     }
 
-    return crc;
+    return ((uint64_t)hi << 32) | lo;
 }
 
 /*******************************************************
  * Basic SDIO command execution
  *******************************************************/
 
+// Total number of commands sent, for benchmarking
+static uint32_t g_sdio_command_count;
+
+uint32_t rp2040_sdio_get_command_count()
+{
+    return g_sdio_command_count;
+}
+
 static void sdio_send_command(uint8_t command, uint32_t arg, uint8_t response_bits)
 {
+    g_sdio_command_count++;
+
     // dbgmsg("SDIO Command: ", (int)command, " arg ", arg);
 
     // Format the arguments in the way expected by the PIO code.
@@ -369,31 +392,38 @@ sdio_status_t rp2040_sdio_command_R3(uint8_t command, uint32_t arg, uint32_t *re
  * Data reception from SD card
  *******************************************************/
 
-sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks)
+sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks, uint32_t block_size, bool pause_at_end)
 {
     // Buffer must be aligned
     assert(((uint32_t)buffer & 3) == 0 && num_blocks <= SDIO_MAX_BLOCKS);
+    assert((block_size & 7) == 0 && block_size <= SDIO_BLOCK_SIZE);
 
     g_sdio.transfer_state = SDIO_RX;
     g_sdio.transfer_start_time = millis();
     g_sdio.data_buf = (uint32_t*)buffer;
+    g_sdio.block_size = block_size;
     g_sdio.blocks_done = 0;
     g_sdio.total_blocks = num_blocks;
     g_sdio.blocks_checksumed = 0;
     g_sdio.checksum_errors = 0;
+    g_sdio.pause_at_end = pause_at_end;
 
-    // Create DMA block descriptors to store each block of 512 bytes of data to buffer
+    // Create DMA block descriptors to store each block of data to buffer
     // and then 8 bytes to g_sdio.received_checksums.
     for (int i = 0; i < num_blocks; i++)
     {
-        g_sdio.dma_blocks[i * 2].write_addr = buffer + i * SDIO_BLOCK_SIZE;
-        g_sdio.dma_blocks[i * 2].transfer_count = SDIO_BLOCK_SIZE / sizeof(uint32_t);
+        g_sdio.dma_blocks[i * 2].write_addr = buffer + i * block_size;
+        g_sdio.dma_blocks[i * 2].transfer_count = block_size / sizeof(uint32_t);
 
         g_sdio.dma_blocks[i * 2 + 1].write_addr = &g_sdio.received_checksums[i];
         g_sdio.dma_blocks[i * 2 + 1].transfer_count = 2;
+
+        g_sdio.clock_stop_masks[i * 2] = 0;
+        g_sdio.clock_stop_masks[i * 2 + 1] = 0;
     }
     g_sdio.dma_blocks[num_blocks * 2].write_addr = 0;
     g_sdio.dma_blocks[num_blocks * 2].transfer_count = 0;
+    g_sdio.clock_stop_masks[num_blocks * 2] = (1 << (PIO_CTRL_SM_ENABLE_LSB + SDIO_CMD_SM));
 
     // Configure first DMA channel for reading from the PIO RX fifo
     dma_channel_config dmacfg = dma_channel_get_default_config(SDIO_DMA_CH);
@@ -411,15 +441,36 @@ sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks)
     channel_config_set_read_increment(&dmacfg, true);
     channel_config_set_write_increment(&dmacfg, true);
     channel_config_set_ring(&dmacfg, true, 3);
+    if (pause_at_end)
+    {
+        channel_config_set_chain_to(&dmacfg, SDIO_DMA_CHC);
+    }
     dma_channel_configure(SDIO_DMA_CHB, &dmacfg, &dma_hw->ch[SDIO_DMA_CH].al1_write_addr,
         g_sdio.dma_blocks, 2, false);
 
+    if (pause_at_end)
+    {
+        // The SD card keeps sending blocks of a multi-block read as long as it gets
+        // clock pulses. To keep the read open for continuing later, the clock must
+        // stop before the next block starts. Software is too slow for that, so a
+        // third DMA channel disables the clock state machine when the second
+        // channel loads the end marker.
+        dmacfg = dma_channel_get_default_config(SDIO_DMA_CHC);
+        channel_config_set_transfer_data_size(&dmacfg, DMA_SIZE_32);
+        channel_config_set_read_increment(&dmacfg, true);
+        channel_config_set_write_increment(&dmacfg, false);
+        // Transfer count is reloaded on every trigger while the read address
+        // keeps incrementing, so each descriptor gets its own mask word.
+        dma_channel_configure(SDIO_DMA_CHC, &dmacfg, hw_clear_alias(&SDIO_PIO->ctrl),
+            g_sdio.clock_stop_masks, 1, false);
+    }
+
     // Initialize PIO state machine
     pio_sm_init(SDIO_PIO, SDIO_DATA_SM, g_sdio.pio_data_rx_offset, &g_sdio.pio_cfg_data_rx);
     pio_sm_set_consecutive_pindirs(SDIO_PIO, SDIO_DATA_SM, SDIO_D0, 4, false);
 
     // Write number of nibbles to receive to Y register
-    pio_sm_put(SDIO_PIO, SDIO_DATA_SM, SDIO_BLOCK_SIZE * 2 + 16 - 1);
+    pio_sm_put(SDIO_PIO, SDIO_DATA_SM, block_size * 2 + 16 - 1);
     pio_sm_exec(SDIO_PIO, SDIO_DATA_SM, pio_encode_out(pio_y, 32));
 
     // Enable RX FIFO join because we don't need the TX FIFO during transfer.
@@ -440,8 +491,9 @@ static void sdio_verify_rx_checksums(uint32_t maxcount)
     {
         // Calculate checksum from received data
         int blockidx = g_sdio.blocks_checksumed++;
-        uint64_t checksum = sdio_crc16_4bit_checksum(g_sdio.data_buf + blockidx * SDIO_WORDS_PER_BLOCK,
-                                                     SDIO_WORDS_PER_BLOCK);
+        uint32_t block_words = g_sdio.block_size / sizeof(uint32_t);
+        uint64_t checksum = sdio_crc16_4bit_checksum(g_sdio.data_buf + blockidx * block_words,
+                                                     block_words);
 
         // Convert received checksum to little-endian format
         uint32_t top = __builtin_bswap32(g_sdio.received_checksums[blockidx].top);
@@ -469,14 +521,15 @@ sdio_status_t rp2040_sdio_rx_poll(uint32_t *bytes_complete)
     }
     else
     {
-        // Use the idle time to calculate checksums
-        sdio_verify_rx_checksums(4);
+        // Use the idle time to calculate checksums. One block per call
+        // keeps the caller's callback running while data is arriving.
+        sdio_verify_rx_checksums(1);
 
         // Check how many DMA control blocks have been consumed
         uint32_t dma_ctrl_block_count = (dma_hw->ch[SDIO_DMA_CHB].read_addr - (uint32_t)&g_sdio.dma_blocks);
         dma_ctrl_block_count /= sizeof(g_sdio.dma_blocks[0]);
 
-        // Compute how many complete 512 byte SDIO blocks have been transferred
+        // Compute how many complete SDIO blocks have been transferred
         // When transfer ends, dma_ctrl_block_count == g_sdio.total_blocks * 2 + 1
         g_sdio.blocks_done = (dma_ctrl_block_count - 1) / 2;
 
@@ -488,7 +541,7 @@ sdio_status_t rp2040_sdio_rx_poll(uint32_t *bytes_complete)
 
     if (bytes_complete)
     {
-        *bytes_complete = g_sdio.blocks_done * SDIO_BLOCK_SIZE;
+        *bytes_complete = g_sdio.blocks_done * g_sdio.block_size;
     }
 
     if (g_sdio.transfer_state == SDIO_IDLE)
@@ -737,19 +790,44 @@ sdio_status_t rp2040_sdio_tx_poll(uint32_t *bytes_complete)
     return SDIO_BUSY;
 }
 
+bool rp2040_sdio_rx_can_continue()
+{
+    if (!g_sdio.pause_at_end || g_sdio.transfer_state != SDIO_IDLE ||
+        (SDIO_PIO->ctrl & (1 << (PIO_CTRL_SM_ENABLE_LSB + SDIO_CMD_SM))))
+    {
+        // Clock was not stopped by DMA
+        return false;
+    }
+
+    // Data state machine should still be waiting for start bit of next block.
+    // If the card started the block before clock stopped, data is already lost.
+    uint32_t pc = pio_sm_get_pc(SDIO_PIO, SDIO_DATA_SM) - g_sdio.pio_data_rx_offset;
+    return pc == 1 && pio_sm_is_rx_fifo_empty(SDIO_PIO, SDIO_DATA_SM);
+}
+
+void rp2040_sdio_clock_resume()
+{
+    hw_set_bits(&SDIO_PIO->ctrl, 1 << (PIO_CTRL_SM_ENABLE_LSB + SDIO_CMD_SM));
+}
+
 // Force everything to idle state
 sdio_status_t rp2040_sdio_stop()
 {
     dma_channel_abort(SDIO_DMA_CH);
     dma_channel_abort(SDIO_DMA_CHB);
+    dma_channel_abort(SDIO_DMA_CHC);
     dma_set_irq1_channel_mask_enabled(1 << SDIO_DMA_CHB, 0);
     pio_sm_set_enabled(SDIO_PIO, SDIO_DATA_SM, false);
     pio_sm_set_consecutive_pindirs(SDIO_PIO, SDIO_DATA_SM, SDIO_D0, 4, false);
     g_sdio.transfer_state = SDIO_IDLE;
+    g_sdio.pause_at_end = false;
+
+    // Clock may have been stopped at the end of reception
+    rp2040_sdio_clock_resume();
     return SDIO_OK;
 }
 
-void rp2040_sdio_init(int clock_divider)
+void rp2040_sdio_init(int clock_divider, bool high_speed)
 {
     // Mark resources as being in use, unless it has been done already.
     static bool resources_claimed = false;
@@ -759,6 +837,7 @@ void rp2040_sdio_init(int clock_divider)
         pio_sm_claim(SDIO_PIO, SDIO_DATA_SM);
         dma_channel_claim(SDIO_DMA_CH);
         dma_channel_claim(SDIO_DMA_CHB);
+        dma_channel_claim(SDIO_DMA_CHC);
         resources_claimed = true;
     }
 
@@ -766,6 +845,7 @@ void rp2040_sdio_init(int clock_divider)
 
     dma_channel_abort(SDIO_DMA_CH);
     dma_channel_abort(SDIO_DMA_CHB);
+    dma_channel_abort(SDIO_DMA_CHC);
     pio_sm_set_enabled(SDIO_PIO, SDIO_CMD_SM, false);
     pio_sm_set_enabled(SDIO_PIO, SDIO_DATA_SM, false);
 
@@ -773,8 +853,17 @@ void rp2040_sdio_init(int clock_divider)
     pio_clear_instruction_memory(SDIO_PIO);
 
     // Command & clock state machine
-    g_sdio.pio_cmd_clk_offset = pio_add_program(SDIO_PIO, &sdio_cmd_clk_program);
-    pio_sm_config cfg = sdio_cmd_clk_program_get_default_config(g_sdio.pio_cmd_clk_offset);
+    pio_sm_config cfg;
+    if (high_speed)
+    {
+        g_sdio.pio_cmd_clk_offset = pio_add_program(SDIO_PIO, &sdio_cmd_clk_hs_program);
+        cfg = sdio_cmd_clk_hs_program_get_default_config(g_sdio.pio_cmd_clk_offset);
+    }
+    else
+    {
+        g_sdio.pio_cmd_clk_offset = pio_add_program(SDIO_PIO, &sdio_cmd_clk_program);
+        cfg = sdio_cmd_clk_program_get_default_config(g_sdio.pio_cmd_clk_offset);
+    }
     sm_config_set_out_pins(&cfg, SDIO_CMD, 1);
     sm_config_set_in_pins(&cfg, SDIO_CMD);
     sm_config_set_set_pins(&cfg, SDIO_CMD, 1);
@@ -790,16 +879,32 @@ void rp2040_sdio_init(int clock_divider)
     pio_sm_set_enabled(SDIO_PIO, SDIO_CMD_SM, true);
 
     // Data reception program
-    g_sdio.pio_data_rx_offset = pio_add_program(SDIO_PIO, &sdio_data_rx_program);
-    g_sdio.pio_cfg_data_rx = sdio_data_rx_program_get_default_config(g_sdio.pio_data_rx_offset);
+    if (high_speed)
+    {
+        g_sdio.pio_data_rx_offset = pio_add_program(SDIO_PIO, &sdio_data_rx_hs_program);
+        g_sdio.pio_cfg_data_rx = sdio_data_rx_hs_program_get_default_config(g_sdio.pio_data_rx_offset);
+    }
+    else
+    {
+        g_sdio.pio_data_rx_offset = pio_add_program(SDIO_PIO, &sdio_data_rx_program);
+        g_sdio.pio_cfg_data_rx = sdio_data_rx_program_get_default_config(g_sdio.pio_data_rx_offset);
+    }
     sm_config_set_in_pins(&g_sdio.pio_cfg_data_rx, SDIO_D0);
     sm_config_set_in_shift(&g_sdio.pio_cfg_data_rx, false, true, 32);
     sm_config_set_out_shift(&g_sdio.pio_cfg_data_rx, false, true, 32);
     sm_config_set_clkdiv_int_frac(&g_sdio.pio_cfg_data_rx, clock_divider, 0);
 
     // Data transmission program
-    g_sdio.pio_data_tx_offset = pio_add_program(SDIO_PIO, &sdio_data_tx_program);
-    g_sdio.pio_cfg_data_tx = sdio_data_tx_program_get_default_config(g_sdio.pio_data_tx_offset);
+    if (high_speed)
+    {
+        g_sdio.pio_data_tx_offset = pio_add_program(SDIO_PIO, &sdio_data_tx_hs_program);
+        g_sdio.pio_cfg_data_tx = sdio_data_tx_hs_program_get_default_config(g_sdio.pio_data_tx_offset);
+    }
+    else
+    {
+        g_sdio.pio_data_tx_offset = pio_add_program(SDIO_PIO, &sdio_data_tx_program);
+        g_sdio.pio_cfg_data_tx = sdio_data_tx_program_get_default_config(g_sdio.pio_data_tx_offset);
+    }
     sm_config_set_in_pins(&g_sdio.pio_cfg_data_tx, SDIO_D0);
     sm_config_set_set_pins(&g_sdio.pio_cfg_data_tx, SDIO_D0, 4);
     sm_config_set_out_pins(&g_sdio.pio_cfg_data_tx, SDIO_D0, 4);
@@ -52,14 +52,27 @@ sdio_status_t rp2040_sdio_command_R2(uint8_t command, uint32_t arg, uint8_t *res
 // Execute a command that has 48-bit reply but without CRC (response R3)
 sdio_status_t rp2040_sdio_command_R3(uint8_t command, uint32_t arg, uint32_t *response);
 
+// Get total number of commands sent to the card since boot
+uint32_t rp2040_sdio_get_command_count();
+
 // Start transferring data from SD card to memory buffer
-// Transfer block size is always 512 bytes.
-sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks);
+// Block size is 512 bytes for data transfers, register reads such as
+// CMD6 status and SCR use shorter blocks. Block size must be a multiple of 8 bytes.
+// If pause_at_end is true, SD clock is stopped after the last block so that
+// a multi-block read can be continued with another rp2040_sdio_rx_start().
+sdio_status_t rp2040_sdio_rx_start(uint8_t *buffer, uint32_t num_blocks,
+                                   uint32_t block_size = SDIO_BLOCK_SIZE, bool pause_at_end = false);
 
 // Check if reception is complete
 // Returns SDIO_BUSY while transferring, SDIO_OK when done and error on failure.
 sdio_status_t rp2040_sdio_rx_poll(uint32_t *bytes_complete = nullptr);
 
+// Check if reception paused by pause_at_end can be continued without data loss
+bool rp2040_sdio_rx_can_continue();
+
+// Restart SD clock after rp2040_sdio_rx_start() for a paused multi-block read
+void rp2040_sdio_clock_resume();
+
 // Start transferring data from memory to SD card
 sdio_status_t rp2040_sdio_tx_start(const uint8_t *buffer, uint32_t num_blocks);
 
@@ -69,5 +82,20 @@ sdio_status_t rp2040_sdio_tx_poll(uint32_t *bytes_complete = nullptr);
 // Force everything to idle state
 sdio_status_t rp2040_sdio_stop();
 
+// Stop a paused multi-block read if it has been idle for too long.
+// Implemented in sd_card_sdio.cpp, called from platform_poll().
+void sdio_stream_poll();
+
+// Statistics of SdioCard data transfers, for benchmarking.
+// Implemented in sd_card_sdio.cpp.
+struct sdio_transfer_stats_t {
+    uint32_t transfers; // Number of completed read and write calls
+    uint32_t commands; // Commands sent during those calls
+    uint32_t last_transfer_commands; // Commands sent during latest call
+};
+void sdio_get_transfer_stats(sdio_transfer_stats_t *stats);
+
 // (Re)initialize the SDIO interface
-void rp2040_sdio_init(int clock_divider = 1);
+// If high_speed is true, loads PIO programs with timing for SD high speed mode.
+// The card must have been switched to high speed mode with CMD6 before that.
+void rp2040_sdio_init(int clock_divider = 1, bool high_speed = false);
@@ -0,0 +1,202 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2023 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Executes SD card sector transfers on the second core.
+//
+// Core0 places requests in a single producer, single consumer queue and
+// core1 runs them in order. Progress is reported through a byte counter
+// that is updated from the SD driver callback as each block completes,
+// so that core0 can pass data to the IDE bus while the transfer continues.
+//
+// Only the queued transfers run on core1. Other SD card access, such as
+// filesystem operations, stays on core0 and must only happen when
+// platform_sd_core1_busy() returns false. Logging is disabled on core1,
+// so the SD driver error code is stored and logged by core0 instead.
+
+#include "ZuluIDE_platform.h"
+#include "ZuluIDE_log.h"
+#include <ZuluIDE.h>
+#include <SdFat.h>
+#include <string.h>
+#include <pico/multicore.h>
+#include <hardware/sync.h>
+
+static struct {
+    bool requested;
+    bool active;
+
+    // Request queue, head is written only by core0 and tail only by core1
+    struct {
+        uint8_t *buf;
+        uint32_t sector;
+        uint32_t count;
+        bool write;
+    } queue[SD_CORE1_QUEUE_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+
+    // Written by core1 while busy, reset by core0 while idle
+    volatile uint32_t bytes_base; // Bytes in requests completed before the current one
+    volatile uint32_t bytes_done; // Bytes completed including the current request
+    volatile bool error;
+    uint8_t error_code;     // SD driver error code of the failed request
+    uint32_t error_sector;  // First sector of the failed request
+    bool error_write;
+} g_sd_core1;
+
+// Called by SD driver on core1 during transfers
+static void sd_core1_progress(uint32_t bytes_complete)
+{
+    g_sd_core1.bytes_done = g_sd_core1.bytes_base + bytes_complete;
+}
+
+static void sd_core1_main()
+{
+    // Allow core0 to pause this core while it writes to flash
+    multicore_lockout_victim_init();
+
+    while (true)
+    {
+        uint32_t tail = g_sd_core1.tail;
+        if (tail == g_sd_core1.head)
+        {
+            __wfe();
+            continue;
+        }
+
+        __dmb();
+        uint32_t idx = tail % SD_CORE1_QUEUE_SIZE;
+        uint8_t *buf = g_sd_core1.queue[idx].buf;
+        uint32_t sector = g_sd_core1.queue[idx].sector;
+        uint32_t count = g_sd_core1.queue[idx].count;
+
+        // After an error the rest of the queue is skipped until core0 resets the state
+        if (!g_sd_core1.error)
+        {
+            bool status;
+            platform_set_sd_callback(&sd_core1_progress, buf);
+            if (g_sd_core1.queue[idx].write)
+                status = SD.card()->writeSectors(sector, buf, count);
+            else
+                status = SD.card()->readSectors(sector, buf, count);
+            platform_set_sd_callback(nullptr, nullptr);
+
+            if (!status)
+            {
+                g_sd_core1.error_code = SD.card()->errorCode();
+                g_sd_core1.error_sector = sector;
+                g_sd_core1.error_write = g_sd_core1.queue[idx].write;
+                __dmb();
+                g_sd_core1.error = true;
+            }
+        }
+
+        g_sd_core1.bytes_base += count * 512;
+        g_sd_core1.bytes_done = g_sd_core1.bytes_base;
+
+        __dmb();
+        g_sd_core1.tail = tail + 1;
+        __sev();
+    }
+}
+
+void platform_sd_core1_request(bool enable)
+{
+    g_sd_core1.requested = enable;
+}
+
+void platform_sd_core1_start()
+{
+    if (!g_sd_core1.requested || g_sd_core1.active)
+    {
+        return;
+    }
+
+    memset(&g_sd_core1, 0, sizeof(g_sd_core1));
+    g_sd_core1.requested = true;
+
+    multicore_reset_core1();
+    multicore_launch_core1(sd_core1_main);
+    g_sd_core1.active = true;
+    logmsg("SD card transfers run on second core");
+}
+
+bool platform_sd_core1_active()
+{
+    return g_sd_core1.active;
+}
+
+bool platform_sd_core1_busy()
+{
+    return g_sd_core1.active && g_sd_core1.tail != g_sd_core1.head;
+}
+
+bool platform_sd_core1_submit(bool write, uint32_t sector, uint8_t *buf, uint32_t count)
+{
+    uint32_t head = g_sd_core1.head;
+    if (head - g_sd_core1.tail >= SD_CORE1_QUEUE_SIZE)
+    {
+        return false;
+    }
+
+    uint32_t idx = head % SD_CORE1_QUEUE_SIZE;
+    g_sd_core1.queue[idx].buf = buf;
+    g_sd_core1.queue[idx].sector = sector;
+    g_sd_core1.queue[idx].count = count;
+    g_sd_core1.queue[idx].write = write;
+
+    __dmb();
+    g_sd_core1.head = head + 1;
+    __sev();
+    return true;
+}
+
+uint32_t platform_sd_core1_bytes_done(bool *error)
+{
+    uint32_t bytes = g_sd_core1.bytes_done;
+    __dmb();
+    *error = g_sd_core1.error;
+    return bytes;
+}
+
+bool platform_sd_core1_reset()
+{
+    uint32_t start = millis();
+    while (platform_sd_core1_busy())
+    {
+        if ((uint32_t)(millis() - start) > 10000)
+        {
+            logmsg("platform_sd_core1_reset() timeout waiting for SD card transfers");
+            return false;
+        }
+    }
+
+    if (g_sd_core1.error)
+    {
+        logmsg("SD card ", g_sd_core1.error_write ? "write" : "read", " on second core failed at sector ",
+               g_sd_core1.error_sector, ", error code ", (int)g_sd_core1.error_code);
+    }
+
+    g_sd_core1.bytes_base = 0;
+    g_sd_core1.bytes_done = 0;
+    g_sd_core1.error = false;
+    return true;
+}
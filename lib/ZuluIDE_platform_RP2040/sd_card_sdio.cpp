@@ -27,7 +27,9 @@
 
 #include "ZuluIDE_log.h"
 #include "rp2040_sdio.h"
+#include "rp2040_fpga.h"
 #include <hardware/gpio.h>
+#include <hardware/clocks.h>
 #include <SdFat.h>
 #include <SdCard/SdCardInfo.h>
 
@@ -39,6 +41,61 @@ static int g_sdio_error_line;
 static sdio_status_t g_sdio_error;
 static uint32_t g_sdio_dma_buf[128];
 static uint32_t g_sdio_sector_count;
+static bool g_sdio_high_speed; // Card and PIO are in high speed mode
+static uint8_t g_sdio_scr[8]; // SD configuration register
+static bool g_sdio_cmd23; // Card supports CMD23 SET_BLOCK_COUNT
+static sdio_transfer_stats_t g_sdio_stats;
+
+// Aligned scratch buffer for multi-block transfers with unaligned buffers
+#ifndef SDIO_BOUNCE_SECTORS
+#define SDIO_BOUNCE_SECTORS 8
+#endif
+static uint32_t g_sdio_bounce_buf[SDIO_BOUNCE_SECTORS * SDIO_WORDS_PER_BLOCK];
+
+// Maximum time to wait for CMD38 ERASE to complete
+#ifndef SDIO_ERASE_TIMEOUT_MS
+#define SDIO_ERASE_TIMEOUT_MS 30000
+#endif
+
+// Multi-block read is kept open with SD clock stopped after the last
+// requested block. If the next readSectors() call continues from where
+// the previous one ended, reception resumes without new CMD18.
+#ifndef SDIO_STREAM_TIMEOUT_MS
+#define SDIO_STREAM_TIMEOUT_MS 100
+#endif
+static struct {
+    bool active;
+    uint32_t next_sector;
+    uint32_t pause_time;
+} g_sdio_stream;
+
+// Switch back to default speed timing if there are CRC errors in high speed mode.
+// Returns true if the failed transfer should be retried.
+// Only call when the card is back in transfer state, as this sends CMD6.
+static bool sdio_check_speed_fallback(sdio_status_t status)
+{
+    if (!g_sdio_high_speed ||
+        (status != SDIO_ERR_RESPONSE_CRC && status != SDIO_ERR_DATA_CRC && status != SDIO_ERR_WRITE_CRC))
+    {
+        return false;
+    }
+
+    logmsg("SDIO CRC error in high speed mode, reducing clock rate to 25 MHz");
+    g_sdio_high_speed = false;
+    g_sdio_stream.active = false;
+    rp2040_sdio_init(1);
+
+    // Return the card to default speed output timing
+    uint32_t reply;
+    rp2040_sdio_rx_start((uint8_t*)g_sdio_dma_buf, 1, 64);
+    if (rp2040_sdio_command_R1(CMD6, 0x80FFFFF0, &reply) == SDIO_OK)
+    {
+        while (rp2040_sdio_rx_poll() == SDIO_BUSY);
+    }
+    rp2040_sdio_stop();
+
+    return true;
+}
 
 #define checkReturnOk(call) ((g_sdio_error = (call)) == SDIO_OK ? true : logSDError(__LINE__))
 static bool logSDError(int line)
@@ -48,6 +105,46 @@ static bool logSDError(int line)
     return false;
 }
 
+static void sdio_stream_stop()
+{
+    if (g_sdio_stream.active)
+    {
+        // Restart clock and send STOP_TRANSMISSION
+        g_sdio_stream.active = false;
+        rp2040_sdio_stop();
+
+        uint32_t reply;
+        if (checkReturnOk(rp2040_sdio_command_R1(CMD12, 0, &reply)))
+        {
+            uint32_t start = millis();
+            while ((sio_hw->gpio_in & (1 << SDIO_D0)) == 0 &&
+                   (uint32_t)(millis() - start) < 5000);
+        }
+    }
+}
+
+void sdio_get_transfer_stats(sdio_transfer_stats_t *stats)
+{
+    *stats = g_sdio_stats;
+}
+
+// Update statistics when a data transfer call finishes
+static void sdio_count_transfer(uint32_t commands_at_start)
+{
+    uint32_t commands = rp2040_sdio_get_command_count() - commands_at_start;
+    g_sdio_stats.transfers++;
+    g_sdio_stats.commands += commands;
+    g_sdio_stats.last_transfer_commands = commands;
+}
+
+void sdio_stream_poll()
+{
+    if (g_sdio_stream.active && (uint32_t)(millis() - g_sdio_stream.pause_time) > SDIO_STREAM_TIMEOUT_MS)
+    {
+        sdio_stream_stop();
+    }
+}
+
 // Callback used by SCSI code for simultaneous processing
 static sd_callback_t m_stream_callback;
 static const uint8_t *m_stream_buffer;
@@ -88,6 +185,8 @@ bool SdioCard::begin(SdioConfig sdioConfig)
 {
     uint32_t reply;
     sdio_status_t status;
+
+    g_sdio_stream.active = false;
     
     // Initialize at 1 MHz clock speed
     rp2040_sdio_init(25);
@@ -167,9 +266,51 @@ bool SdioCard::begin(SdioConfig sdioConfig)
         return false;
     }
 
+    // High capacity cards always use 512 byte blocks. For standard capacity
+    // cards the block length stays set until changed, so set it only once here.
+    if (type() != SD_CARD_TYPE_SDHC &&
+        !checkReturnOk(rp2040_sdio_command_R1(16, 512, &reply))) // SET_BLOCKLEN
+    {
+        dbgmsg("SDIO failed to set block length");
+        return false;
+    }
+
+    // Check support for CMD23 SET_BLOCK_COUNT, which avoids CMD12 after writes
+    g_sdio_cmd23 = false;
+    scr_t scr;
+    if (readSCR(&scr))
+    {
+        g_sdio_cmd23 = (g_sdio_scr[3] & 0x02);
+        dbgmsg("SDIO SCR: ", bytearray(g_sdio_scr, 8), " CMD23 support: ", (int)g_sdio_cmd23);
+    }
+
     // Increase to 25 MHz clock rate
     rp2040_sdio_init(1);
 
+    // Switch to high speed mode if the card supports it.
+    // First query with mode 0 and then switch with mode 1.
+    g_sdio_high_speed = false;
+    uint8_t switch_status[64];
+    if (cardCMD6(0x00FFFFF1, switch_status) && (switch_status[13] & 0x02) &&
+        cardCMD6(0x80FFFFF1, switch_status) && (switch_status[16] & 0x0F) == 1)
+    {
+        // Card changes timing within 8 clocks after the status block
+        rp2040_sdio_init(1, true);
+        g_sdio_high_speed = true;
+
+        // Verify that data transfers work at the higher clock rate.
+        // Data CRC errors are handled by the retry in readSector(),
+        // command response CRC errors here.
+        if (readSector(0, (uint8_t*)g_sdio_dma_buf) && g_sdio_high_speed)
+        {
+            logmsg("SDIO card in high speed mode, clock rate ", (int)kHzSdClk(), " kHz");
+        }
+        else
+        {
+            sdio_check_speed_fallback(g_sdio_error);
+        }
+    }
+
     return true;
 }
 
@@ -195,7 +336,8 @@ bool SdioCard::isBusy()
 
 uint32_t SdioCard::kHzSdClk()
 {
-    return 0;
+    // PIO programs use 5 system clocks per SD clock in default speed and 3 in high speed mode
+    return clock_get_hz(clk_sys) / 1000 / (g_sdio_high_speed ? 3 : 5);
 }
 
 bool SdioCard::readCID(cid_t* cid)
@@ -212,6 +354,8 @@ bool SdioCard::readCSD(csd_t* csd)
 
 bool SdioCard::readOCR(uint32_t* ocr)
 {
+    sdio_stream_stop();
+
     // SDIO mode does not have CMD58, but main program uses this to
     // poll for card presence. Return status register instead.
     return checkReturnOk(rp2040_sdio_command_R1(CMD13, g_sdio_rca, ocr));
@@ -242,6 +386,8 @@ uint32_t SdioCard::sectorCount()
 
 uint32_t SdioCard::status()
 {
+    sdio_stream_stop();
+
     uint32_t reply;
     if (checkReturnOk(rp2040_sdio_command_R1(CMD13, g_sdio_rca, &reply)))
         return reply;
@@ -316,24 +462,108 @@ bool SdioCard::writeStop()
 
 bool SdioCard::erase(uint32_t firstSector, uint32_t lastSector)
 {
-    logmsg("SdioCard::erase() not implemented");
-    return false;
+    sdio_stream_stop();
+
+    // Cards without ERASE_BLK_EN can only erase whole erase blocks
+    if (!g_sdio_csd.eraseSingleBlock())
+    {
+        // CSD v1 SECTOR_SIZE can be any value from 1 to 128, not only a power of 2
+        uint32_t erase_size = g_sdio_csd.eraseSize();
+        if ((firstSector % erase_size) != 0 || ((lastSector + 1) % erase_size) != 0)
+        {
+            logmsg("SdioCard::erase(", firstSector, ", ", lastSector, ") not aligned to erase size ", (int)erase_size);
+            return false;
+        }
+    }
+
+    // Cards up to 2GB use byte addressing, SDHC cards use sector addressing
+    uint32_t first = (type() == SD_CARD_TYPE_SDHC) ? firstSector : (firstSector * 512);
+    uint32_t last = (type() == SD_CARD_TYPE_SDHC) ? lastSector : (lastSector * 512);
+
+    uint32_t reply;
+    if (!checkReturnOk(rp2040_sdio_command_R1(CMD32, first, &reply)) || // ERASE_WR_BLK_START
+        !checkReturnOk(rp2040_sdio_command_R1(CMD33, last, &reply)) || // ERASE_WR_BLK_END
+        !checkReturnOk(rp2040_sdio_command_R1(CMD38, 0, &reply))) // ERASE
+    {
+        return false;
+    }
+
+    // Card keeps D0 low until the erase has completed.
+    // Erase time scales with the range size, so the timeout is generous.
+    uint32_t start = millis();
+    while (isBusy())
+    {
+        if ((uint32_t)(millis() - start) > SDIO_ERASE_TIMEOUT_MS)
+        {
+            logmsg("SdioCard::erase(", firstSector, ", ", lastSector, ") timeout");
+            return false;
+        }
+    }
+
+    return true;
 }
 
 bool SdioCard::cardCMD6(uint32_t arg, uint8_t* status) {
-    logmsg("SdioCard::cardCMD6() not implemented");
-    return false;
+    sdio_stream_stop();
+
+    // SWITCH_FUNC returns 64 byte status block on the data lines
+    uint32_t reply;
+    if (!checkReturnOk(rp2040_sdio_rx_start((uint8_t*)g_sdio_dma_buf, 1, 64)) ||
+        !checkReturnOk(rp2040_sdio_command_R1(CMD6, arg, &reply)))
+    {
+        rp2040_sdio_stop();
+        return false;
+    }
+
+    do {
+        g_sdio_error = rp2040_sdio_rx_poll();
+    } while (g_sdio_error == SDIO_BUSY);
+
+    if (g_sdio_error != SDIO_OK)
+    {
+        logmsg("SdioCard::cardCMD6(", arg, ") failed: ", (int)g_sdio_error);
+        return false;
+    }
+
+    memcpy(status, g_sdio_dma_buf, 64);
+    return true;
 }
 
 bool SdioCard::readSCR(scr_t* scr) {
-    logmsg("SdioCard::readSCR() not implemented");
-    return false;
+    sdio_stream_stop();
+
+    // SEND_SCR returns 8 byte register on the data lines
+    uint32_t reply;
+    if (!checkReturnOk(rp2040_sdio_command_R1(CMD55, g_sdio_rca, &reply)) || // APP_CMD
+        !checkReturnOk(rp2040_sdio_rx_start((uint8_t*)g_sdio_dma_buf, 1, 8)) ||
+        !checkReturnOk(rp2040_sdio_command_R1(51, 0, &reply))) // ACMD51 SEND_SCR
+    {
+        rp2040_sdio_stop();
+        return false;
+    }
+
+    do {
+        g_sdio_error = rp2040_sdio_rx_poll();
+    } while (g_sdio_error == SDIO_BUSY);
+
+    if (g_sdio_error != SDIO_OK)
+    {
+        logmsg("SdioCard::readSCR() failed: ", (int)g_sdio_error);
+        return false;
+    }
+
+    memcpy(g_sdio_scr, g_sdio_dma_buf, sizeof(g_sdio_scr));
+    memcpy(scr, g_sdio_scr, sizeof(*scr) < sizeof(g_sdio_scr) ? sizeof(*scr) : sizeof(g_sdio_scr));
+    return true;
 }
 
 /* Writing and reading, with progress callback */
 
 bool SdioCard::writeSector(uint32_t sector, const uint8_t* src)
 {
+    uint32_t commands_at_start = rp2040_sdio_get_command_count();
+    sdio_stream_stop();
+
     if (((uint32_t)src & 3) != 0)
     {
         // Buffer is not aligned, need to memcpy() the data to a temporary buffer.
@@ -348,8 +578,7 @@ bool SdioCard::writeSector(uint32_t sector, const uint8_t* src)
     uint32_t address = (type() == SD_CARD_TYPE_SDHC) ? sector : (sector * 512);
 
     uint32_t reply;
-    if (!checkReturnOk(rp2040_sdio_command_R1(16, 512, &reply)) || // SET_BLOCKLEN
-        !checkReturnOk(rp2040_sdio_command_R1(CMD24, address, &reply)) || // WRITE_BLOCK
+    if (!checkReturnOk(rp2040_sdio_command_R1(CMD24, address, &reply)) || // WRITE_BLOCK
         !checkReturnOk(rp2040_sdio_tx_start(src, 1))) // Start transmission
     {
         return false;
@@ -368,22 +597,39 @@ bool SdioCard::writeSector(uint32_t sector, const uint8_t* src)
     if (g_sdio_error != SDIO_OK)
     {
         logmsg("SdioCard::writeSector(", sector, ") failed: ", (int)g_sdio_error);
+
+        if (!callback && sdio_check_speed_fallback(g_sdio_error))
+        {
+            return writeSector(sector, src);
+        }
+
+        return false;
     }
 
-    return g_sdio_error == SDIO_OK;
+    sdio_count_transfer(commands_at_start);
+    return true;
 }
 
 bool SdioCard::writeSectors(uint32_t sector, const uint8_t* src, size_t n)
 {
+    uint32_t commands_at_start = rp2040_sdio_get_command_count();
+    sdio_stream_stop();
+
     if (((uint32_t)src & 3) != 0)
     {
-        // Unaligned write, execute sector-by-sector
-        for (size_t i = 0; i < n; i++)
+        // Unaligned write, copy chunks to scratch buffer
+        while (n > 0)
         {
-            if (!writeSector(sector + i, src + 512 * i))
+            size_t count = (n < SDIO_BOUNCE_SECTORS) ? n : SDIO_BOUNCE_SECTORS;
+            memcpy(g_sdio_bounce_buf, src, count * 512);
+            if (!writeSectors(sector, (const uint8_t*)g_sdio_bounce_buf, count))
             {
                 return false;
             }
+
+            sector += count;
+            src += count * 512;
+            n -= count;
         }
         return true;
     }
@@ -394,10 +640,24 @@ bool SdioCard::writeSectors(uint32_t sector, const uint8_t* src, size_t n)
     uint32_t address = (type() == SD_CARD_TYPE_SDHC) ? sector : (sector * 512);
 
     uint32_t reply;
-    if (!checkReturnOk(rp2040_sdio_command_R1(16, 512, &reply)) || // SET_BLOCKLEN
-        !checkReturnOk(rp2040_sdio_command_R1(CMD55, g_sdio_rca, &reply)) || // APP_CMD
-        !checkReturnOk(rp2040_sdio_command_R1(ACMD23, n, &reply)) || // SET_WR_CLK_ERASE_COUNT
-        !checkReturnOk(rp2040_sdio_command_R1(CMD25, address, &reply)) || // WRITE_MULTIPLE_BLOCK
+    if (g_sdio_cmd23)
+    {
+        // Card stops by itself after the given number of blocks
+        if (!checkReturnOk(rp2040_sdio_command_R1(23, n, &reply))) // SET_BLOCK_COUNT
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if (!checkReturnOk(rp2040_sdio_command_R1(CMD55, g_sdio_rca, &reply)) || // APP_CMD
+            !checkReturnOk(rp2040_sdio_command_R1(ACMD23, n, &reply))) // SET_WR_CLK_ERASE_COUNT
+        {
+            return false;
+        }
+    }
+
+    if (!checkReturnOk(rp2040_sdio_command_R1(CMD25, address, &reply)) || // WRITE_MULTIPLE_BLOCK
         !checkReturnOk(rp2040_sdio_tx_start(src, n))) // Start transmission
     {
         return false;
@@ -415,20 +675,44 @@ bool SdioCard::writeSectors(uint32_t sector, const uint8_t* src, size_t n)
 
     if (g_sdio_error != SDIO_OK)
     {
-        logmsg("SdioCard::writeSectors(", sector, ",...,", (int)n, ") failed: ", (int)g_sdio_error);
+        // stopTransmission() overwrites g_sdio_error with the CMD12 result
+        sdio_status_t status = g_sdio_error;
+        logmsg("SdioCard::writeSectors(", sector, ",...,", (int)n, ") failed: ", (int)status);
         stopTransmission(true);
+        g_sdio_error = status;
+
+        if (!callback && sdio_check_speed_fallback(status))
+        {
+            return writeSectors(sector, src, n);
+        }
+
         return false;
     }
+    else if (g_sdio_cmd23)
+    {
+        // PIO has already waited for the card to finish programming the last block
+        sdio_count_transfer(commands_at_start);
+        return true;
+    }
     else
     {
         // TODO: Instead of CMD12 stopTransmission command, according to SD spec we should send stopTran token.
         // stopTransmission seems to work in practice.
-        return stopTransmission(true);
+        if (!stopTransmission(true))
+        {
+            return false;
+        }
+
+        sdio_count_transfer(commands_at_start);
+        return true;
     }
 }
 
 bool SdioCard::readSector(uint32_t sector, uint8_t* dst)
 {
+    uint32_t commands_at_start = rp2040_sdio_get_command_count();
+    sdio_stream_stop();
+
     uint8_t *real_dst = dst;
     if (((uint32_t)dst & 3) != 0)
     {
@@ -436,14 +720,16 @@ bool SdioCard::readSector(uint32_t sector, uint8_t* dst)
         dst = (uint8_t*)g_sdio_dma_buf;
     }
 
+    // Buffer may still be in use by background transfer to FPGA
+    fpga_wait_buffer(dst, 512);
+
     sd_callback_t callback = get_stream_callback(dst, 512, "readSector", sector);
 
     // Cards up to 2GB use byte addressing, SDHC cards use sector addressing
     uint32_t address = (type() == SD_CARD_TYPE_SDHC) ? sector : (sector * 512);
 
     uint32_t reply;
-    if (!checkReturnOk(rp2040_sdio_command_R1(16, 512, &reply)) || // SET_BLOCKLEN
-        !checkReturnOk(rp2040_sdio_rx_start(dst, 1)) || // Prepare for reception
+    if (!checkReturnOk(rp2040_sdio_rx_start(dst, 1)) || // Prepare for reception
         !checkReturnOk(rp2040_sdio_command_R1(CMD17, address, &reply))) // READ_SINGLE_BLOCK
     {
         return false;
@@ -462,21 +748,60 @@ bool SdioCard::readSector(uint32_t sector, uint8_t* dst)
     if (g_sdio_error != SDIO_OK)
     {
         logmsg("SdioCard::readSector(", sector, ") failed: ", (int)g_sdio_error);
+
+        if (!callback && sdio_check_speed_fallback(g_sdio_error))
+        {
+            return readSector(sector, real_dst);
+        }
     }
 
     if (dst != real_dst)
     {
+        fpga_wait_buffer(real_dst, 512);
         memcpy(real_dst, g_sdio_dma_buf, sizeof(g_sdio_dma_buf));
     }
 
+    if (g_sdio_error == SDIO_OK)
+    {
+        sdio_count_transfer(commands_at_start);
+    }
+
     return g_sdio_error == SDIO_OK;
 }
 
 bool SdioCard::readSectors(uint32_t sector, uint8_t* dst, size_t n)
 {
-    if (((uint32_t)dst & 3) != 0 || sector + n >= g_sdio_sector_count)
+    if (((uint32_t)dst & 3) != 0)
+    {
+        // Unaligned read, transfer chunks through scratch buffer
+        while (n > 0)
+        {
+            size_t count = (n < SDIO_BOUNCE_SECTORS) ? n : SDIO_BOUNCE_SECTORS;
+            if (!readSectors(sector, (uint8_t*)g_sdio_bounce_buf, count))
+            {
+                return false;
+            }
+            fpga_wait_buffer(dst, count * 512);
+            memcpy(dst, g_sdio_bounce_buf, count * 512);
+
+            sector += count;
+            dst += count * 512;
+            n -= count;
+        }
+        return true;
+    }
+
+    if (n > 1 && sector + n == g_sdio_sector_count)
+    {
+        // Multi-block read must not reach the last sector of the card,
+        // the card could report out of range error when reading ahead.
+        return readSectors(sector, dst, n - 1) &&
+               readSector(sector + n - 1, dst + 512 * (n - 1));
+    }
+
+    if (sector + n >= g_sdio_sector_count)
     {
-        // Unaligned read or end-of-drive read, execute sector-by-sector
+        // End-of-drive read, execute sector-by-sector
         for (size_t i = 0; i < n; i++)
         {
             if (!readSector(sector + i, dst + 512 * i))
@@ -487,17 +812,40 @@ bool SdioCard::readSectors(uint32_t sector, uint8_t* dst, size_t n)
         return true;
     }
 
+    // Buffer may still be in use by background transfer to FPGA
+    fpga_wait_buffer(dst, n * 512);
+
+    uint32_t commands_at_start = rp2040_sdio_get_command_count();
     sd_callback_t callback = get_stream_callback(dst, n * 512, "readSectors", sector);
 
-    // Cards up to 2GB use byte addressing, SDHC cards use sector addressing
-    uint32_t address = (type() == SD_CARD_TYPE_SDHC) ? sector : (sector * 512);
+    bool resumed = false;
+    if (g_sdio_stream.active && g_sdio_stream.next_sector == sector &&
+        (uint32_t)(millis() - g_sdio_stream.pause_time) <= SDIO_STREAM_TIMEOUT_MS &&
+        rp2040_sdio_rx_can_continue())
+    {
+        // Continue previous multi-block read
+        if (checkReturnOk(rp2040_sdio_rx_start(dst, n, SDIO_BLOCK_SIZE, true)))
+        {
+            rp2040_sdio_clock_resume();
+            resumed = true;
+        }
+    }
 
-    uint32_t reply;
-    if (!checkReturnOk(rp2040_sdio_command_R1(16, 512, &reply)) || // SET_BLOCKLEN
-        !checkReturnOk(rp2040_sdio_rx_start(dst, n)) || // Prepare for reception
-        !checkReturnOk(rp2040_sdio_command_R1(CMD18, address, &reply))) // READ_MULTIPLE_BLOCK
+    if (!resumed)
     {
-        return false;
+        // Ends any paused read, also one that failed to resume, and starts a new one
+        sdio_stream_stop();
+
+        // Cards up to 2GB use byte addressing, SDHC cards use sector addressing
+        uint32_t address = (type() == SD_CARD_TYPE_SDHC) ? sector : (sector * 512);
+
+        uint32_t reply;
+        if (!checkReturnOk(rp2040_sdio_rx_start(dst, n, SDIO_BLOCK_SIZE, true)) || // Prepare for reception
+            !checkReturnOk(rp2040_sdio_command_R1(CMD18, address, &reply))) // READ_MULTIPLE_BLOCK
+        {
+            rp2040_sdio_stop();
+            return false;
+        }
     }
 
     do {
@@ -512,13 +860,28 @@ bool SdioCard::readSectors(uint32_t sector, uint8_t* dst, size_t n)
 
     if (g_sdio_error != SDIO_OK)
     {
-        logmsg("SdioCard::readSectors(", sector, ",...,", (int)n, ") failed: ", (int)g_sdio_error);
+        // stopTransmission() overwrites g_sdio_error with the CMD12 result
+        sdio_status_t status = g_sdio_error;
+        logmsg("SdioCard::readSectors(", sector, ",...,", (int)n, ") failed: ", (int)status);
+        rp2040_sdio_stop();
         stopTransmission(true);
+        g_sdio_error = status;
+
+        if (!callback && sdio_check_speed_fallback(status))
+        {
+            return readSectors(sector, dst, n);
+        }
+
         return false;
     }
     else
     {
-        return stopTransmission(true);
+        // Leave the read open with clock stopped, sdio_stream_stop() sends CMD12 later
+        g_sdio_stream.active = true;
+        g_sdio_stream.next_sector = sector + n;
+        g_sdio_stream.pause_time = millis();
+        sdio_count_transfer(commands_at_start);
+        return true;
     }
 }
 
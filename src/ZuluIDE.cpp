@@ -57,6 +57,14 @@ static IDERigidDevice g_ide_rigid;
 static IDEImageFile g_ide_imagefile;
 static IDEDevice *g_ide_device;
 
+// Hard drive image accessed directly as a sector range on the SD card
+static struct {
+    bool enabled;
+    bool read_only;
+    uint32_t first_sector;
+    uint32_t sector_count;
+} g_raw_image;
+
 zuluide::status::StatusController g_StatusController;
 zuluide::control::StdDisplayController g_DisplayController(&g_StatusController);
 zuluide::control::ControlInterface g_ControlInterface;
@@ -174,6 +182,139 @@ void print_sd_info()
 }
 
 
+/*********************************/
+/* Raw SD card image             */
+/*********************************/
+
+// Find sector range of a primary partition in the MBR partition table
+static bool find_sd_partition(int partition, uint32_t *first_sector, uint32_t *sector_count)
+{
+    uint32_t mbr[128];
+    const uint8_t *bytes = (const uint8_t*)mbr;
+    if (!SD.card()->readSectors(0, (uint8_t*)mbr, 1) || bytes[510] != 0x55 || bytes[511] != 0xAA)
+    {
+        logmsg("-- No MBR partition table on SD card");
+        return false;
+    }
+
+    const uint8_t *entry = &bytes[0x1BE + (partition - 1) * 16];
+    if (entry[4] == 0x00 || entry[4] == 0xEE)
+    {
+        logmsg("-- SD card partition ", partition, " not found, GPT partition tables are not supported");
+        return false;
+    }
+
+    *first_sector = entry[8] | ((uint32_t)entry[9] << 8) | ((uint32_t)entry[10] << 16) | ((uint32_t)entry[11] << 24);
+    *sector_count = entry[12] | ((uint32_t)entry[13] << 8) | ((uint32_t)entry[14] << 16) | ((uint32_t)entry[15] << 24);
+    return true;
+}
+
+// Find first sector of the MBR partition that contains the given sector.
+// Returns 0 if there is no partition table, i.e. the filesystem starts at sector 0.
+static uint32_t find_sd_partition_start(uint32_t sector)
+{
+    uint32_t mbr[128];
+    const uint8_t *bytes = (const uint8_t*)mbr;
+    if (!SD.card()->readSectors(0, (uint8_t*)mbr, 1) || bytes[510] != 0x55 || bytes[511] != 0xAA)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        const uint8_t *entry = &bytes[0x1BE + i * 16];
+        uint32_t start = entry[8] | ((uint32_t)entry[9] << 8) | ((uint32_t)entry[10] << 16) | ((uint32_t)entry[11] << 24);
+        uint32_t count = entry[12] | ((uint32_t)entry[13] << 8) | ((uint32_t)entry[14] << 16) | ((uint32_t)entry[15] << 24);
+        if (entry[4] != 0x00 && entry[4] != 0xEE && sector >= start && sector - start < count)
+        {
+            return start;
+        }
+    }
+
+    return 0;
+}
+
+// A hard drive image can be a partition or a sector range on the SD card,
+// set with raw_partition or raw_first_sector in zuluide.ini.
+// A card without a FAT filesystem is used as a raw image in whole. There is
+// no zuluide.ini to opt in with, so that image is read only.
+static void read_raw_image_config()
+{
+    g_raw_image.enabled = false;
+    if (!SD.card()) return;
+
+    uint32_t card_sectors = SD.card()->sectorCount();
+    uint32_t first_sector = 0;
+    uint32_t sector_count = 0;
+    bool has_filesystem = (SD.clusterCount() != 0);
+    int partition = ini_getl("IDE", "raw_partition", 0, CONFIGFILE);
+    long first = ini_getl("IDE", "raw_first_sector", -1, CONFIGFILE);
+
+    if (!has_filesystem)
+    {
+        sector_count = card_sectors;
+    }
+    else if (partition >= 1 && partition <= 4)
+    {
+        if (!find_sd_partition(partition, &first_sector, &sector_count)) return;
+
+        if (sector_count == 0 || first_sector >= card_sectors || sector_count > card_sectors - first_sector)
+        {
+            logmsg("-- SD card partition ", partition, " at sectors ", (int)first_sector, " + ", (int)sector_count,
+                   " does not fit on card with ", (int)card_sectors, " sectors");
+            return;
+        }
+    }
+    else if (first >= 0 && (uint32_t)first < card_sectors)
+    {
+        first_sector = first;
+        sector_count = ini_getl("IDE", "raw_sector_count", 0, CONFIGFILE);
+        if (sector_count == 0 || sector_count > card_sectors - first_sector)
+        {
+            sector_count = card_sectors - first_sector;
+        }
+    }
+    else
+    {
+        return;
+    }
+
+    if (has_filesystem)
+    {
+        // The host must not overwrite the filesystem with zuluide.ini and the log file.
+        // The protected range covers the whole volume including its boot sector
+        // and reserved sectors, and the partition table in sector 0.
+        FsVolume *vol = SD.vol();
+        uint32_t fs_start = find_sd_partition_start(vol->fatStartSector());
+        uint64_t fs_end = vol->dataStartSector() + (uint64_t)vol->clusterCount() * vol->sectorsPerCluster();
+        uint64_t raw_end = (uint64_t)first_sector + sector_count;
+        if (first_sector == 0 || (first_sector < fs_end && raw_end > fs_start))
+        {
+            logmsg("Raw image at SD card sectors ", (int)first_sector, " + ", (int)sector_count,
+                   " overlaps the filesystem, ignoring it");
+            return;
+        }
+    }
+
+    g_raw_image.enabled = true;
+    g_raw_image.read_only = !has_filesystem || ini_getbool("IDE", "raw_read_only", false, CONFIGFILE);
+    g_raw_image.first_sector = first_sector;
+    g_raw_image.sector_count = sector_count;
+}
+
+static void load_raw_image()
+{
+    if (g_ide_imagefile.open_raw(SD.card(), g_raw_image.first_sector,
+                                 g_raw_image.sector_count, g_raw_image.read_only))
+    {
+        g_ide_device->set_image(&g_ide_imagefile);
+    }
+    else
+    {
+        blinkStatus(BLINK_ERROR_NO_IMAGES);
+    }
+}
+
 /**************/
 /* Log saving */
 /**************/
@@ -272,6 +413,8 @@ void setupStatusController()
   if (!g_sdcard_present) {
     logmsg("SD card not loaded, defaulting to CD-ROM");
     g_ide_imagefile.set_drive_type(drive_type_t::DRIVE_TYPE_CDROM);
+  } else if (g_raw_image.enabled) {
+    g_ide_imagefile.set_drive_type(drive_type_t::DRIVE_TYPE_RIGID);
   } else if (strncasecmp(device_name, "cdrom", sizeof("cdrom")) == 0) {
     g_ide_imagefile.set_drive_type(drive_type_t::DRIVE_TYPE_CDROM);
   } else if (strncasecmp(device_name, "zip100", sizeof("zip100")) == 0) {
@@ -357,7 +500,11 @@ void setupStatusController()
     g_StatusController.EndUpdate();
   }
 
-  loadFirstImage();
+  if (g_raw_image.enabled && g_ide_device == &g_ide_rigid) {
+    load_raw_image();
+  } else {
+    loadFirstImage();
+  }
 }
 
 void loadFirstImage() {
@@ -444,6 +591,7 @@ static void zuluide_setup_sd_card()
         if (g_sdcard_present)
         {
             init_logfile();
+            read_raw_image_config();
 
             if (ini_getbool("IDE", "DisableStatusLED", false, CONFIGFILE))
             {
@@ -461,6 +609,12 @@ void zuluide_init(void)
     platform_late_init();
     zuluide_setup_sd_card();
     g_ide_imagefile = IDEImageFile((uint8_t*)g_ide_buffer, sizeof(g_ide_buffer));
+    IDEImageFile::set_sector_cache_size(ini_getl("IDE", "sector_cache", IMAGE_SECTOR_CACHE_MAX, CONFIGFILE));
+    bool write_cache = ini_getbool("IDE", "write_cache", false, CONFIGFILE);
+    IDEImageFile::set_write_cache_allowed(write_cache);
+    g_ide_imagefile.set_write_cache(write_cache);
+    g_log_deferred = ini_getbool("IDE", "deferred_debug_log", true, CONFIGFILE);
+    platform_sd_core1_request(ini_getbool("IDE", "sd_on_core1", false, CONFIGFILE));
 
 #ifdef PLATFORM_MASS_STORAGE
   static bool check_mass_storage = true;
@@ -510,9 +664,22 @@ void zuluide_main_loop(void)
 
     g_StatusController.ProcessUpdates();
 
+    ide_protocol_poll();
+
+    if (!ide_phy_is_command_interrupted())
+    {
+        // Format debug messages while host is not sending commands
+        log_deferred_poll(LOG_DEFERRED_POLL_RECORDS);
+    }
+
     save_logfile();
 
-    ide_protocol_poll();
+    if (g_sdcard_present && !ide_phy_is_command_interrupted())
+    {
+        // Write cached data and read ahead while host is not sending commands
+        g_ide_imagefile.write_cache_poll();
+        g_ide_imagefile.prefetch_poll();
+    }
 
     if (g_sdcard_present)
     {
@@ -547,9 +714,13 @@ void zuluide_main_loop(void)
             print_sd_info();
 
             init_logfile();
+            read_raw_image_config();
 
             g_StatusController.SetIsCardPresent(true);
-            loadFirstImage();
+            if (g_raw_image.enabled && g_ide_device == &g_ide_rigid)
+                load_raw_image();
+            else
+                loadFirstImage();
             g_ide_device->sd_card_inserted();
         }
         else
@@ -132,6 +132,7 @@ int bootloader_main(void)
 {
     platform_init();
     g_log_debug = true;
+    g_log_deferred = false;
     platform_reset_watchdog();
 
     logmsg("Bootloader version: " __DATE__ " " __TIME__ " " PLATFORM_NAME);
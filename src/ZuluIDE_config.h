@@ -51,6 +51,21 @@
 #endif
 #define LOG_SAVE_INTERVAL_MS 1000
 
+// Buffer for binary debug messages waiting to be formatted, must be a power of 2
+#ifndef LOG_DEFERRED_BUFSIZE
+#define LOG_DEFERRED_BUFSIZE 4096
+#endif
+
+// Maximum number of deferred debug messages to format per main loop iteration
+#ifndef LOG_DEFERRED_POLL_RECORDS
+#define LOG_DEFERRED_POLL_RECORDS 8
+#endif
+
+// Longest string argument that is copied to a deferred debug message
+#ifndef LOG_DEFERRED_MAX_STRLEN
+#define LOG_DEFERRED_MAX_STRLEN 64
+#endif
+
 // Watchdog timeout
 // Watchdog will first issue a bus reset and if that does not help, crashdump.
 #define WATCHDOG_BUS_RESET_TIMEOUT 15000
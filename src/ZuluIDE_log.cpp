@@ -23,6 +23,7 @@
 #include "ZuluIDE_log.h"
 #include "ZuluIDE_config.h"
 #include "ZuluIDE_platform.h"
+#include <string.h>
 
 const char *g_log_firmwareversion = ZULU_FW_VERSION " " __DATE__ " " __TIME__;
 bool g_log_debug = true;
@@ -58,6 +59,15 @@ void log_raw(const char *str)
     platform_log(str);
 }
 
+bool log_is_allowed()
+{
+#ifdef PLATFORM_LOG_ALLOWED
+    return PLATFORM_LOG_ALLOWED();
+#else
+    return true;
+#endif
+}
+
 // Log byte as hex
 void log_raw(uint8_t value)
 {
@@ -208,3 +218,275 @@ const char *log_get_buffer(uint32_t *startpos, uint32_t *available)
     return result;
 }
 
+
+/*********************************/
+/* Deferred binary debug log     */
+/*********************************/
+
+bool g_log_deferred = true;
+
+#define LOG_DEFERRED_MASK (LOG_DEFERRED_BUFSIZE - 1)
+
+enum log_arg_type_t {
+    LOG_ARG_CONST_STR = 1,
+    LOG_ARG_STR,
+    LOG_ARG_U8,
+    LOG_ARG_U16,
+    LOG_ARG_U32,
+    LOG_ARG_U64,
+    LOG_ARG_INT,
+    LOG_ARG_BYTES
+};
+
+// Number of bytes stored from bytearray arguments.
+// log_raw(bytearray) prints at most this many before "... (total N)"
+#define LOG_DEFERRED_MAX_BYTES 34
+
+// Ring buffer of records. Producer only advances head after a complete
+// record has been written, consumer only advances tail.
+static struct {
+    uint8_t buf[LOG_DEFERRED_BUFSIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t dropped;
+} g_log_deferred_ring;
+
+static void log_deferred_put(log_deferred_writer_t *w, const void *data, size_t len)
+{
+    if (w->overflow) return;
+
+    if (w->pos + len - g_log_deferred_ring.tail > LOG_DEFERRED_BUFSIZE)
+    {
+        w->overflow = true;
+        return;
+    }
+
+    const uint8_t *src = (const uint8_t*)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        g_log_deferred_ring.buf[(w->pos++) & LOG_DEFERRED_MASK] = src[i];
+    }
+}
+
+static void log_deferred_put_tag(log_deferred_writer_t *w, log_arg_type_t tag)
+{
+    uint8_t t = tag;
+    log_deferred_put(w, &t, 1);
+}
+
+void log_deferred_begin(log_deferred_writer_t *w, int argc)
+{
+    w->pos = g_log_deferred_ring.head;
+    w->overflow = false;
+
+    uint8_t count = argc;
+    uint32_t timestamp = millis();
+    log_deferred_put(w, &count, 1);
+    log_deferred_put(w, &timestamp, 4);
+}
+
+void log_deferred_end(log_deferred_writer_t *w)
+{
+    if (w->overflow)
+    {
+        g_log_deferred_ring.dropped++;
+    }
+    else
+    {
+        __sync_synchronize();
+        g_log_deferred_ring.head = w->pos;
+    }
+}
+
+void log_deferred_arg(log_deferred_writer_t *w, const char *str)
+{
+#ifdef PLATFORM_LOG_IS_CONST_STR
+    if (PLATFORM_LOG_IS_CONST_STR(str))
+    {
+        log_deferred_put_tag(w, LOG_ARG_CONST_STR);
+        log_deferred_put(w, &str, sizeof(str));
+        return;
+    }
+#endif
+
+    // String may be in a temporary buffer, store a copy
+    uint8_t len = strnlen(str, LOG_DEFERRED_MAX_STRLEN);
+    log_deferred_put_tag(w, LOG_ARG_STR);
+    log_deferred_put(w, &len, 1);
+    log_deferred_put(w, str, len);
+}
+
+void log_deferred_arg(log_deferred_writer_t *w, uint8_t value)
+{
+    log_deferred_put_tag(w, LOG_ARG_U8);
+    log_deferred_put(w, &value, sizeof(value));
+}
+
+void log_deferred_arg(log_deferred_writer_t *w, uint16_t value)
+{
+    log_deferred_put_tag(w, LOG_ARG_U16);
+    log_deferred_put(w, &value, sizeof(value));
+}
+
+void log_deferred_arg(log_deferred_writer_t *w, uint32_t value)
+{
+    log_deferred_put_tag(w, LOG_ARG_U32);
+    log_deferred_put(w, &value, sizeof(value));
+}
+
+void log_deferred_arg(log_deferred_writer_t *w, uint64_t value)
+{
+    log_deferred_put_tag(w, LOG_ARG_U64);
+    log_deferred_put(w, &value, sizeof(value));
+}
+
+void log_deferred_arg(log_deferred_writer_t *w, int value)
+{
+    log_deferred_put_tag(w, LOG_ARG_INT);
+    log_deferred_put(w, &value, sizeof(value));
+}
+
+void log_deferred_arg(log_deferred_writer_t *w, bytearray array)
+{
+    uint16_t total = (array.len > 0xFFFF) ? 0xFFFF : array.len;
+    uint8_t stored = (total > LOG_DEFERRED_MAX_BYTES) ? LOG_DEFERRED_MAX_BYTES : total;
+    log_deferred_put_tag(w, LOG_ARG_BYTES);
+    log_deferred_put(w, &total, sizeof(total));
+    log_deferred_put(w, &stored, 1);
+    log_deferred_put(w, array.data, stored);
+}
+
+bool log_deferred_pending()
+{
+    return g_log_deferred_ring.head != g_log_deferred_ring.tail;
+}
+
+static void log_deferred_get(uint32_t *pos, void *data, size_t len)
+{
+    uint8_t *dst = (uint8_t*)data;
+    for (size_t i = 0; i < len; i++)
+    {
+        dst[i] = g_log_deferred_ring.buf[((*pos)++) & LOG_DEFERRED_MASK];
+    }
+}
+
+// Format one record starting at tail, returns false if record is corrupted
+static bool log_deferred_format_record()
+{
+    uint32_t pos = g_log_deferred_ring.tail;
+    uint8_t argc;
+    uint32_t timestamp;
+    log_deferred_get(&pos, &argc, 1);
+    log_deferred_get(&pos, &timestamp, 4);
+
+    log_raw("[", (int)timestamp, "ms] DBG ");
+
+    for (int i = 0; i < argc; i++)
+    {
+        uint8_t tag;
+        log_deferred_get(&pos, &tag, 1);
+
+        if (tag == LOG_ARG_CONST_STR)
+        {
+            const char *str;
+            log_deferred_get(&pos, &str, sizeof(str));
+#ifdef PLATFORM_LOG_IS_CONST_STR
+            if (!PLATFORM_LOG_IS_CONST_STR(str)) return false;
+#else
+            return false;
+#endif
+            log_raw(str);
+        }
+        else if (tag == LOG_ARG_STR)
+        {
+            char str[LOG_DEFERRED_MAX_STRLEN + 1];
+            uint8_t len;
+            log_deferred_get(&pos, &len, 1);
+            if (len > LOG_DEFERRED_MAX_STRLEN) return false;
+            log_deferred_get(&pos, str, len);
+            str[len] = '\0';
+            log_raw(str);
+        }
+        else if (tag == LOG_ARG_U8)
+        {
+            uint8_t value;
+            log_deferred_get(&pos, &value, sizeof(value));
+            log_raw(value);
+        }
+        else if (tag == LOG_ARG_U16)
+        {
+            uint16_t value;
+            log_deferred_get(&pos, &value, sizeof(value));
+            log_raw(value);
+        }
+        else if (tag == LOG_ARG_U32)
+        {
+            uint32_t value;
+            log_deferred_get(&pos, &value, sizeof(value));
+            log_raw(value);
+        }
+        else if (tag == LOG_ARG_U64)
+        {
+            uint64_t value;
+            log_deferred_get(&pos, &value, sizeof(value));
+            log_raw(value);
+        }
+        else if (tag == LOG_ARG_INT)
+        {
+            int value;
+            log_deferred_get(&pos, &value, sizeof(value));
+            log_raw(value);
+        }
+        else if (tag == LOG_ARG_BYTES)
+        {
+            uint8_t data[LOG_DEFERRED_MAX_BYTES];
+            uint16_t total;
+            uint8_t stored;
+            log_deferred_get(&pos, &total, sizeof(total));
+            log_deferred_get(&pos, &stored, 1);
+            if (stored > LOG_DEFERRED_MAX_BYTES) return false;
+            log_deferred_get(&pos, data, stored);
+            log_raw(bytearray(data, total));
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    log_raw("\r\n");
+    g_log_deferred_ring.tail = pos;
+    return true;
+}
+
+void log_deferred_poll(int max_records)
+{
+    while (max_records-- > 0 && log_deferred_pending())
+    {
+        if (!log_deferred_format_record())
+        {
+            // This can happen if dbgmsg() got called from interrupt while
+            // another record was being written. Discard pending data.
+            g_log_deferred_ring.tail = g_log_deferred_ring.head;
+            log_raw("[", (int)millis(), "ms] Deferred debug log corrupted, discarding pending messages\r\n");
+        }
+    }
+
+    if (g_log_deferred_ring.dropped > 0 && !log_deferred_pending())
+    {
+        uint32_t dropped = g_log_deferred_ring.dropped;
+        g_log_deferred_ring.dropped = 0;
+        log_raw("[", (int)millis(), "ms] DBG ");
+        log_raw((int)dropped, " debug messages dropped, deferred log buffer full\r\n");
+    }
+}
+
+void log_deferred_flush()
+{
+    log_deferred_poll(LOG_DEFERRED_BUFSIZE);
+}
+
+void log_deferred_flush_some()
+{
+    log_deferred_poll(LOG_DEFERRED_POLL_RECORDS);
+}
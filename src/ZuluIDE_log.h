@@ -37,6 +37,14 @@ const char *log_get_buffer(uint32_t *startpos, uint32_t *available = nullptr);
 // Whether to enable debug messages
 extern bool g_log_debug;
 
+// Whether to store debug messages in binary form and format them later
+// in log_deferred_poll(). This keeps the time spent in dbgmsg() small.
+extern bool g_log_deferred;
+
+// Returns false when called from a context that must not write to the log,
+// such as the second core on platforms that run SD card transfers there.
+bool log_is_allowed();
+
 // Firmware version string
 extern const char *g_log_firmwareversion;
 
@@ -73,6 +81,51 @@ inline void log_raw()
 
 extern "C" unsigned long millis();
 
+// Deferred debug messages are stored as binary records in a ring buffer.
+// Each record contains timestamp and the raw argument values, string
+// literals are stored by pointer when the platform allows it.
+struct log_deferred_writer_t {
+    uint32_t pos;
+    bool overflow;
+};
+
+void log_deferred_begin(log_deferred_writer_t *w, int argc);
+void log_deferred_end(log_deferred_writer_t *w);
+
+void log_deferred_arg(log_deferred_writer_t *w, const char *str);
+void log_deferred_arg(log_deferred_writer_t *w, uint8_t value);
+void log_deferred_arg(log_deferred_writer_t *w, uint16_t value);
+void log_deferred_arg(log_deferred_writer_t *w, uint32_t value);
+void log_deferred_arg(log_deferred_writer_t *w, uint64_t value);
+void log_deferred_arg(log_deferred_writer_t *w, int value);
+void log_deferred_arg(log_deferred_writer_t *w, bytearray array);
+
+inline void log_deferred_args(log_deferred_writer_t *w)
+{
+    // End of template recursion
+}
+
+template<typename T, typename... Rest>
+inline void log_deferred_args(log_deferred_writer_t *w, T first, Rest... rest)
+{
+    log_deferred_arg(w, first);
+    log_deferred_args(w, rest...);
+}
+
+// Returns true if there are deferred messages waiting to be formatted
+bool log_deferred_pending();
+
+// Format up to max_records deferred messages into the text log.
+// Called from idle time in main loop.
+void log_deferred_poll(int max_records);
+
+// Format all pending deferred messages
+void log_deferred_flush();
+
+// Format a bounded number of pending deferred messages.
+// Called before each regular log message.
+void log_deferred_flush_some();
+
 // Variadic template for printing multiple items
 template<typename T, typename T2, typename... Rest>
 inline void log_raw(T first, T2 second, Rest... rest)
@@ -86,6 +139,15 @@ inline void log_raw(T first, T2 second, Rest... rest)
 template<typename... Params>
 inline void logmsg(Params... params)
 {
+    if (!log_is_allowed()) return;
+
+    // Format the oldest debug messages first. If there are many pending,
+    // the rest are formatted later and can appear after this message.
+    if (log_deferred_pending())
+    {
+        log_deferred_flush_some();
+    }
+
     log_raw("[", (int)millis(), "ms] ");
     log_raw(params...);
     log_raw("\r\n");
@@ -95,7 +157,16 @@ inline void logmsg(Params... params)
 template<typename... Params>
 inline void dbgmsg(Params... params)
 {
-    if (g_log_debug)
+    if (!g_log_debug || !log_is_allowed()) return;
+
+    if (g_log_deferred)
+    {
+        log_deferred_writer_t w;
+        log_deferred_begin(&w, sizeof...(params));
+        log_deferred_args(&w, params...);
+        log_deferred_end(&w);
+    }
+    else
     {
         log_raw("[", (int)millis(), "ms] DBG ");
         log_raw(params...);
@@ -405,11 +405,17 @@ ssize_t IDEATAPIDevice::atapi_send_data_async(const uint8_t *data, size_t blocks
     if (m_atapi_state.data_state == ATAPI_DATA_WRITE &&
         blocksize == m_atapi_state.blocksize)
     {
-        // Fast path, transfer size has already been set up
+        // Fast path, transfer size has already been set up.
+        // Image data can be transferred in the background, but m_buffer
+        // may get reused by the caller as soon as this function returns.
+        bool in_buffer = (data >= m_buffer.bytes && data < m_buffer.bytes + sizeof(m_buffer));
         size_t blocks_sent = 0;
         while (blocks_sent < num_blocks && ide_phy_can_write_block())
         {
-            ide_phy_write_block(data, blocksize);
+            if (in_buffer)
+                ide_phy_write_block(data, blocksize);
+            else
+                ide_phy_write_block_async(data, blocksize);
             data += blocksize;
             blocks_sent++;
         }
@@ -681,6 +687,7 @@ bool IDEATAPIDevice::handle_atapi_command(const uint8_t *cmd)
         case ATAPI_CMD_WRITE10:         return atapi_write(cmd);
         case ATAPI_CMD_WRITE12:         return atapi_write(cmd);
         case ATAPI_CMD_WRITE_AND_VERIFY10: return atapi_write(cmd);
+        case ATAPI_CMD_SYNCHRONIZE_CACHE: return atapi_synchronize_cache(cmd);
 
         default:
             logmsg("-- WARNING: Unsupported ATAPI command ", get_atapi_command_name(cmd[0]));
@@ -1197,6 +1204,19 @@ bool IDEATAPIDevice::atapi_write(const uint8_t *cmd)
     return doWrite(lba, transfer_len);
 }
 
+// Write any data in the image write-back cache to the SD card
+bool IDEATAPIDevice::atapi_synchronize_cache(const uint8_t *cmd)
+{
+    if (!is_medium_present()) return atapi_cmd_not_ready_error();
+
+    if (!m_image->flush())
+    {
+        return atapi_cmd_error(ATAPI_SENSE_MEDIUM_ERROR, 0);
+    }
+
+    return atapi_cmd_ok();
+}
+
 // Start write transfer to image file. Can be called directly by subclasses.
 bool IDEATAPIDevice::doWrite(uint32_t lba, uint32_t transfer_len)
 {
@@ -128,11 +128,12 @@ protected:
     } m_removable;
 
     // Buffer used for responses, ide_phy code benefits from this being aligned to 32 bits
-    // Enough for any inquiry/mode response and for up to one CD sector.
+    // Enough for any inquiry/mode response and for up to one CD sector
+    // with formatted Q subchannel (2352 + 16 bytes).
     union {
-        uint32_t dword[588];
-        uint16_t word[1176];
-        uint8_t bytes[2352];
+        uint32_t dword[592];
+        uint16_t word[1184];
+        uint8_t bytes[2368];
     } m_buffer;
 
     // IDE command handlers
@@ -184,6 +185,7 @@ protected:
     virtual bool atapi_read_capacity(const uint8_t *cmd);
     virtual bool atapi_read(const uint8_t *cmd);
     virtual bool atapi_write(const uint8_t *cmd);
+    virtual bool atapi_synchronize_cache(const uint8_t *cmd);
 
     // Read handlers
     virtual bool doRead(uint32_t lba, uint32_t transfer_len);
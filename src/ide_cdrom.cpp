@@ -302,7 +302,7 @@ void IDECDROMDevice::set_image(IDEImage *image)
         strncasecmp(filename + strlen(filename) - 4, ".bin", 4) == 0)
     {
         char cuesheetname[MAX_FILE_PATH + 1] = {0};
-        strncpy(cuesheetname, filename, strlen(filename) - 4);
+        memcpy(cuesheetname, filename, strlen(filename) - 4);
         strlcat(cuesheetname, ".cue", sizeof(cuesheetname));
 
         valid = loadAndValidateCueSheet(cuesheetname);
@@ -319,15 +319,21 @@ void IDECDROMDevice::set_image(IDEImage *image)
         m_cueparser = CUEParser(m_cuesheet);
     }
 
+    loadTrackTable();
+
     if (image)
     {
         CUETrackInfo firsttrack, lasttrack;
-        getFirstLastTrackInfo(firsttrack, lasttrack);
-
-        bool firstaudio = (firsttrack.track_mode == CUETrack_AUDIO);
-        bool lastaudio = (lasttrack.track_mode == CUETrack_AUDIO);
+        bool has_tracks = getFirstLastTrackInfo(firsttrack, lasttrack);
+        bool firstaudio = has_tracks && (firsttrack.track_mode == CUETrack_AUDIO);
+        bool lastaudio = has_tracks && (lasttrack.track_mode == CUETrack_AUDIO);
 
-        if (firstaudio && lastaudio)
+        if (!has_tracks)
+        {
+            logmsg("---- No tracks found in cue sheet");
+            m_devinfo.medium_type = ATAPI_MEDIUM_CDROM;
+        }
+        else if (firstaudio && lastaudio)
         {
             m_devinfo.medium_type = ATAPI_MEDIUM_CDDA;
         }
@@ -1269,33 +1275,74 @@ bool IDECDROMDevice::loadAndValidateCueSheet(const char *cuesheetname)
     return true;
 }
 
-bool IDECDROMDevice::getFirstLastTrackInfo(CUETrackInfo &first, CUETrackInfo &last)
+// Parse the CUE sheet into m_tracks and compute lead-out position
+void IDECDROMDevice::loadTrackTable()
 {
+    m_track_count = 0;
     m_cueparser.restart();
 
     const CUETrackInfo *trackinfo;
-    bool got_track = false;
     while ((trackinfo = m_cueparser.next_track()) != NULL)
     {
-        if (!got_track)
+        if (m_track_count >= CD_MAX_TRACKS)
         {
-            first = *trackinfo;
-            got_track = true;
+            logmsg("---- Cue sheet has more than ", (int)CD_MAX_TRACKS, " tracks, ignoring the rest");
+            break;
         }
 
-        last = *trackinfo;
+        cd_track_t *track = &m_tracks[m_track_count++];
+        track->file_offset = trackinfo->file_offset;
+        track->track_start = trackinfo->track_start;
+        track->data_start = trackinfo->data_start;
+        track->unstored_pregap_length = trackinfo->unstored_pregap_length;
+        track->sector_length = trackinfo->sector_length;
+        track->track_number = trackinfo->track_number;
+        track->track_mode = trackinfo->track_mode;
+    }
+
+    if (m_track_count > 0)
+    {
+        CUETrackInfo last;
+        getTrackInfo(m_track_count - 1, last);
+        m_leadout_lba = getLeadOutLBA(&last);
+    }
+    else
+    {
+        m_leadout_lba = getLeadOutLBA(nullptr);
+    }
+}
+
+void IDECDROMDevice::getTrackInfo(int idx, CUETrackInfo &result)
+{
+    const cd_track_t *track = &m_tracks[idx];
+    result = CUETrackInfo{};
+    result.file_mode = CUEFile_BINARY;
+    result.file_offset = track->file_offset;
+    result.track_number = track->track_number;
+    result.track_mode = (CUETrackMode)track->track_mode;
+    result.sector_length = track->sector_length;
+    result.unstored_pregap_length = track->unstored_pregap_length;
+    result.data_start = track->data_start;
+    result.track_start = track->track_start;
+}
+
+bool IDECDROMDevice::getFirstLastTrackInfo(CUETrackInfo &first, CUETrackInfo &last)
+{
+    if (m_track_count == 0)
+    {
+        return false;
     }
 
-    return got_track;
+    getTrackInfo(0, first);
+    getTrackInfo(m_track_count - 1, last);
+    return true;
 }
 
 uint64_t IDECDROMDevice::capacity_lba()
 {
     if (!m_image) return 0;
 
-    CUETrackInfo first, last;
-    getFirstLastTrackInfo(first, last);
-    return (uint64_t)getLeadOutLBA(&last);
+    return m_leadout_lba;
 }
 
 
@@ -1386,24 +1433,28 @@ uint32_t IDECDROMDevice::getLeadOutLBA(const CUETrackInfo* lasttrack)
     }
 }
 
-// Fetch track info based on LBA
+// Fetch track info based on LBA.
+// Tracks in a CUE sheet are in increasing order, so binary search can be used.
 CUETrackInfo IDECDROMDevice::getTrackFromLBA(uint32_t lba)
 {
     CUETrackInfo result = {};
-    const CUETrackInfo *tmptrack;
-    m_cueparser.restart();
-    while ((tmptrack = m_cueparser.next_track()) != NULL)
+    if (m_track_count == 0 || m_tracks[0].track_start > lba)
     {
-        if (tmptrack->track_start <= lba)
-        {
-            result = *tmptrack;
-        }
+        return result;
+    }
+
+    int low = 0;
+    int high = m_track_count - 1;
+    while (low < high)
+    {
+        int mid = (low + high + 1) / 2;
+        if (m_tracks[mid].track_start <= lba)
+            low = mid;
         else
-        {
-            break;
-        }
+            high = mid - 1;
     }
 
+    getTrackInfo(low, result);
     return result;
 }
 
@@ -26,6 +26,9 @@
 #include "ide_atapi.h"
 #include <CUEParser.h>
 
+// Maximum number of tracks on a CD
+#define CD_MAX_TRACKS 99
+
 // Event Status Notification handling
 class IDECDROMDevice: public IDEATAPIDevice
 {
@@ -112,6 +115,25 @@ protected:
     uint32_t getLeadOutLBA(const CUETrackInfo* lasttrack);
     CUETrackInfo getTrackFromLBA(uint32_t lba);
 
+    // Track list parsed from CUE sheet in set_image(), for lookups
+    // during read commands without parsing the CUE sheet text again.
+    // Compact form of CUETrackInfo, 24 bytes per track (2.3 kB in total).
+    // Firmware has a single CD-ROM device instance, so the table is not duplicated.
+    struct cd_track_t {
+        uint64_t file_offset;
+        uint32_t track_start;
+        uint32_t data_start;
+        uint32_t unstored_pregap_length;
+        uint16_t sector_length;
+        uint8_t track_number;
+        uint8_t track_mode;
+    };
+    cd_track_t m_tracks[CD_MAX_TRACKS];
+    int m_track_count;
+    uint32_t m_leadout_lba;
+    void loadTrackTable();
+    void getTrackInfo(int idx, CUETrackInfo &result);
+
     // ATAPI configuration pages
     virtual size_t atapi_get_configuration(uint16_t feature, uint8_t *buffer, size_t max_bytes) override;
 
@@ -40,7 +40,9 @@
 #define IDE_ERROR_EXEC_DEV_DIAG_DEV1_FAIL 0x80
 #define IDE_ERROR_EXEC_DEV_DIAG_DEV0_PASS 0x01
 #define IDE_ERROR_WRITEPROTECT    0x40
+#define IDE_ERROR_UNCORRECTABLE   0x40
 #define IDE_ERROR_MEDIACHANGE     0x20
+#define IDE_ERROR_IDNF            0x10
 #define IDE_ERROR_MEDIACHANGEREQ  0x08
 #define IDE_ERROR_ABORT           0x04
 #define IDE_ERROR_NOMEDIA         0x01
@@ -51,13 +53,14 @@
 #define IDE_DEVCTRL_HOB     0x80
 
 // Device bits register bits
-#define IDE_DEVICE_DEV  0x10;
+#define IDE_DEVICE_DEV  0x10
 
 // IDE command set defined as X-macro
 // These will be available as enum values named IDE_CMD_xxx
 #define IDE_COMMAND_LIST(X) \
 X(IDE_CMD_NOP                                       , 0x00) \
 X(IDE_CMD_CFA_REQUEST_EXTENDED_ERROR                , 0x03) \
+X(IDE_CMD_DATA_SET_MANAGEMENT                       , 0x06) \
 X(IDE_CMD_DEVICE_RESET                              , 0x08) \
 X(IDE_CMD_READ_SECTORS                              , 0x20) \
 X(IDE_CMD_READ_SECTORS_EXT                          , 0x24) \
@@ -178,13 +181,18 @@ IDE_COMMAND_LIST(IDE_ENUM_ENTRY)
 #define IDE_IDENTIFY_OFFSET_HARDWARE_RESET_RESULT    93
 #define IDE_IDENTIFY_OFFSET_ACOUSTIC_MANAGEMENT      94
 #define IDE_IDENTIFY_OFFSET_MAX_LBA                 100
+#define IDE_IDENTIFY_OFFSET_DSM_MAX_BLOCKS          105
 #define IDE_IDENTIFY_OFFSET_BYTE_COUNT_ZERO         125
 #define IDE_IDENTIFY_OFFSET_REMOVABLE_MEDIA_SUPPORT 127
 #define IDE_IDENTIFY_OFFSET_SECURITY_STATUS         128
 #define IDE_IDENTIFY_OFFSET_CFA_POWER_MODE_1        160
+#define IDE_IDENTIFY_OFFSET_DATA_SET_MANAGEMENT     169
 #define IDE_IDENTIFY_OFFSET_MEDIA_SERIAL_NUMBER     176
 #define IDE_IDENTIFY_OFFSET_INTEGRITY_WORD          255
 
+// IDE_CMD_DATA_SET_MANAGEMENT feature register bits
+#define IDE_DSM_FEATURE_TRIM                        0x01
+
 // IDE_CMD_SET_FEATURES feature register values
 #define IDE_SET_FEATURE_ENABLE_8BIT                 0x01
 #define IDE_SET_FEATURE_ENABLE_WRITE_CACHE          0x02
@@ -20,6 +20,7 @@
 **/
 
 #include "ide_imagefile.h"
+#include "ide_phy.h"
 #include <strings.h>
 #include "ZuluIDE.h"
 #include "ZuluIDE_config.h"
@@ -29,6 +30,44 @@
 // SD card callbacks from platform code use global state
 IDEImageFile::sd_cb_state_t IDEImageFile::sd_cb_state;
 
+// Cache of recently read sectors, such as partition tables, FAT sectors
+// and ISO9660 directories that hosts read repeatedly. Only one image is
+// accessed at a time, so the cache is global and tagged with its owner.
+static struct {
+    const IDEImageFile *owner;
+    uint32_t max_sectors;
+    uint32_t use_counter;
+    uint32_t hits;
+    uint32_t misses;
+
+    struct {
+        bool valid;
+        uint32_t sector;    // Sector number in image file
+        uint32_t last_used; // use_counter value at latest access
+    } entries[IMAGE_SECTOR_CACHE_MAX];
+
+    uint32_t data[IMAGE_SECTOR_CACHE_MAX][128];
+} g_sector_cache = {nullptr, IMAGE_SECTOR_CACHE_MAX};
+
+// Write-back cache keeps recently written sectors in RAM until the host
+// has been idle for a while or requests FLUSH CACHE. Data is lost if power
+// is removed before that, so the cache is disabled by default.
+static struct {
+    IDEImageFile *owner;
+    bool allowed; // Set from zuluide.ini, host can only enable the cache if allowed
+    bool enabled;
+    bool write_error; // Drain failed, reported by next flush()
+    uint32_t dirty_count;
+    uint32_t last_write; // millis() at latest cached write
+
+    struct {
+        bool dirty;
+        uint32_t sector; // Sector number in image file
+    } entries[IMAGE_WRITE_CACHE_SECTORS];
+
+    uint32_t data[IMAGE_WRITE_CACHE_SECTORS][128];
+} g_write_cache;
+
 IDEImageFile::IDEImageFile(): IDEImageFile(nullptr, 0)
 {
 
@@ -45,9 +84,13 @@ void IDEImageFile::clear()
 {
     m_blockdev = nullptr;
     m_contiguous = false;
+    m_raw = false;
     m_first_sector = 0;
+    m_position = 0;
+    m_extent_count = 0;
     m_capacity = 0;
     m_read_only = false;
+    readahead_reset();
 
 }
 
@@ -63,8 +106,19 @@ bool IDEImageFile::open_file(FsVolume *volume, const char *filename, bool read_o
         read_only = true;
     }
 
+    if (g_write_cache.owner == this)
+    {
+        write_cache_flush();
+        g_write_cache.owner = nullptr;
+    }
+
     m_contiguous = false;
+    m_raw = false;
+    m_blockdev = nullptr;
+    m_position = 0;
+    m_extent_count = 0;
     m_read_only = read_only;
+    readahead_reset();
     m_file.close();
     m_file = volume->open(filename, read_only ? O_RDONLY : O_RDWR);
 
@@ -82,18 +136,199 @@ bool IDEImageFile::open_file(FsVolume *volume, const char *filename, bool read_o
         dbgmsg("Image file ", filename, " is contiguous, sectors ", (int)begin, " to ", (int)end);
         m_first_sector = begin;
         m_contiguous = true;
+
+        m_extents[0].file_sector = 0;
+        m_extents[0].sd_sector = begin;
+        m_extents[1].file_sector = end - begin + 1;
+        m_extents[1].sd_sector = 0;
+        m_extent_count = 1;
+    }
+    else if (volume == SD.vol() && build_extent_map(volume))
+    {
+        logmsg("Image file ", filename, " is fragmented in ", (int)m_extent_count, " parts");
     }
     else
     {
         logmsg("Image file ", filename, " is not contiguous, access will be slower");
     }
 
+    // Raw sector access requires the sector numbers to refer to the main SD card
+    if (m_extent_count > 0 && volume == SD.vol())
+    {
+        m_blockdev = SD.card();
+    }
+
+    return true;
+}
+
+// The sector range is described as a single extent, so all access goes
+// through access_raw() and there is no FsFile.
+bool IDEImageFile::open_raw(SdCard *card, uint32_t first_sector, uint32_t sector_count, bool read_only)
+{
+    if (g_write_cache.owner == this)
+    {
+        write_cache_flush();
+        g_write_cache.owner = nullptr;
+    }
+
+    m_file.close();
+    readahead_reset();
+    m_position = 0;
+    m_read_only = read_only;
+
+    if (!card || sector_count == 0 ||
+        (uint64_t)first_sector + sector_count > card->sectorCount())
+    {
+        logmsg("Raw image sectors ", (int)first_sector, " + ", (int)sector_count, " are not on the SD card");
+        clear();
+        return false;
+    }
+
+    m_blockdev = card;
+    m_contiguous = true;
+    m_raw = true;
+    m_first_sector = first_sector;
+    m_extents[0].file_sector = 0;
+    m_extents[0].sd_sector = first_sector;
+    m_extents[1].file_sector = sector_count;
+    m_extents[1].sd_sector = 0;
+    m_extent_count = 1;
+    m_capacity = (uint64_t)sector_count * 512;
+
+    logmsg("Using SD card sectors ", (int)first_sector, " to ", (int)(first_sector + sector_count - 1),
+           " as raw image", read_only ? " (read only)" : "");
     return true;
 }
 
+// Walk the FAT cluster chain of a fragmented image file and store it as a list of extents.
+// SdFat would do the same walk from the start of the file on every backwards seek.
+bool IDEImageFile::build_extent_map(FsVolume *volume)
+{
+    uint8_t fat_type = volume->fatType();
+    if (fat_type != FAT_TYPE_FAT16 && fat_type != FAT_TYPE_FAT32 && fat_type != FAT_TYPE_EXFAT)
+    {
+        return false;
+    }
+
+    SdCard *card = SD.card();
+    uint32_t sectors_per_cluster = volume->sectorsPerCluster();
+    uint32_t data_start = volume->dataStartSector();
+    uint32_t fat_start = volume->fatStartSector();
+    uint32_t max_cluster = volume->clusterCount() + 1;
+    uint32_t first_sector = m_file.firstSector();
+    if (!card || sectors_per_cluster == 0 || first_sector < data_start)
+    {
+        return false;
+    }
+
+    // Make sure any pending FAT updates have been written to the card
+    m_file.sync();
+
+    uint32_t cluster_bytes = sectors_per_cluster * 512;
+    uint32_t clusters_needed = (m_capacity + cluster_bytes - 1) / cluster_bytes;
+    uint32_t cluster = (first_sector - data_start) / sectors_per_cluster + 2;
+    uint32_t entries_per_sector = (fat_type == FAT_TYPE_FAT16) ? 256 : 128;
+
+    uint32_t fat_buf[128];
+    uint32_t fat_buf_sector = 0xFFFFFFFF;
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < clusters_needed; i++)
+    {
+        if (cluster < 2 || cluster > max_cluster)
+        {
+            dbgmsg("-- Invalid cluster ", cluster, " in FAT chain at index ", i);
+            m_extent_count = 0;
+            return false;
+        }
+
+        uint32_t sd_sector = data_start + (cluster - 2) * sectors_per_cluster;
+        uint32_t file_sector = i * sectors_per_cluster;
+        if (count == 0 ||
+            m_extents[count - 1].sd_sector + (file_sector - m_extents[count - 1].file_sector) != sd_sector)
+        {
+            if (count >= IMAGE_MAX_EXTENTS)
+            {
+                dbgmsg("-- Image file has more than ", (int)IMAGE_MAX_EXTENTS, " fragments");
+                m_extent_count = 0;
+                return false;
+            }
+
+            m_extents[count].file_sector = file_sector;
+            m_extents[count].sd_sector = sd_sector;
+            count++;
+        }
+
+        if (i + 1 < clusters_needed)
+        {
+            // Look up next cluster from the FAT
+            uint32_t fat_sector = fat_start + cluster / entries_per_sector;
+            if (fat_sector != fat_buf_sector)
+            {
+                if (!card->readSectors(fat_sector, (uint8_t*)fat_buf, 1))
+                {
+                    m_extent_count = 0;
+                    return false;
+                }
+                fat_buf_sector = fat_sector;
+            }
+
+            uint32_t idx = cluster % entries_per_sector;
+            if (fat_type == FAT_TYPE_FAT16)
+                cluster = ((uint16_t*)fat_buf)[idx];
+            else if (fat_type == FAT_TYPE_FAT32)
+                cluster = fat_buf[idx] & 0x0FFFFFFF;
+            else
+                cluster = fat_buf[idx];
+        }
+    }
+
+    m_extents[count].file_sector = clusters_needed * sectors_per_cluster;
+    m_extents[count].sd_sector = 0;
+    m_extent_count = count;
+    return count > 0;
+}
+
+// Binary search for the extent that contains the given file sector
+uint32_t IDEImageFile::find_extent(uint32_t file_sector)
+{
+    uint32_t low = 0;
+    uint32_t high = m_extent_count - 1;
+    while (low < high)
+    {
+        uint32_t mid = (low + high + 1) / 2;
+        if (m_extents[mid].file_sector <= file_sector)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
 void IDEImageFile::close()
 {
+    if (g_write_cache.owner == this)
+    {
+        write_cache_flush();
+        g_write_cache.owner = nullptr;
+    }
+
+    if (g_sector_cache.owner == this)
+    {
+        sector_cache_log_stats();
+        g_sector_cache.owner = nullptr;
+    }
+
+    if (m_raw)
+    {
+        m_raw = false;
+        m_blockdev = nullptr;
+        m_extent_count = 0;
+        m_capacity = 0;
+    }
+
     m_file.close();
+    readahead_reset();
 }
 
 bool IDEImageFile::get_filename(char *buf, size_t buflen)
@@ -409,12 +644,12 @@ uint64_t IDEImageFile::capacity()
 
 uint64_t IDEImageFile::file_position()
 {
-    return m_file.position();
+    return m_position;
 }
 
 bool IDEImageFile::is_open()
 {
-    return m_file.isOpen();
+    return m_raw || m_file.isOpen();
 }
 
 bool IDEImageFile::writable()
@@ -426,173 +661,1169 @@ bool IDEImageFile::writable()
 /* Data transfer from SD card */
 /******************************/
 
-bool IDEImageFile::read(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback)
+// Check if access can bypass the filesystem layer and go directly to SD card sectors
+bool IDEImageFile::can_access_raw(uint64_t pos, size_t count)
 {
-    if (!m_file.seek(startpos)) return false;
-
-    assert(blocksize <= m_buffer_size);
+    return m_blockdev != nullptr
+        && (pos & 511) == 0
+        && (count & 511) == 0
+        && pos + count <= m_capacity
+        && pos + count <= (uint64_t)m_extents[m_extent_count].file_sector * 512;
+}
 
-    sd_cb_state.callback = callback;
-    sd_cb_state.error = false;
-    sd_cb_state.buffer = m_buffer;
-    sd_cb_state.num_blocks = num_blocks;
-    sd_cb_state.blocksize = blocksize;
-    sd_cb_state.blocks_done = 0;
-    sd_cb_state.blocks_available = 0;
-    sd_cb_state.bufsize_blocks = m_buffer_size / blocksize;
+// Transfer sectors directly to/from SD card, splitting at fragment boundaries.
+// The buffer pointer advances continuously, so platform stream callbacks keep working.
+bool IDEImageFile::access_raw(uint64_t pos, uint8_t *buf, size_t count, bool write)
+{
+    uint32_t sector = pos / 512;
+    uint32_t sectors_left = count / 512;
 
-    while (sd_cb_state.blocks_done < num_blocks && !sd_cb_state.error)
+    while (sectors_left > 0)
     {
-        platform_poll();
+        uint32_t idx = find_extent(sector);
+        uint32_t offset = sector - m_extents[idx].file_sector;
+        uint32_t len = std::min(sectors_left, m_extents[idx + 1].file_sector - sector);
+        uint32_t sd_sector = m_extents[idx].sd_sector + offset;
+
+        bool status;
+        if (write)
+            status = m_blockdev->writeSectors(sd_sector, buf, len);
+        else
+            status = m_blockdev->readSectors(sd_sector, buf, len);
 
-        // Check if we have buffer space to read more from SD card
-        if (sd_cb_state.blocks_available < num_blocks &&
-            sd_cb_state.blocks_available < sd_cb_state.blocks_done + sd_cb_state.bufsize_blocks)
+        if (!status)
         {
-            // Check how many contiguous blocks we have space available for.
-            // Limit by:
-            // 1. Total requested transfer size
-            // 2. Number of free slots in buffer
-            // 3. Space until wrap point of the buffer
-            size_t start_idx = sd_cb_state.blocks_available % sd_cb_state.bufsize_blocks;
-            size_t max_read = std::min({
-                num_blocks - sd_cb_state.blocks_available,
-                sd_cb_state.blocks_done + sd_cb_state.bufsize_blocks - sd_cb_state.blocks_available,
-                sd_cb_state.bufsize_blocks - start_idx
-            });
+            return false;
+        }
 
-            // Read from SD card and process callbacks
-            uint8_t *buf = m_buffer + blocksize * start_idx;
-            platform_set_sd_callback(&IDEImageFile::sd_read_callback, buf);
-            int status = m_file.read(buf, blocksize * max_read);
-            platform_set_sd_callback(nullptr, nullptr);
+        sector += len;
+        sectors_left -= len;
+        buf += len * 512;
+    }
 
-            // Check status of SD card read
-            if (status != blocksize * max_read)
-                sd_cb_state.error = true;
-            else
-                sd_cb_state.blocks_available += max_read;
-        }
+    if (write)
+    {
+        raw_write_done();
+    }
 
-        // Provide callbacks until all blocks have been processed,
-        // even if SD card read is done.
-        if (sd_cb_state.blocks_done < sd_cb_state.blocks_available)
-        {
-            sd_read_callback(0);
-        }
+    return true;
+}
+
+// SdFat may still have one of the sectors that were written or erased in its
+// cache from an earlier unaligned access. Drop the cache so that later FsFile
+// reads get the new data. Partial sector writes are flushed in write_at(),
+// so the cache never has data for the image that is not on the card.
+void IDEImageFile::raw_write_done()
+{
+    if (!m_raw)
+    {
+        SD.vol()->cacheClear();
     }
+}
 
-    return !sd_cb_state.error;
+// Read from image file at given position.
+// When the image location is known, it is read with multi-sector commands
+// to the SD card, without going through SdFat cluster chain and cache.
+bool IDEImageFile::read_at(uint64_t pos, uint8_t *buf, size_t count)
+{
+    if (can_access_raw(pos, count))
+    {
+        return access_raw(pos, buf, count, false);
+    }
+
+    if (m_file.position() != pos && !m_file.seek(pos))
+    {
+        return false;
+    }
+
+    // SdFat copies data from its sector cache without going through the
+    // SD card driver, which waits for buffers still being sent to the PHY.
+    ide_phy_wait_buffer(buf, count);
+    return m_file.read(buf, count) == (int)count;
 }
 
-void IDEImageFile::sd_read_callback(uint32_t bytes_complete)
+bool IDEImageFile::write_at(uint64_t pos, const uint8_t *buf, size_t count)
 {
-    // Update number of blocks available by the latest callback status.
-    // sd_cb_state.blocks_available will be updated when SD card read() returns.
-    size_t blocks_available = sd_cb_state.blocks_available + bytes_complete / sd_cb_state.blocksize;
+    if (m_read_only)
+    {
+        return false;
+    }
 
-    // Check how many contiguous blocks are available to process.
-    size_t start_idx = sd_cb_state.blocks_done % sd_cb_state.bufsize_blocks;
-    size_t max_write = std::min({
-        blocks_available - sd_cb_state.blocks_done,
-        sd_cb_state.bufsize_blocks - start_idx
-    });
+    if (can_access_raw(pos, count))
+    {
+        return access_raw(pos, (uint8_t*)buf, count, true);
+    }
 
-    if (max_write > 0)
+    if (m_file.position() != pos && !m_file.seek(pos))
     {
-        uint8_t *data_start = sd_cb_state.buffer + start_idx * sd_cb_state.blocksize;
-        ssize_t status = sd_cb_state.callback->read_callback(data_start, sd_cb_state.blocksize, max_write);
-        if (status < 0)
-            sd_cb_state.error = true;
-        else
-            sd_cb_state.blocks_done += status;
+        return false;
+    }
+
+    if (m_file.write(buf, count) != count)
+    {
+        return false;
+    }
+
+    if (m_blockdev)
+    {
+        // Partial sector writes are buffered in SdFat cache.
+        // Flush them so that later raw sector reads see the new data.
+        m_file.flush();
     }
+
+    return true;
 }
 
 /******************************/
-/* Data transfer to SD card */
+/* Sequential read-ahead      */
 /******************************/
 
-// For now this uses simple blocking access, because we don't need CD-ROM write yet.
-bool IDEImageFile::write(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback)
+void IDEImageFile::readahead_reset()
 {
-    if (!m_file.seek(startpos)) return false;
+    m_readahead.sequential_reads = 0;
+    m_readahead.next_pos = 0;
+    m_readahead.start = 0;
+    m_readahead.bytes = 0;
+}
 
-    assert(blocksize <= m_buffer_size);
+void IDEImageFile::prefetch_poll()
+{
+    if (!is_open() || !m_buffer ||
+        m_readahead.sequential_reads < IMAGE_READAHEAD_MIN_SEQUENTIAL)
+    {
+        return;
+    }
 
-    sd_cb_state.callback = callback;
-    sd_cb_state.error = false;
-    sd_cb_state.buffer = m_buffer;
-    sd_cb_state.num_blocks = num_blocks;
-    sd_cb_state.blocksize = blocksize;
-    sd_cb_state.blocks_done = 0;
-    sd_cb_state.blocks_available = 0;
-    sd_cb_state.bufsize_blocks = m_buffer_size / blocksize;
+    if (m_readahead.next_pos < m_readahead.start ||
+        m_readahead.next_pos > m_readahead.start + m_readahead.bytes)
+    {
+        // Host has moved outside prefetched area
+        m_readahead.start = m_readahead.next_pos;
+        m_readahead.bytes = 0;
+    }
 
-    while (sd_cb_state.blocks_done < num_blocks && !sd_cb_state.error)
+    if (m_readahead.bytes == m_buffer_size)
     {
-        platform_poll();
+        // Buffer is full, drop the data that host has already read
+        size_t consumed = (m_readahead.next_pos - m_readahead.start) & ~(size_t)511;
+        if (consumed < m_buffer_size / 2) return;
 
-        // Check if callback can provide more data
-        sd_write_callback(0);
+        memmove(m_buffer, m_buffer + consumed, m_readahead.bytes - consumed);
+        m_readahead.start += consumed;
+        m_readahead.bytes -= consumed;
+    }
 
-        // Check if there is data to be written to SD card
-        if (sd_cb_state.blocks_done < sd_cb_state.blocks_available)
-        {
-            // Check how many contiguous blocks are available to process.
-            size_t start_idx = sd_cb_state.blocks_done % sd_cb_state.bufsize_blocks;
-            size_t max_write = std::min({
-                sd_cb_state.blocks_available - sd_cb_state.blocks_done,
-                sd_cb_state.bufsize_blocks - start_idx
-            });
+    uint64_t pos = m_readahead.start + m_readahead.bytes;
+    if (pos >= m_capacity) return;
 
-            // Write data to SD card and process callbacks
-            uint8_t *buf = m_buffer + blocksize * start_idx;
-            platform_set_sd_callback(&IDEImageFile::sd_write_callback, buf);
-            int status = m_file.write(buf, blocksize * max_write);
-            platform_set_sd_callback(nullptr, nullptr);
+    size_t len = std::min<uint64_t>({
+        IMAGE_READAHEAD_CHUNK,
+        m_buffer_size - m_readahead.bytes,
+        m_capacity - pos
+    });
 
-            // Check status of SD card write
-            if (status != blocksize * max_write)
-                sd_cb_state.error = true;
-            else
-                sd_cb_state.blocks_done += max_write;
-        }
+    // Data on SD card is outdated until write_cache_poll() has written it
+    if (write_cache_overlaps(pos, len)) return;
+
+    if (!read_at(pos, m_buffer + m_readahead.bytes, len))
+    {
+        dbgmsg("-- Read-ahead failed at ", (uint32_t)pos);
+        readahead_reset();
+        return;
     }
 
-    return !sd_cb_state.error;
+    m_readahead.bytes += len;
 }
 
-void IDEImageFile::sd_write_callback(uint32_t bytes_complete)
+// Start reading ahead from the given position on next prefetch_poll().
+// If the position is already in the prefetched data, it is kept.
+void IDEImageFile::seek_hint(uint64_t startpos)
 {
-    // Update number of blocks done by the latest callback status.
-    // sd_cb_state.blocks_done will be updated when SD card write() returns.
-    size_t blocks_done = sd_cb_state.blocks_done + bytes_complete / sd_cb_state.blocksize;
+    if (!is_open() || startpos >= m_capacity) return;
 
-    if (sd_cb_state.blocks_available < sd_cb_state.num_blocks &&
-        sd_cb_state.blocks_available < blocks_done + sd_cb_state.bufsize_blocks)
+    m_readahead.sequential_reads = IMAGE_READAHEAD_MIN_SEQUENTIAL;
+    m_readahead.next_pos = startpos;
+}
+
+// Pass blocks that are already in the read-ahead buffer to callback.
+// Returns false on callback error.
+bool IDEImageFile::read_from_prefetch(uint64_t startpos, size_t blocksize, size_t num_blocks,
+                                      Callback *callback, size_t *blocks_done)
+{
+    *blocks_done = 0;
+    if (startpos < m_readahead.start || startpos >= m_readahead.start + m_readahead.bytes)
     {
-        // Check how many contiguous blocks we have space available for.
-        // Limit by:
-        // 1. Total requested transfer size
-        // 2. Number of free slots in buffer
-        // 3. Space until wrap point of the buffer
-        size_t start_idx = sd_cb_state.blocks_available % sd_cb_state.bufsize_blocks;
-        size_t max_read = std::min({
-            sd_cb_state.num_blocks - sd_cb_state.blocks_available,
-            sd_cb_state.blocks_done + sd_cb_state.bufsize_blocks - sd_cb_state.blocks_available,
-            sd_cb_state.bufsize_blocks - start_idx
-        });
+        return true;
+    }
 
-        if (max_read > 0)
+    size_t offset = startpos - m_readahead.start;
+    size_t hit_blocks = std::min(num_blocks, (m_readahead.bytes - offset) / blocksize);
+    const uint8_t *data = m_buffer + offset;
+
+    while (*blocks_done < hit_blocks)
+    {
+        platform_poll();
+
+        ssize_t status = callback->read_callback(data + *blocks_done * blocksize,
+                                                 blocksize, hit_blocks - *blocks_done);
+        if (status < 0)
         {
-            // Receive data from callback
-            uint8_t *data_start = sd_cb_state.buffer + start_idx * sd_cb_state.blocksize;
-            ssize_t status = sd_cb_state.callback->write_callback(data_start, sd_cb_state.blocksize, max_read);
-            if (status < 0)
-                sd_cb_state.error = true;
-            else
-                sd_cb_state.blocks_available += status;
+            return false;
         }
+
+        *blocks_done += status;
     }
+
+    return true;
+}
+
+/******************************/
+/* Sector cache               */
+/******************************/
+
+void IDEImageFile::set_sector_cache_size(uint32_t sectors)
+{
+    g_sector_cache.max_sectors = std::min<uint32_t>(sectors, IMAGE_SECTOR_CACHE_MAX);
+    g_sector_cache.owner = nullptr;
+}
+
+void IDEImageFile::sector_cache_log_stats()
+{
+    logmsg("-- Sector cache: ", (int)g_sector_cache.hits, " hits, ",
+           (int)g_sector_cache.misses, " misses, ",
+           (int)g_sector_cache.max_sectors, " sectors");
+}
+
+void IDEImageFile::sector_cache_invalidate(uint64_t startpos, size_t count)
+{
+    if (g_sector_cache.owner != this || count == 0) return;
+
+    uint32_t first = startpos / 512;
+    uint32_t last = (startpos + count - 1) / 512;
+    for (uint32_t i = 0; i < g_sector_cache.max_sectors; i++)
+    {
+        if (g_sector_cache.entries[i].sector >= first &&
+            g_sector_cache.entries[i].sector <= last)
+        {
+            g_sector_cache.entries[i].valid = false;
+        }
+    }
+}
+
+// Serve small aligned reads from sector cache, or read them synchronously
+// to m_buffer and add to cache. Returns false if request is not cacheable,
+// otherwise result of the read is stored in *success.
+bool IDEImageFile::read_cached(uint64_t startpos, size_t blocksize, size_t num_blocks,
+                               Callback *callback, bool *success)
+{
+    size_t count = blocksize * num_blocks;
+    if (g_sector_cache.max_sectors == 0 ||
+        count == 0 || count > IMAGE_SECTOR_CACHE_MAX_READ || count > m_buffer_size ||
+        (startpos & 511) != 0 || (count & 511) != 0 ||
+        startpos + count > m_capacity)
+    {
+        return false;
+    }
+
+    // Long sequential transfers would only flush the cache
+    if (m_readahead.sequential_reads >= IMAGE_READAHEAD_MIN_SEQUENTIAL)
+    {
+        return false;
+    }
+
+    if (g_sector_cache.owner != this)
+    {
+        // Cache contents belong to some other image
+        for (uint32_t i = 0; i < IMAGE_SECTOR_CACHE_MAX; i++)
+        {
+            g_sector_cache.entries[i].valid = false;
+        }
+        g_sector_cache.owner = this;
+        g_sector_cache.hits = 0;
+        g_sector_cache.misses = 0;
+    }
+
+    uint32_t first = startpos / 512;
+    uint32_t sectors = count / 512;
+    int found[IMAGE_SECTOR_CACHE_MAX_READ / 512];
+    bool all_found = true;
+    for (uint32_t s = 0; s < sectors; s++)
+    {
+        found[s] = -1;
+        for (uint32_t i = 0; i < g_sector_cache.max_sectors; i++)
+        {
+            if (g_sector_cache.entries[i].valid && g_sector_cache.entries[i].sector == first + s)
+            {
+                found[s] = i;
+                break;
+            }
+        }
+
+        if (found[s] < 0) all_found = false;
+    }
+
+    // Data is collected to m_buffer, so read-ahead data there is lost
+    m_readahead.start = m_readahead.next_pos;
+    m_readahead.bytes = 0;
+
+    if (all_found)
+    {
+        g_sector_cache.hits++;
+        for (uint32_t s = 0; s < sectors; s++)
+        {
+            g_sector_cache.entries[found[s]].last_used = ++g_sector_cache.use_counter;
+            memcpy(m_buffer + s * 512, g_sector_cache.data[found[s]], 512);
+        }
+    }
+    else
+    {
+        g_sector_cache.misses++;
+        if ((g_sector_cache.misses & 255) == 0)
+        {
+            sector_cache_log_stats();
+        }
+
+        if (!read_at(startpos, m_buffer, count))
+        {
+            *success = false;
+            return true;
+        }
+
+        // Store the sectors that were not already in cache, replacing least recently used
+        for (uint32_t s = 0; s < sectors; s++)
+        {
+            int idx = found[s];
+            if (idx < 0)
+            {
+                idx = 0;
+                for (uint32_t i = 0; i < g_sector_cache.max_sectors; i++)
+                {
+                    if (!g_sector_cache.entries[i].valid)
+                    {
+                        idx = i;
+                        break;
+                    }
+                    else if (g_sector_cache.entries[i].last_used < g_sector_cache.entries[idx].last_used)
+                    {
+                        idx = i;
+                    }
+                }
+
+                g_sector_cache.entries[idx].valid = true;
+                g_sector_cache.entries[idx].sector = first + s;
+                memcpy(g_sector_cache.data[idx], m_buffer + s * 512, 512);
+            }
+            g_sector_cache.entries[idx].last_used = ++g_sector_cache.use_counter;
+        }
+    }
+
+    size_t blocks_done = 0;
+    *success = true;
+    while (blocks_done < num_blocks)
+    {
+        platform_poll();
+
+        ssize_t status = callback->read_callback(m_buffer + blocks_done * blocksize,
+                                                 blocksize, num_blocks - blocks_done);
+        if (status < 0)
+        {
+            *success = false;
+            break;
+        }
+
+        blocks_done += status;
+    }
+
+    m_position = startpos + blocksize * blocks_done;
+    return true;
+}
+
+bool IDEImageFile::read(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback)
+{
+    if (startpos > m_capacity) return false;
+
+    assert(blocksize <= m_buffer_size);
+
+    if (write_cache_overlaps(startpos, (uint64_t)blocksize * num_blocks))
+    {
+        write_cache_flush();
+    }
+
+    // Detect sequential access for read-ahead
+    if (startpos == m_readahead.next_pos)
+        m_readahead.sequential_reads++;
+    else
+        m_readahead.sequential_reads = 0;
+    m_readahead.next_pos = startpos + (uint64_t)blocksize * num_blocks;
+
+    size_t hit_blocks;
+    if (!read_from_prefetch(startpos, blocksize, num_blocks, callback, &hit_blocks))
+    {
+        return false;
+    }
+
+    startpos += (uint64_t)blocksize * hit_blocks;
+    num_blocks -= hit_blocks;
+    if (num_blocks == 0)
+    {
+        m_position = startpos;
+        return true;
+    }
+
+    bool success;
+    if (hit_blocks == 0 && read_cached(startpos, blocksize, num_blocks, callback, &success))
+    {
+        return success;
+    }
+
+    // Rest of the data is read through the ring buffer, which overwrites
+    // the prefetched data. Read-ahead continues after the end of this read.
+    m_readahead.start = m_readahead.next_pos;
+    m_readahead.bytes = 0;
+
+    sd_cb_state.callback = callback;
+    sd_cb_state.error = false;
+    sd_cb_state.buffer = m_buffer;
+    sd_cb_state.num_blocks = num_blocks;
+    sd_cb_state.blocksize = blocksize;
+    sd_cb_state.blocks_done = 0;
+    sd_cb_state.blocks_available = 0;
+    sd_cb_state.bufsize_blocks = m_buffer_size / blocksize;
+
+    if (platform_sd_core1_active() && (blocksize & 511) == 0 &&
+        can_access_raw(startpos, blocksize * num_blocks))
+    {
+        bool status = read_core1(startpos);
+        m_position = startpos + (uint64_t)blocksize * sd_cb_state.blocks_done;
+        return status;
+    }
+
+    while (sd_cb_state.blocks_done < num_blocks && !sd_cb_state.error)
+    {
+        platform_poll();
+
+        // Check if we have buffer space to read more from SD card
+        if (sd_cb_state.blocks_available < num_blocks &&
+            sd_cb_state.blocks_available < sd_cb_state.blocks_done + sd_cb_state.bufsize_blocks)
+        {
+            // Check how many contiguous blocks we have space available for.
+            // Limit by:
+            // 1. Total requested transfer size
+            // 2. Number of free slots in buffer
+            // 3. Space until wrap point of the buffer
+            size_t start_idx = sd_cb_state.blocks_available % sd_cb_state.bufsize_blocks;
+            size_t max_read = std::min({
+                num_blocks - sd_cb_state.blocks_available,
+                sd_cb_state.blocks_done + sd_cb_state.bufsize_blocks - sd_cb_state.blocks_available,
+                sd_cb_state.bufsize_blocks - start_idx
+            });
+
+            // Read from SD card and process callbacks
+            uint8_t *buf = m_buffer + blocksize * start_idx;
+            uint64_t pos = startpos + (uint64_t)blocksize * sd_cb_state.blocks_available;
+            platform_set_sd_callback(&IDEImageFile::sd_read_callback, buf);
+            bool status = read_at(pos, buf, blocksize * max_read);
+            platform_set_sd_callback(nullptr, nullptr);
+
+            // Check status of SD card read
+            if (!status)
+                sd_cb_state.error = true;
+            else
+                sd_cb_state.blocks_available += max_read;
+        }
+
+        // Provide callbacks until all blocks have been processed,
+        // even if SD card read is done.
+        if (sd_cb_state.blocks_done < sd_cb_state.blocks_available)
+        {
+            sd_read_callback(0);
+        }
+    }
+
+    m_position = startpos + (uint64_t)blocksize * sd_cb_state.blocks_available;
+    return !sd_cb_state.error;
+}
+
+void IDEImageFile::sd_read_callback(uint32_t bytes_complete)
+{
+    // Update number of blocks available by the latest callback status.
+    // sd_cb_state.blocks_available will be updated when SD card read() returns.
+    size_t blocks_available = sd_cb_state.blocks_available + bytes_complete / sd_cb_state.blocksize;
+
+    // Check how many contiguous blocks are available to process.
+    size_t start_idx = sd_cb_state.blocks_done % sd_cb_state.bufsize_blocks;
+    size_t max_write = std::min({
+        blocks_available - sd_cb_state.blocks_done,
+        sd_cb_state.bufsize_blocks - start_idx
+    });
+
+    if (max_write > 0)
+    {
+        uint8_t *data_start = sd_cb_state.buffer + start_idx * sd_cb_state.blocksize;
+        ssize_t status = sd_cb_state.callback->read_callback(data_start, sd_cb_state.blocksize, max_write);
+        if (status < 0)
+            sd_cb_state.error = true;
+        else
+            sd_cb_state.blocks_done += status;
+    }
+}
+
+/******************************/
+/* Data transfer to SD card */
+/******************************/
+
+// Data is received from the IDE bus in chunks of IMAGE_WRITE_PIPELINE_CHUNK.
+// While one part of the ring buffer is being written to the SD card, the SD
+// driver progress callback receives the following chunks into free space.
+bool IDEImageFile::write(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback)
+{
+    if (m_read_only) return false;
+
+    // Write uses the buffer and may change prefetched data
+    readahead_reset();
+    sector_cache_invalidate(startpos, blocksize * num_blocks);
+
+    assert(blocksize <= m_buffer_size);
+
+    bool success;
+    if (write_cached(startpos, blocksize, num_blocks, callback, &success))
+    {
+        return success;
+    }
+
+    // Older cached data must reach the SD card before it is overwritten
+    if (write_cache_overlaps(startpos, (uint64_t)blocksize * num_blocks))
+    {
+        write_cache_flush();
+    }
+
+    sd_cb_state.callback = callback;
+    sd_cb_state.error = false;
+    sd_cb_state.buffer = m_buffer;
+    sd_cb_state.num_blocks = num_blocks;
+    sd_cb_state.blocksize = blocksize;
+    sd_cb_state.blocks_done = 0;
+    sd_cb_state.blocks_available = 0;
+    sd_cb_state.bufsize_blocks = m_buffer_size / blocksize;
+
+    if (platform_sd_core1_active() && (blocksize & 511) == 0 &&
+        can_access_raw(startpos, blocksize * num_blocks))
+    {
+        bool status = write_core1(startpos);
+        m_position = startpos + (uint64_t)blocksize * sd_cb_state.blocks_done;
+        return status;
+    }
+
+    while (sd_cb_state.blocks_done < num_blocks && !sd_cb_state.error)
+    {
+        platform_poll();
+
+        // Check if callback can provide more data
+        sd_write_callback(0);
+
+        // Check if there is data to be written to SD card
+        if (sd_cb_state.blocks_done < sd_cb_state.blocks_available)
+        {
+            // Check how many contiguous blocks are available to process.
+            size_t start_idx = sd_cb_state.blocks_done % sd_cb_state.bufsize_blocks;
+            size_t max_write = std::min({
+                sd_cb_state.blocks_available - sd_cb_state.blocks_done,
+                sd_cb_state.bufsize_blocks - start_idx
+            });
+
+            // Write data to SD card and process callbacks
+            uint8_t *buf = m_buffer + blocksize * start_idx;
+            uint64_t pos = startpos + (uint64_t)blocksize * sd_cb_state.blocks_done;
+            platform_set_sd_callback(&IDEImageFile::sd_write_callback, buf);
+            bool status = write_at(pos, buf, blocksize * max_write);
+            platform_set_sd_callback(nullptr, nullptr);
+
+            // Check status of SD card write
+            if (!status)
+                sd_cb_state.error = true;
+            else
+                sd_cb_state.blocks_done += max_write;
+        }
+    }
+
+    m_position = startpos + (uint64_t)blocksize * sd_cb_state.blocks_done;
+    return !sd_cb_state.error;
+}
+
+void IDEImageFile::sd_write_callback(uint32_t bytes_complete)
+{
+    // Update number of blocks done by the latest callback status.
+    // sd_cb_state.blocks_done will be updated when SD card write() returns.
+    size_t blocks_done = sd_cb_state.blocks_done + bytes_complete / sd_cb_state.blocksize;
+
+    if (sd_cb_state.blocks_available < sd_cb_state.num_blocks &&
+        sd_cb_state.blocks_available < blocks_done + sd_cb_state.bufsize_blocks)
+    {
+        // Check how many contiguous blocks we have space available for.
+        // Limit by:
+        // 1. Total requested transfer size
+        // 2. Number of free slots in buffer
+        // 3. Space until wrap point of the buffer
+        // 4. Pipeline chunk size, so that SD card write can start early
+        size_t start_idx = sd_cb_state.blocks_available % sd_cb_state.bufsize_blocks;
+        size_t max_read = std::min({
+            sd_cb_state.num_blocks - sd_cb_state.blocks_available,
+            blocks_done + sd_cb_state.bufsize_blocks - sd_cb_state.blocks_available,
+            sd_cb_state.bufsize_blocks - start_idx,
+            std::max<size_t>(1, IMAGE_WRITE_PIPELINE_CHUNK / sd_cb_state.blocksize)
+        });
+
+        if (max_read > 0)
+        {
+            // Receive data from callback
+            uint8_t *data_start = sd_cb_state.buffer + start_idx * sd_cb_state.blocksize;
+            ssize_t status = sd_cb_state.callback->write_callback(data_start, sd_cb_state.blocksize, max_read);
+            if (status < 0)
+                sd_cb_state.error = true;
+            else
+                sd_cb_state.blocks_available += status;
+        }
+    }
+}
+
+/******************************/
+/* Write-back cache           */
+/******************************/
+
+void IDEImageFile::set_write_cache_allowed(bool allowed)
+{
+    if (!allowed && g_write_cache.owner)
+    {
+        g_write_cache.owner->write_cache_flush();
+    }
+
+    g_write_cache.allowed = allowed;
+    g_write_cache.enabled = g_write_cache.enabled && allowed;
+}
+
+bool IDEImageFile::has_write_cache()
+{
+    return g_write_cache.allowed;
+}
+
+bool IDEImageFile::set_write_cache(bool enable)
+{
+    if (enable && !g_write_cache.allowed) return false;
+
+    bool status = true;
+    if (!enable)
+    {
+        status = flush();
+    }
+
+    g_write_cache.enabled = enable;
+    return status;
+}
+
+bool IDEImageFile::get_write_cache()
+{
+    return g_write_cache.enabled;
+}
+
+bool IDEImageFile::flush()
+{
+    bool status = write_cache_flush();
+
+    // Report earlier failures of background drains once
+    if (g_write_cache.write_error)
+    {
+        g_write_cache.write_error = false;
+        status = false;
+    }
+
+    // Partial sector writes may also be buffered in SdFat cache
+    if (m_file.isOpen() && !m_read_only && !m_file.sync())
+    {
+        status = false;
+    }
+
+    return status;
+}
+
+// Write all cached data to the SD card, also if it belongs to another image
+bool IDEImageFile::write_cache_flush()
+{
+    bool status = true;
+    IDEImageFile *owner = g_write_cache.owner;
+    while (owner && g_write_cache.dirty_count > 0)
+    {
+        if (!owner->write_cache_drain_run())
+        {
+            status = false;
+        }
+    }
+
+    return status;
+}
+
+void IDEImageFile::write_cache_poll()
+{
+    if (g_write_cache.owner != this || g_write_cache.dirty_count == 0 ||
+        (uint32_t)(millis() - g_write_cache.last_write) < IMAGE_WRITE_CACHE_DELAY_MS)
+    {
+        return;
+    }
+
+    // One run of consecutive sectors at a time, to keep latency low
+    // if the host sends a new command.
+    write_cache_drain_run();
+}
+
+bool IDEImageFile::write_cache_overlaps(uint64_t startpos, uint64_t count)
+{
+    if (g_write_cache.owner != this || g_write_cache.dirty_count == 0 || count == 0) return false;
+
+    uint32_t first = startpos / 512;
+    uint32_t last = (startpos + count - 1) / 512;
+    for (uint32_t i = 0; i < IMAGE_WRITE_CACHE_SECTORS; i++)
+    {
+        if (g_write_cache.entries[i].dirty &&
+            g_write_cache.entries[i].sector >= first &&
+            g_write_cache.entries[i].sector <= last)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Forget cached sectors that are entirely within the range.
+// Used when the host discards the data, so there is no need to write it.
+void IDEImageFile::write_cache_drop(uint64_t startpos, uint64_t count)
+{
+    if (g_write_cache.owner != this || g_write_cache.dirty_count == 0) return;
+
+    uint64_t first = (startpos + 511) / 512;
+    uint64_t end = (startpos + count) / 512;
+    for (uint32_t i = 0; i < IMAGE_WRITE_CACHE_SECTORS; i++)
+    {
+        if (g_write_cache.entries[i].dirty &&
+            g_write_cache.entries[i].sector >= first &&
+            g_write_cache.entries[i].sector < end)
+        {
+            g_write_cache.entries[i].dirty = false;
+            g_write_cache.dirty_count--;
+        }
+    }
+}
+
+// Write the lowest numbered dirty sector and the consecutive sectors
+// following it to the SD card. The data is gathered in m_buffer.
+bool IDEImageFile::write_cache_drain_run()
+{
+    uint32_t first = 0xFFFFFFFF;
+    for (uint32_t i = 0; i < IMAGE_WRITE_CACHE_SECTORS; i++)
+    {
+        if (g_write_cache.entries[i].dirty && g_write_cache.entries[i].sector < first)
+        {
+            first = g_write_cache.entries[i].sector;
+        }
+    }
+
+    if (first == 0xFFFFFFFF)
+    {
+        g_write_cache.dirty_count = 0;
+        return true;
+    }
+
+    readahead_reset();
+
+    uint32_t count = 0;
+    bool found = true;
+    while (found && count < m_buffer_size / 512)
+    {
+        found = false;
+        for (uint32_t i = 0; i < IMAGE_WRITE_CACHE_SECTORS; i++)
+        {
+            if (g_write_cache.entries[i].dirty && g_write_cache.entries[i].sector == first + count)
+            {
+                memcpy(m_buffer + count * 512, g_write_cache.data[i], 512);
+                g_write_cache.entries[i].dirty = false;
+                g_write_cache.dirty_count--;
+                count++;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    // On failure the data is dropped. The host was already told that the
+    // write completed, so the error is kept until the next flush() reports it.
+    if (!write_at((uint64_t)first * 512, m_buffer, count * 512))
+    {
+        logmsg("-- Write cache flush failed at sector ", first, ", ", (int)count, " sectors lost");
+        g_write_cache.write_error = true;
+        return false;
+    }
+
+    return true;
+}
+
+// Receive small writes into the write-back cache.
+// Returns false if the write must go directly to the SD card.
+bool IDEImageFile::write_cached(uint64_t startpos, size_t blocksize, size_t num_blocks,
+                                Callback *callback, bool *success)
+{
+    size_t count = blocksize * num_blocks;
+    if (!g_write_cache.enabled || !m_buffer ||
+        (blocksize & 511) != 0 || (startpos & 511) != 0 ||
+        count > IMAGE_WRITE_CACHE_MAX_WRITE || count > m_buffer_size ||
+        startpos + count > m_capacity)
+    {
+        return false;
+    }
+
+    if (g_write_cache.owner != this)
+    {
+        write_cache_flush();
+        g_write_cache.owner = this;
+    }
+
+    uint32_t first = startpos / 512;
+    uint32_t sectors = count / 512;
+    uint32_t reused = 0;
+    for (uint32_t i = 0; i < IMAGE_WRITE_CACHE_SECTORS; i++)
+    {
+        if (g_write_cache.entries[i].dirty &&
+            g_write_cache.entries[i].sector >= first &&
+            g_write_cache.entries[i].sector < first + sectors)
+        {
+            reused++;
+        }
+    }
+
+    if (IMAGE_WRITE_CACHE_SECTORS - g_write_cache.dirty_count + reused < sectors)
+    {
+        // Writing everything at once lets sequential writes reach the
+        // SD card as longer runs.
+        write_cache_flush();
+    }
+
+    size_t received = 0;
+    while (received < num_blocks)
+    {
+        platform_poll();
+
+        ssize_t status = callback->write_callback(m_buffer + received * blocksize,
+                                                  blocksize, num_blocks - received);
+        if (status < 0)
+        {
+            *success = false;
+            return true;
+        }
+
+        received += status;
+    }
+
+    for (uint32_t s = 0; s < sectors; s++)
+    {
+        uint32_t idx = IMAGE_WRITE_CACHE_SECTORS;
+        for (uint32_t i = 0; i < IMAGE_WRITE_CACHE_SECTORS; i++)
+        {
+            if (g_write_cache.entries[i].dirty && g_write_cache.entries[i].sector == first + s)
+            {
+                idx = i;
+                break;
+            }
+            else if (!g_write_cache.entries[i].dirty && idx == IMAGE_WRITE_CACHE_SECTORS)
+            {
+                idx = i;
+            }
+        }
+
+        if (!g_write_cache.entries[idx].dirty || g_write_cache.entries[idx].sector != first + s)
+        {
+            g_write_cache.entries[idx].dirty = true;
+            g_write_cache.entries[idx].sector = first + s;
+            g_write_cache.dirty_count++;
+        }
+
+        memcpy(g_write_cache.data[idx], m_buffer + s * 512, 512);
+    }
+
+    g_write_cache.last_write = millis();
+    m_position = startpos + count;
+    *success = true;
+    return true;
+}
+
+/***********************************/
+/* SD card transfers on core1      */
+/***********************************/
+
+// Queue transfer of sectors to the second core, splitting at fragment boundaries.
+// Returns number of bytes queued, which is less than count if the queue is full.
+size_t IDEImageFile::queue_raw(uint64_t pos, uint8_t *buf, size_t count, bool write)
+{
+    uint32_t sector = pos / 512;
+    uint32_t sectors_left = count / 512;
+    size_t queued = 0;
+
+    while (sectors_left > 0)
+    {
+        uint32_t idx = find_extent(sector);
+        uint32_t offset = sector - m_extents[idx].file_sector;
+        uint32_t len = std::min(sectors_left, m_extents[idx + 1].file_sector - sector);
+        uint32_t sd_sector = m_extents[idx].sd_sector + offset;
+
+        if (!platform_sd_core1_submit(write, sd_sector, buf, len))
+        {
+            break;
+        }
+
+        sector += len;
+        sectors_left -= len;
+        buf += len * 512;
+        queued += len * 512;
+    }
+
+    return queued;
+}
+
+// Queue SD card reads to the ring buffer for the second core to execute.
+// Reads are queued as soon as there is free space in the buffer, and the
+// blocks are passed to the callback on this core as each one completes.
+bool IDEImageFile::read_core1(uint64_t startpos)
+{
+    size_t blocksize = sd_cb_state.blocksize;
+    size_t ring_bytes = sd_cb_state.bufsize_blocks * blocksize;
+    size_t total = blocksize * sd_cb_state.num_blocks;
+    size_t queued = 0;
+
+    if (!platform_sd_core1_reset())
+    {
+        return false;
+    }
+
+    while (sd_cb_state.blocks_done < sd_cb_state.num_blocks && !sd_cb_state.error)
+    {
+        platform_poll();
+
+        // Queue reads to free buffer space, splitting at the wrap point
+        size_t limit = std::min(total, sd_cb_state.blocks_done * blocksize + ring_bytes);
+        while (queued < limit)
+        {
+            size_t offset = queued % ring_bytes;
+            size_t count = std::min(limit - queued, ring_bytes - offset);
+            size_t done = queue_raw(startpos + queued, m_buffer + offset, count, false);
+            queued += done;
+            if (done < count) break;
+        }
+
+        // Pass completed blocks to the callback
+        bool error;
+        uint32_t bytes_done = platform_sd_core1_bytes_done(&error);
+        if (error)
+        {
+            sd_cb_state.error = true;
+        }
+        else
+        {
+            sd_read_callback(bytes_done);
+        }
+    }
+
+    // Wait for queued reads before the buffer is reused
+    if (!platform_sd_core1_reset())
+    {
+        sd_cb_state.error = true;
+    }
+
+    sd_cb_state.blocks_available = sd_cb_state.blocks_done;
+    return !sd_cb_state.error;
+}
+
+// Receive data from the callback to the ring buffer and queue SD card writes
+// for the second core to execute. Reception of following blocks continues
+// while the previous ones are being written.
+bool IDEImageFile::write_core1(uint64_t startpos)
+{
+    size_t blocksize = sd_cb_state.blocksize;
+    size_t ring_bytes = sd_cb_state.bufsize_blocks * blocksize;
+    size_t queued = 0;
+
+    if (!platform_sd_core1_reset())
+    {
+        return false;
+    }
+
+    while (sd_cb_state.blocks_done < sd_cb_state.num_blocks && !sd_cb_state.error)
+    {
+        platform_poll();
+
+        bool error;
+        uint32_t bytes_done = platform_sd_core1_bytes_done(&error);
+        if (error)
+        {
+            sd_cb_state.error = true;
+            break;
+        }
+
+        // Receive data to space freed by completed writes.
+        // sd_cb_state.blocks_done stays at 0 until the end, so the written
+        // byte count gives the buffer position like in SD driver callbacks.
+        sd_write_callback(bytes_done);
+
+        // Queue writes for received data, splitting at the wrap point
+        size_t received = sd_cb_state.blocks_available * blocksize;
+        while (queued < received)
+        {
+            size_t offset = queued % ring_bytes;
+            size_t count = std::min(received - queued, ring_bytes - offset);
+            size_t done = queue_raw(startpos + queued, m_buffer + offset, count, true);
+            queued += done;
+            if (done < count) break;
+        }
+
+        if (bytes_done == blocksize * sd_cb_state.num_blocks)
+        {
+            sd_cb_state.blocks_done = sd_cb_state.num_blocks;
+        }
+    }
+
+    // Wait for queued writes before the buffer is reused
+    if (!platform_sd_core1_reset())
+    {
+        sd_cb_state.error = true;
+    }
+
+    raw_write_done();
+    return !sd_cb_state.error;
+}
+
+/******************************/
+/* Verifying data             */
+/******************************/
+
+// Image read callback for verify(), data is not used.
+class IDEImageVerifyCallback: public IDEImage::Callback
+{
+public:
+    virtual ssize_t read_callback(const uint8_t *data, size_t blocksize, size_t num_blocks)
+    {
+        return num_blocks;
+    }
+
+    virtual ssize_t write_callback(uint8_t *data, size_t blocksize, size_t num_blocks)
+    {
+        return -1;
+    }
+};
+
+// Generic implementation reads the range through read() in chunks, so that
+// the failure position is known to chunk accuracy.
+bool IDEImage::verify(uint64_t startpos, uint64_t length, uint64_t *failed_pos)
+{
+    IDEImageVerifyCallback callback;
+    while (length > 0)
+    {
+        size_t blocks = std::min<uint64_t>(length / 512, IMAGE_VERIFY_CHUNK / 512);
+        if (blocks == 0 || !read(startpos, 512, blocks, &callback))
+        {
+            *failed_pos = startpos;
+            return false;
+        }
+
+        startpos += blocks * 512;
+        length -= blocks * 512;
+    }
+
+    return true;
+}
+
+// SD card driver checks the CRC of each block, so a successful read means
+// the data can be read. The read-ahead buffer and sector cache are bypassed,
+// otherwise only RAM would be verified.
+bool IDEImageFile::verify(uint64_t startpos, uint64_t length, uint64_t *failed_pos)
+{
+    *failed_pos = startpos;
+    if (!m_buffer || startpos + length > m_capacity) return false;
+
+    // Cached writes must reach the SD card before they can be verified
+    if (write_cache_overlaps(startpos, length) && !write_cache_flush())
+    {
+        return false;
+    }
+
+    // Data is read to m_buffer, which also holds the read-ahead data
+    readahead_reset();
+
+    while (length > 0)
+    {
+        platform_poll();
+
+        size_t len = std::min<uint64_t>(length, std::min<size_t>(m_buffer_size, IMAGE_VERIFY_CHUNK));
+        if (!read_at(startpos, m_buffer, len))
+        {
+            *failed_pos = startpos;
+            return false;
+        }
+
+        startpos += len;
+        length -= len;
+    }
+
+    m_position = startpos;
+    return true;
+}
+
+/******************************/
+/* Discarding unused data     */
+/******************************/
+
+// Erase SD card blocks that are entirely within the discarded range.
+// This lets the card controller know that the data is no longer needed,
+// so that it doesn't have to copy it around in later writes.
+// Partial erase blocks at the range ends and areas not covered by the
+// extent map keep their data.
+bool IDEImageFile::discard(uint64_t startpos, uint64_t length)
+{
+    if (m_read_only) return false;
+    if (m_blockdev == nullptr) return true;
+
+    csd_t csd;
+    if (!m_blockdev->readCSD(&csd)) return true;
+    uint32_t erase_size = csd.eraseSingleBlock() ? 1 : csd.eraseSize();
+
+    uint64_t end = std::min(startpos + length, m_capacity);
+    uint32_t sector = (startpos + 511) / 512;
+    uint32_t end_sector = std::min<uint64_t>(end / 512, m_extents[m_extent_count].file_sector);
+    bool status = true;
+
+    // Cached data could otherwise be written over the erased area later
+    write_cache_drop(startpos, length);
+
+    readahead_reset();
+
+    while (sector < end_sector)
+    {
+        uint32_t idx = find_extent(sector);
+        uint32_t len = std::min(end_sector, m_extents[idx + 1].file_sector) - sector;
+        uint32_t sd_start = m_extents[idx].sd_sector + (sector - m_extents[idx].file_sector);
+        uint32_t sd_end = sd_start + len;
+
+        uint32_t erase_start = (sd_start + erase_size - 1) / erase_size * erase_size;
+        uint32_t erase_end = sd_end / erase_size * erase_size;
+        if (erase_start < erase_end)
+        {
+            uint64_t file_pos = (uint64_t)(sector + (erase_start - sd_start)) * 512;
+            sector_cache_invalidate(file_pos, (erase_end - erase_start) * 512);
+
+            if (!m_blockdev->erase(erase_start, erase_end - 1))
+            {
+                status = false;
+            }
+        }
+
+        sector += len;
+    }
+
+    raw_write_done();
+    return status;
 }
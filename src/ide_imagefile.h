@@ -24,6 +24,64 @@
 #include <SdFat.h>
 #include <zuluide/ide_drive_type.h>
 
+// Maximum number of fragments in image file for direct SD card access.
+// Files with more fragments are accessed through SdFat.
+#ifndef IMAGE_MAX_EXTENTS
+#define IMAGE_MAX_EXTENTS 128
+#endif
+
+// Read-ahead starts after this many consecutive sequential reads
+#ifndef IMAGE_READAHEAD_MIN_SEQUENTIAL
+#define IMAGE_READAHEAD_MIN_SEQUENTIAL 2
+#endif
+
+// Amount of data to read ahead per prefetch_poll() call.
+// Host commands wait until the SD card read has completed.
+#ifndef IMAGE_READAHEAD_CHUNK
+#define IMAGE_READAHEAD_CHUNK 4096
+#endif
+
+// Maximum amount of data to receive from IDE bus per write callback.
+// SD card write starts once the first chunk has been received, and the
+// following chunks are received while previous data is being written.
+#ifndef IMAGE_WRITE_PIPELINE_CHUNK
+#define IMAGE_WRITE_PIPELINE_CHUNK 4096
+#endif
+
+// Maximum number of 512 byte sectors in RAM cache for frequently read sectors.
+// The number actually used is set with sector_cache in zuluide.ini.
+#ifndef IMAGE_SECTOR_CACHE_MAX
+#define IMAGE_SECTOR_CACHE_MAX 16
+#endif
+
+// Only reads up to this size are cached
+#ifndef IMAGE_SECTOR_CACHE_MAX_READ
+#define IMAGE_SECTOR_CACHE_MAX_READ 4096
+#endif
+
+// Verify reads are done in chunks of this size. If a read fails,
+// the start of the chunk is reported as the failed position.
+#ifndef IMAGE_VERIFY_CHUNK
+#define IMAGE_VERIFY_CHUNK 4096
+#endif
+
+// Number of 512 byte sectors in the optional write-back cache.
+// Enabled with write_cache in zuluide.ini, host can then turn it off and
+// back on with SET FEATURES.
+#ifndef IMAGE_WRITE_CACHE_SECTORS
+#define IMAGE_WRITE_CACHE_SECTORS 16
+#endif
+
+// Only writes up to this size go through the write-back cache
+#ifndef IMAGE_WRITE_CACHE_MAX_WRITE
+#define IMAGE_WRITE_CACHE_MAX_WRITE 4096
+#endif
+
+// Cached writes are written to SD card after the host has been idle this long
+#ifndef IMAGE_WRITE_CACHE_DELAY_MS
+#define IMAGE_WRITE_CACHE_DELAY_MS 20
+#endif
+
 // Interface for emulated image files
 class IDEImage
 {
@@ -78,6 +136,29 @@ public:
     // It will return the number of blocks available at data.
     virtual bool write(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback) = 0;
 
+    // Check that the byte range can be read from storage.
+    // On failure, failed_pos is set to the start of the part that could not be read.
+    virtual bool verify(uint64_t startpos, uint64_t length, uint64_t *failed_pos);
+
+    // Tell the image that data in the given byte range is no longer needed.
+    // This is only a hint, implementations may discard all, part or none of the range.
+    // Contents of discarded areas are undefined until rewritten.
+    virtual bool discard(uint64_t startpos, uint64_t length) { return writable(); }
+
+    // Tell the image that host is likely to read from the given position next.
+    // This is only a hint, implementations can use it to start reading ahead.
+    virtual void seek_hint(uint64_t startpos) {}
+
+    // Returns true if write-back caching can be enabled by the host
+    virtual bool has_write_cache() { return false; }
+
+    // Enable or disable write-back caching. Returns false if not supported.
+    virtual bool set_write_cache(bool enable) { return !enable; }
+    virtual bool get_write_cache() { return false; }
+
+    // Write any cached data to storage
+    virtual bool flush() { return true; }
+
     // Load next image
     // returns false if it failed to load
     virtual bool load_next_image() = 0;
@@ -100,6 +181,9 @@ public:
 
     bool open_file(FsVolume *volume, const char *filename, bool read_only = false);
     bool open_file(const char* filename, bool read_only = false);
+
+    // Use a range of sectors on the SD card as the image, without a filesystem
+    bool open_raw(SdCard *card, uint32_t first_sector, uint32_t sector_count, bool read_only = false);
     void close();
 
     virtual bool get_filename(char *buf, size_t buflen);
@@ -109,8 +193,30 @@ public:
     virtual bool writable();
     virtual bool read(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback);
     virtual bool write(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback);
+    virtual bool verify(uint64_t startpos, uint64_t length, uint64_t *failed_pos);
+    virtual bool discard(uint64_t startpos, uint64_t length);
+    virtual void seek_hint(uint64_t startpos);
+    virtual bool has_write_cache();
+    virtual bool set_write_cache(bool enable);
+    virtual bool get_write_cache();
+    virtual bool flush();
     virtual bool load_next_image();
 
+    // Read ahead after sequential reads. Call from main loop when
+    // no command is being processed.
+    void prefetch_poll();
+
+    // Write cached data to SD card after host has been idle.
+    // Call from main loop when no command is being processed.
+    void write_cache_poll();
+
+    // Set number of sectors to use in the sector cache, 0 to disable.
+    static void set_sector_cache_size(uint32_t sectors);
+
+    // Allow host to enable the write-back cache. Data in the cache is lost
+    // on power off, so this is only allowed when enabled in zuluide.ini.
+    static void set_write_cache_allowed(bool allowed);
+
     // Find next image in alphabetical order. If prev_image is NULL, find the first image
     virtual bool find_next_image(const char *directory, const char *prev_image, char *result, size_t buflen);
     virtual bool find_next_prefix_image(const char *directory, const char *prev_image, char *result, size_t buflen);
@@ -126,10 +232,52 @@ public:
 
 protected:
     FsFile m_file;
+
+    // Set when image location on the SD card is known and it can be
+    // accessed directly with readSectors()/writeSectors().
     SdCard *m_blockdev;
 
     bool m_contiguous;
+    bool m_raw; // Image is a sector range opened with open_raw()
     uint32_t m_first_sector;
+    uint64_t m_position;
+
+    // Location of image file on SD card as list of contiguous extents.
+    // Contiguous images have one extent, fragmented images one per run of
+    // consecutive clusters. The entry after the last extent has file_sector
+    // set to the end of the mapped area.
+    struct extent_t {
+        uint32_t file_sector; // Offset in image file, in 512 byte sectors
+        uint32_t sd_sector;   // Corresponding sector on SD card
+    };
+    extent_t m_extents[IMAGE_MAX_EXTENTS + 1];
+    uint32_t m_extent_count;
+
+    // Read-ahead state. Prefetched data is stored at the start of m_buffer,
+    // which is otherwise unused between read() calls.
+    struct {
+        uint32_t sequential_reads; // Number of consecutive sequential read() calls
+        uint64_t next_pos;  // Image position following the latest read()
+        uint64_t start;     // Image position of data at m_buffer[0]
+        size_t bytes;       // Number of prefetched bytes in m_buffer
+    } m_readahead;
+    void readahead_reset();
+    bool read_from_prefetch(uint64_t startpos, size_t blocksize, size_t num_blocks,
+                            Callback *callback, size_t *blocks_done);
+
+    // Sector cache is shared by all instances, see ide_imagefile.cpp
+    bool read_cached(uint64_t startpos, size_t blocksize, size_t num_blocks,
+                     Callback *callback, bool *success);
+    void sector_cache_invalidate(uint64_t startpos, size_t count);
+    void sector_cache_log_stats();
+
+    // Write-back cache is shared by all instances, see ide_imagefile.cpp
+    bool write_cached(uint64_t startpos, size_t blocksize, size_t num_blocks,
+                      Callback *callback, bool *success);
+    bool write_cache_overlaps(uint64_t startpos, uint64_t count);
+    void write_cache_drop(uint64_t startpos, uint64_t count);
+    bool write_cache_flush();
+    bool write_cache_drain_run();
 
     uint64_t m_capacity;
     bool m_read_only;
@@ -150,6 +298,20 @@ protected:
         size_t blocks_available;
     };
     static sd_cb_state_t sd_cb_state;
+
+    bool build_extent_map(FsVolume *volume);
+    uint32_t find_extent(uint32_t file_sector);
+    bool can_access_raw(uint64_t pos, size_t count);
+    bool access_raw(uint64_t pos, uint8_t *buf, size_t count, bool write);
+    void raw_write_done();
+    bool read_at(uint64_t pos, uint8_t *buf, size_t count);
+    bool write_at(uint64_t pos, const uint8_t *buf, size_t count);
+
+    // Pipelined transfers when SD card access runs on the second core
+    size_t queue_raw(uint64_t pos, uint8_t *buf, size_t count, bool write);
+    bool read_core1(uint64_t startpos);
+    bool write_core1(uint64_t startpos);
+
     static void sd_read_callback(uint32_t bytes_complete);
     static void sd_write_callback(uint32_t bytes_complete);
 };
@@ -45,6 +45,16 @@ struct ide_registers_t {
     uint8_t lba_low;
     uint8_t lba_mid;
     uint8_t lba_high;
+
+    // High order bytes used by 48-bit commands. The host writes these first and
+    // reads them back by setting IDE_DEVCTRL_HOB. Zero if PHY does not support LBA48.
+    struct {
+        uint8_t feature;
+        uint8_t sector_count;
+        uint8_t lba_low;
+        uint8_t lba_mid;
+        uint8_t lba_high;
+    } hob;
 };
 
 struct ide_phy_config_t {
@@ -101,6 +111,15 @@ bool ide_phy_can_write_block();
 void ide_phy_write_block(const uint8_t *buf, uint32_t blocklen);
 bool ide_phy_is_write_finished();
 
+// Same as ide_phy_write_block(), but may return before the PHY has finished reading
+// the buffer. The buffer must not be modified until the next ide_phy_*() call.
+void ide_phy_write_block_async(const uint8_t *buf, uint32_t blocklen);
+
+// Wait until the PHY has finished reading any part of the given buffer that was
+// passed to ide_phy_write_block_async(). Used by code that writes to the buffer
+// without calling other ide_phy functions first.
+void ide_phy_wait_buffer(const uint8_t *buf, uint32_t len);
+
 void ide_phy_start_read(uint32_t blocklen, int udma_mode = -1);
 bool ide_phy_can_read_block();
 void ide_phy_read_block(uint8_t *buf, uint32_t blocklen, bool continue_transfer = false);
@@ -128,6 +147,17 @@ struct ide_phy_capabilities_t
     int min_pio_cycletime_no_iordy;
     int min_pio_cycletime_with_iordy;
     int max_udma_mode; // -1 if UDMA not supported
+    bool supports_lba48; // PHY stores high order register bytes for 48-bit commands
 };
 
 const ide_phy_capabilities_t *ide_phy_get_capabilities();
+
+// Statistics of FPGA status polling, for benchmarking.
+// Status reads made shortly after a previous read reuse its result.
+struct ide_phy_status_stats_t
+{
+    uint32_t reads; // QSPI status read transactions
+    uint32_t saved; // Status queries answered from snapshot
+};
+
+void ide_phy_get_status_stats(ide_phy_status_stats_t *stats);
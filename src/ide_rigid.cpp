@@ -25,17 +25,7 @@
 #include "ZuluIDE.h"
 #include "ZuluIDE_config.h"
 #include <minIni.h>
-// Map from command index for command name for logging
-static const char *get_atapi_command_name(uint8_t cmd)
-{
-    switch (cmd)
-    {
-#define CMD_NAME_TO_STR(name, code) case code: return #name;
-    ATAPI_COMMAND_LIST(CMD_NAME_TO_STR)
-#undef CMD_NAME_TO_STR
-        default: return "UNKNOWN_CMD";
-    }
-}
+#include <algorithm>
 
 void IDERigidDevice::initialize(int devidx)
 {
@@ -80,8 +70,23 @@ bool IDERigidDevice::handle_command(ide_registers_t *regs)
         case IDE_CMD_WRITE_DMA: return cmd_write(regs, true);
         case IDE_CMD_READ_SECTORS: return cmd_read(regs, false);
         case IDE_CMD_WRITE_SECTORS: return cmd_write(regs, false);
+        case IDE_CMD_READ_DMA_EXT: return cmd_read(regs, true, true);
+        case IDE_CMD_WRITE_DMA_EXT: return cmd_write(regs, true, true);
+        case IDE_CMD_READ_SECTORS_EXT: return cmd_read(regs, false, true);
+        case IDE_CMD_WRITE_SECTORS_EXT: return cmd_write(regs, false, true);
+        case IDE_CMD_READ_MULTIPLE: return cmd_read(regs, false, false, true);
+        case IDE_CMD_WRITE_MULTIPLE: return cmd_write(regs, false, false, true);
+        case IDE_CMD_READ_MULTIPLE_EXT: return cmd_read(regs, false, true, true);
+        case IDE_CMD_WRITE_MULTIPLE_EXT: return cmd_write(regs, false, true, true);
+        case IDE_CMD_SET_MULTIPLE_MODE: return cmd_set_multiple_mode(regs);
         case IDE_CMD_INIT_DEV_PARAMS: return cmd_init_dev_params(regs);
         case IDE_CMD_IDENTIFY_DEVICE: return cmd_identify_device(regs);
+        case IDE_CMD_DATA_SET_MANAGEMENT: return cmd_data_set_management(regs);
+        case IDE_CMD_FLUSH_CACHE: return cmd_flush_cache(regs);
+        case IDE_CMD_FLUSH_CACHE_EXT: return cmd_flush_cache(regs);
+        case IDE_CMD_READ_VERIFY_SECTORS: return cmd_read_verify(regs, false);
+        case IDE_CMD_READ_VERIFY_SECTORS_EXT: return cmd_read_verify(regs, true);
+        case IDE_CMD_SEEK: return cmd_seek(regs);
 
         default: return false;
     }
@@ -137,6 +142,20 @@ bool IDERigidDevice::cmd_set_features(ide_registers_t *regs)
     {
         dbgmsg("-- Enable revert to power-on defaults");
     }
+    else if (feature == IDE_SET_FEATURE_ENABLE_WRITE_CACHE ||
+             feature == IDE_SET_FEATURE_DISABLE_WRITE_CACHE)
+    {
+        bool enable = (feature == IDE_SET_FEATURE_ENABLE_WRITE_CACHE);
+        if (m_image && m_image->set_write_cache(enable))
+        {
+            dbgmsg("-- Write cache ", enable ? "enabled" : "disabled");
+        }
+        else
+        {
+            dbgmsg("-- Failed to ", enable ? "enable" : "disable", " write cache");
+            regs->error = IDE_ERROR_ABORT;
+        }
+    }
     else
     {
         dbgmsg("-- Unknown SET_FEATURE: ", feature);
@@ -168,63 +187,159 @@ static void copy_id_string(uint16_t *dst, size_t maxwords, const char *src)
     }
 }
 
-bool IDERigidDevice::cmd_read(ide_registers_t *regs, bool dma_transfer)
+// Get starting address and sector count of a read or write command.
+// 28-bit commands use either LBA or CHS addressing, 48-bit commands always use LBA.
+void IDERigidDevice::ata_get_lba(const ide_registers_t *regs, bool lba48, uint64_t *lba, uint32_t *sector_count)
+{
+    if (lba48)
+    {
+        *sector_count = ((uint32_t)regs->hob.sector_count << 8) | regs->sector_count;
+        if (*sector_count == 0) *sector_count = 65536;
+
+        *lba = ((uint64_t)regs->hob.lba_high << 40) |
+               ((uint64_t)regs->hob.lba_mid << 32) |
+               ((uint64_t)regs->hob.lba_low << 24) |
+               ((uint32_t)regs->lba_high << 16) |
+               ((uint32_t)regs->lba_mid << 8) |
+               regs->lba_low;
+        return;
+    }
+
+    *sector_count = (regs->sector_count == 0) ? 256 : regs->sector_count;
+    if (regs->device & 0x40)
+    {
+        *lba = ((uint32_t)(regs->device & 0x0F) << 24) |
+               ((uint32_t)regs->lba_high << 16) |
+               ((uint32_t)regs->lba_mid << 8) |
+               regs->lba_low;
+    }
+    else
+    {
+        uint8_t head = 0xF & (regs->device);
+        uint16_t cylinder = ((uint16_t)regs->lba_high << 8) | regs->lba_mid;
+        uint8_t sector = regs->lba_low;
+        *lba = (cylinder * m_devinfo.heads + head) * m_devinfo.sectors_per_track + (sector - 1);
+    }
+}
+
+// Report address of the last sector that was transferred
+void IDERigidDevice::ata_set_lba(ide_registers_t *regs, bool lba48, uint64_t lba)
+{
+    if (lba48)
+    {
+        regs->lba_low = lba;
+        regs->lba_mid = lba >> 8;
+        regs->lba_high = lba >> 16;
+        regs->hob.lba_low = lba >> 24;
+        regs->hob.lba_mid = lba >> 32;
+        regs->hob.lba_high = lba >> 40;
+    }
+    else if (regs->device & 0x40)
+    {
+        regs->device &= 0xF0;
+        regs->device |= (0x0F) & (lba >> 24);
+        regs->lba_high = lba >> 16;
+        regs->lba_mid = lba >> 8;
+        regs->lba_low = lba;
+    }
+    else
+    {
+        uint16_t cylinder;
+        uint8_t head, sector;
+        lba2chs(lba, cylinder, head, sector);
+        regs->device &= 0xF0;
+        regs->device |= (0x0F) & head;
+        regs->lba_high = cylinder >> 8;
+        regs->lba_mid = cylinder;
+        regs->lba_low = sector;
+    }
+}
+
+// Maximum number of sectors per DRQ block for READ/WRITE MULTIPLE
+uint32_t IDERigidDevice::ata_max_multiple_sectors()
+{
+    return std::min<uint32_t>(ATA_MAX_MULTIPLE_SECTORS, m_phy_caps.max_blocksize / m_devinfo.bytes_per_sector);
+}
+
+// SET MULTIPLE MODE: sector count register gives the number of sectors per DRQ block
+// for READ/WRITE MULTIPLE commands, zero disables multiple mode.
+bool IDERigidDevice::cmd_set_multiple_mode(ide_registers_t *regs)
+{
+    uint32_t count = regs->sector_count;
+    if (count > ata_max_multiple_sectors() || (count & (count - 1)) != 0)
+    {
+        dbgmsg("-- Unsupported multiple mode sector count ", (int)count);
+        regs->error = IDE_ERROR_ABORT;
+        ide_phy_set_regs(regs);
+        ide_phy_assert_irq(IDE_STATUS_DEVRDY | IDE_STATUS_ERR);
+        return true;
+    }
+
+    dbgmsg("-- Set multiple mode to ", (int)count, " sectors per block");
+    m_ata_state.multiple_sectors = count;
+    regs->error = 0;
+    ide_phy_set_regs(regs);
+    ide_phy_assert_irq(IDE_STATUS_DEVRDY);
+    return true;
+}
+
+// Get DRQ block size in sectors for the command.
+// Returns false if READ/WRITE MULTIPLE is used without enabling multiple mode first.
+bool IDERigidDevice::ata_get_sectors_per_block(ide_registers_t *regs, bool multiple, uint32_t *sectors_per_block)
+{
+    *sectors_per_block = 1;
+    if (multiple)
+    {
+        if (m_ata_state.multiple_sectors == 0)
+        {
+            dbgmsg("-- READ/WRITE MULTIPLE without SET MULTIPLE MODE");
+            regs->error = IDE_ERROR_ABORT;
+            ide_phy_set_regs(regs);
+            ide_phy_assert_irq(IDE_STATUS_DEVRDY | IDE_STATUS_ERR);
+            return false;
+        }
+
+        *sectors_per_block = m_ata_state.multiple_sectors;
+    }
+    return true;
+}
+
+bool IDERigidDevice::cmd_read(ide_registers_t *regs, bool dma_transfer, bool lba48, bool multiple)
 {
     if (dma_transfer && m_phy_caps.max_udma_mode < 0)
         return false;
+    if (lba48 && !m_phy_caps.supports_lba48)
+        return false;
 
-    bool lba_mode = false;
-    uint32_t lba = 0;
-    uint16_t sector_count = regs->sector_count == 0 ? 256 : regs->sector_count;
-    uint8_t head = 0;
-    uint16_t cylinder = 0;
-    uint8_t sector = 0;
+    uint32_t sectors_per_block;
+    if (!ata_get_sectors_per_block(regs, multiple, &sectors_per_block))
+        return true;
+
+    uint64_t lba = 0;
+    uint32_t sector_count = 0;
+    ata_get_lba(regs, lba48, &lba, &sector_count);
     m_ata_state.data_state = ATA_DATA_IDLE;
     m_ata_state.dma_requested = dma_transfer;
     m_ata_state.crc_errors = 0;
 
-
-    lba_mode = !!(regs->device & 0x40);
-    if (lba_mode)
+    // Full DRQ blocks first, then the remaining sectors as one shorter block
+    uint32_t full_blocks = sector_count / sectors_per_block;
+    uint32_t last_sectors = sector_count % sectors_per_block;
+    uint32_t bytes_per_sector = m_devinfo.bytes_per_sector;
+    bool status = true;
+    if (full_blocks > 0)
     {
-        lba |= 0xF & (regs->device << 24);
-        lba |= regs->lba_high << 16;
-        lba |= regs->lba_mid << 8;
-        lba |= regs->lba_low;
+        status = m_image->read(lba * bytes_per_sector, bytes_per_sector * sectors_per_block, full_blocks, this);
     }
-    else
+    if (status && last_sectors > 0)
     {
-        head = 0xF & (regs->device);
-        cylinder = regs->lba_high << 8;
-        cylinder |= regs->lba_mid;
-        sector = regs->lba_low;
-        lba = (cylinder * m_devinfo.heads + head) * m_devinfo.sectors_per_track + (sector - 1);
+        status = m_image->read((lba + sector_count - last_sectors) * bytes_per_sector, bytes_per_sector * last_sectors, 1, this);
     }
-    bool status = m_image->read((uint64_t)lba * m_devinfo.bytes_per_sector, m_devinfo.bytes_per_sector, sector_count, this);
     status = status && ata_send_wait_finish();
     if (status)
     {
-        uint32_t new_lba = lba + sector_count - 1;
         ide_phy_get_regs(regs);
-        if (lba_mode)
-        {
-            regs->device &= 0xF0;
-            regs->device |= (0x0F) & (new_lba >> 24);
-            regs->lba_high = new_lba >> 16;
-            regs->lba_mid = new_lba >> 8;
-            regs->lba_low = new_lba;
-        }
-        else
-        {
-            sector = (new_lba % m_devinfo.sectors_per_track) + 1;
-            cylinder = (new_lba / m_devinfo.sectors_per_track) / m_devinfo.heads;
-            head = (new_lba / m_devinfo.sectors_per_track) % m_devinfo.heads;
-            regs->device &= 0xF0; 
-            regs->device |= (0x0F) & head;
-            regs->lba_high = cylinder >> 8;
-            regs->lba_mid = cylinder;
-            regs->lba_low = sector;
-        }
+        ata_set_lba(regs, lba48, lba + sector_count - 1);
         m_ata_state.data_state = ATA_DATA_IDLE;
         regs->status = IDE_STATUS_DEVRDY;
         ide_phy_set_regs(regs);
@@ -233,76 +348,125 @@ bool IDERigidDevice::cmd_read(ide_registers_t *regs, bool dma_transfer)
     return status;
 }
 
-bool IDERigidDevice::cmd_write(ide_registers_t *regs, bool dma_transfer)
+bool IDERigidDevice::cmd_write(ide_registers_t *regs, bool dma_transfer, bool lba48, bool multiple)
 {
     if (dma_transfer && m_phy_caps.max_udma_mode < 0)
         return false;
-    bool lba_mode = false;
-    uint32_t lba = 0;
-    uint16_t sector_count = regs->sector_count == 0 ? 256 : regs->sector_count;
-    uint8_t head = 0;
-    uint16_t cylinder = 0;
-    uint8_t sector = 0;
+    if (lba48 && !m_phy_caps.supports_lba48)
+        return false;
+
+    uint32_t sectors_per_block;
+    if (!ata_get_sectors_per_block(regs, multiple, &sectors_per_block))
+        return true;
+
+    uint64_t lba = 0;
+    uint32_t sector_count = 0;
     bool status = false;
+    ata_get_lba(regs, lba48, &lba, &sector_count);
     m_ata_state.data_state = ATA_DATA_IDLE;
     m_ata_state.dma_requested = dma_transfer;
     m_ata_state.crc_errors = 0;
 
-    lba_mode = !!(regs->device & 0x40);
-    if (lba_mode)
+    if (m_image && m_image->writable())
+    {
+        // Full DRQ blocks first, then the remaining sectors as one shorter block
+        uint32_t full_blocks = sector_count / sectors_per_block;
+        uint32_t last_sectors = sector_count % sectors_per_block;
+        uint32_t bytes_per_sector = m_devinfo.bytes_per_sector;
+        status = true;
+        if (full_blocks > 0)
+        {
+            status = m_image->write(lba * bytes_per_sector, bytes_per_sector * sectors_per_block, full_blocks, this);
+        }
+        if (status && last_sectors > 0)
+        {
+            status = m_image->write((lba + sector_count - last_sectors) * bytes_per_sector, bytes_per_sector * last_sectors, 1, this);
+        }
+    }
+
+    if (status)
     {
-        lba |= 0xF & (regs->device) << 24;
-        lba |= regs->lba_high << 16;
-        lba |= regs->lba_mid << 8;
-        lba |= regs->lba_low;
+        ide_phy_get_regs(regs);
+        ata_set_lba(regs, lba48, lba + sector_count - 1);
+        regs->status = IDE_STATUS_DEVRDY;
+        ide_phy_set_regs(regs);
+        ide_phy_assert_irq(IDE_STATUS_DEVRDY);
     }
     else
     {
-        head = 0xF & (regs->device);
-        cylinder = regs->lba_high << 8;
-        cylinder |= regs->lba_mid;
-        sector = regs->lba_low;
-        lba = (cylinder * m_devinfo.heads + head) * m_devinfo.sectors_per_track + (sector - 1);
+        // \todo do something if the read fails
     }
+    return status;
+}
 
-    if (m_image && m_image->writable())
+bool IDERigidDevice::cmd_read_verify(ide_registers_t *regs, bool lba48)
+{
+    if (lba48 && !m_phy_caps.supports_lba48)
+        return false;
+
+    uint64_t lba = 0;
+    uint32_t sector_count = 0;
+    ata_get_lba(regs, lba48, &lba, &sector_count);
+
+    if (!m_image || lba + sector_count > capacity_lba())
     {
-    status = m_image->write((uint64_t)lba * m_devinfo.bytes_per_sector,
-                            m_devinfo.bytes_per_sector, sector_count,
-                            this);
+        dbgmsg("-- READ VERIFY beyond capacity, LBA ", (uint32_t)lba, " + ", (int)sector_count);
+        regs->error = m_image ? IDE_ERROR_IDNF : IDE_ERROR_ABORT;
+        ide_phy_set_regs(regs);
+        ide_phy_assert_irq(IDE_STATUS_DEVRDY | IDE_STATUS_ERR);
+        return true;
     }
 
+    uint32_t bytes_per_sector = m_devinfo.bytes_per_sector;
+    uint64_t failed_pos;
+    bool status = m_image->verify(lba * bytes_per_sector, (uint64_t)sector_count * bytes_per_sector, &failed_pos);
+
+    ide_phy_get_regs(regs);
     if (status)
     {
-        ide_phy_get_regs(regs);
-        uint32_t new_lba = lba + sector_count - 1;
-        if (lba_mode)
-        {
-            regs->device |= (0x0F) & (new_lba >> 24);
-            regs->lba_high = new_lba >> 16;
-            regs->lba_mid = new_lba >> 8;
-            regs->lba_low = new_lba;
-        }
-        else
-        {
-            sector = (new_lba % m_devinfo.sectors_per_track) + 1;
-            cylinder = (new_lba / m_devinfo.sectors_per_track) / m_devinfo.heads;
-            head = (new_lba / m_devinfo.sectors_per_track) % m_devinfo.heads;
-            regs->device |= (0x0F) & head;
-            regs->lba_high = cylinder >> 8;
-            regs->lba_mid = cylinder;
-            regs->lba_low = sector;
-
-        }
+        ata_set_lba(regs, lba48, lba + sector_count - 1);
+        regs->error = 0;
         regs->status = IDE_STATUS_DEVRDY;
         ide_phy_set_regs(regs);
         ide_phy_assert_irq(IDE_STATUS_DEVRDY);
     }
     else
     {
-        // \todo do something if the read fails
+        // Report the first sector that could not be verified
+        uint64_t failed_lba = failed_pos / bytes_per_sector;
+        logmsg("-- READ VERIFY failed at LBA ", (uint32_t)failed_lba);
+        ata_set_lba(regs, lba48, failed_lba);
+        regs->error = IDE_ERROR_UNCORRECTABLE;
+        regs->status = IDE_STATUS_DEVRDY | IDE_STATUS_ERR;
+        ide_phy_set_regs(regs);
+        ide_phy_assert_irq(IDE_STATUS_DEVRDY | IDE_STATUS_ERR);
     }
-    return status;
+    return true;
+}
+
+// There is no head to move, but the image can start reading ahead
+// from the requested position while the host is idle.
+bool IDERigidDevice::cmd_seek(ide_registers_t *regs)
+{
+    uint64_t lba = 0;
+    uint32_t sector_count = 0;
+    ata_get_lba(regs, false, &lba, &sector_count);
+
+    if (!m_image || lba >= capacity_lba())
+    {
+        dbgmsg("-- SEEK beyond capacity, LBA ", (uint32_t)lba);
+        regs->error = m_image ? IDE_ERROR_IDNF : IDE_ERROR_ABORT;
+        ide_phy_set_regs(regs);
+        ide_phy_assert_irq(IDE_STATUS_DEVRDY | IDE_STATUS_ERR);
+        return true;
+    }
+
+    m_image->seek_hint(lba * m_devinfo.bytes_per_sector);
+
+    regs->error = 0;
+    ide_phy_set_regs(regs);
+    ide_phy_assert_irq(IDE_STATUS_DEVRDY);
+    return true;
 }
 
 bool IDERigidDevice::cmd_init_dev_params(ide_registers_t *regs)
@@ -378,7 +542,11 @@ bool IDERigidDevice::cmd_identify_device(ide_registers_t *regs)
     // idf[IDE_IDENTIFY_OFFSET_BUFFER_SIZE_512] = 0x00C0;
     // idf[IDE_IDENTIFY_OFFSET_ECC_LONG_CMDS] = 0x0010;
 
-    idf[IDE_IDENTIFY_OFFSET_MAX_SECTORS] = 0x8020;
+    idf[IDE_IDENTIFY_OFFSET_MAX_SECTORS] = 0x8000 | ata_max_multiple_sectors();
+    if (m_ata_state.multiple_sectors > 0)
+    {
+        idf[IDE_IDENTIFY_OFFSET_MULTI_SECTOR_VALID] = 0x0100 | m_ata_state.multiple_sectors;
+    }
     
     idf[IDE_IDENTIFY_OFFSET_CAPABILITIES_1] = (m_phy_caps.supports_iordy ? 1 << 11 : 0) | 
                                             // 1 << 10 | 
@@ -396,8 +564,9 @@ bool IDERigidDevice::cmd_identify_device(ide_registers_t *regs)
     uint64_t sectors = capacity_lba();
     // idf[IDE_IDENTIFY_OFFSET_CURRENT_CAPACITY_IN_SECTORS_LOW] = sectors & 0xFFFF;;
     // idf[IDE_IDENTIFY_OFFSET_CURRENT_CAPACITY_IN_SECTORS_HI] = (sectors >> 16) & 0xFFFF;
-    idf[IDE_IDENTIFY_OFFSET_TOTAL_SECTORS]     = sectors & 0xFFFF;
-    idf[IDE_IDENTIFY_OFFSET_TOTAL_SECTORS + 1] = (sectors >> 16) & 0xFFFF;
+    uint32_t sectors28 = (sectors > 0x0FFFFFFF) ? 0x0FFFFFFF : sectors;
+    idf[IDE_IDENTIFY_OFFSET_TOTAL_SECTORS]     = sectors28 & 0xFFFF;
+    idf[IDE_IDENTIFY_OFFSET_TOTAL_SECTORS + 1] = (sectors28 >> 16) & 0xFFFF;
     idf[IDE_IDENTIFY_OFFSET_MODEINFO_SINGLEWORD] = 0;// 0x0007; // disabling single word dma
     idf[IDE_IDENTIFY_OFFSET_MODEINFO_MULTIWORD] = 0; // 0x0103; // disabling multi-word dma
     
@@ -412,6 +581,35 @@ bool IDERigidDevice::cmd_identify_device(ide_registers_t *regs)
     idf[IDE_IDENTIFY_OFFSET_COMMAND_SET_SUPPORT_3] = 0x4000;
     idf[IDE_IDENTIFY_OFFSET_COMMAND_SET_ENABLED_1] = 0x0004;
 
+    if (m_phy_caps.supports_lba48)
+    {
+        idf[IDE_IDENTIFY_OFFSET_COMMAND_SET_SUPPORT_2] |= (1 << 10); // 48-bit address feature set
+        idf[IDE_IDENTIFY_OFFSET_COMMAND_SET_ENABLED_2] |= (1 << 10);
+        idf[IDE_IDENTIFY_OFFSET_MAX_LBA]     = sectors & 0xFFFF;
+        idf[IDE_IDENTIFY_OFFSET_MAX_LBA + 1] = (sectors >> 16) & 0xFFFF;
+        idf[IDE_IDENTIFY_OFFSET_MAX_LBA + 2] = (sectors >> 32) & 0xFFFF;
+        idf[IDE_IDENTIFY_OFFSET_MAX_LBA + 3] = (sectors >> 48) & 0xFFFF;
+    }
+
+    if (m_image && m_image->writable())
+    {
+        if (m_image->has_write_cache())
+        {
+            idf[IDE_IDENTIFY_OFFSET_COMMAND_SET_SUPPORT_1] |= (1 << 5); // Write cache
+            idf[IDE_IDENTIFY_OFFSET_COMMAND_SET_ENABLED_1] |= m_image->get_write_cache() ? (1 << 5) : 0;
+        }
+        idf[IDE_IDENTIFY_OFFSET_COMMAND_SET_SUPPORT_2] |= (1 << 12); // FLUSH CACHE
+        idf[IDE_IDENTIFY_OFFSET_COMMAND_SET_ENABLED_2] |= (1 << 12);
+
+        // DATA SET MANAGEMENT uses DMA protocol, so it is only offered with UDMA.
+        // Reads after TRIM are not deterministic, the SD card may return either zeros or ones.
+        if (m_phy_caps.max_udma_mode >= 0)
+        {
+            idf[IDE_IDENTIFY_OFFSET_DSM_MAX_BLOCKS] = ATA_DSM_MAX_BLOCKS;
+            idf[IDE_IDENTIFY_OFFSET_DATA_SET_MANAGEMENT] = 0x0001; // TRIM supported
+        }
+    }
+
     idf[IDE_IDENTIFY_OFFSET_MODEINFO_ULTRADMA]  = (m_phy_caps.max_udma_mode >= 0) ? 0x0001 : 0;
     idf[IDE_IDENTIFY_OFFSET_MODEINFO_ULTRADMA] |= (m_ata_state.udma_mode == 0)  ? (1 << 8) : 0;
 
@@ -464,6 +662,85 @@ bool IDERigidDevice::cmd_identify_device(ide_registers_t *regs)
     return true;
 }
 
+// DATA SET MANAGEMENT with TRIM bit set: host sends a list of LBA ranges that
+// no longer contain valid data. Each 8 byte entry has 48-bit LBA in the low
+// bits and 16-bit sector count in the high bits. Entries with zero count are unused.
+bool IDERigidDevice::cmd_data_set_management(ide_registers_t *regs)
+{
+    if (m_phy_caps.max_udma_mode < 0)
+        return false;
+
+    uint16_t block_count = regs->sector_count;
+    if (!(regs->feature & IDE_DSM_FEATURE_TRIM) ||
+        block_count == 0 || block_count > ATA_DSM_MAX_BLOCKS ||
+        !m_image || !m_image->writable())
+    {
+        dbgmsg("-- Unsupported DATA SET MANAGEMENT, feature ", regs->feature, " blocks ", (int)block_count);
+        regs->error = IDE_ERROR_ABORT;
+        ide_phy_set_regs(regs);
+        ide_phy_assert_irq(IDE_STATUS_DEVRDY | IDE_STATUS_ERR);
+        return true;
+    }
+
+    m_ata_state.data_state = ATA_DATA_IDLE;
+    m_ata_state.dma_requested = true;
+    m_ata_state.crc_errors = 0;
+    if (!ata_recv_data(m_buffer.bytes, 512, block_count))
+    {
+        return false;
+    }
+
+    uint64_t capacity = capacity_lba();
+    for (size_t i = 0; i < block_count * 512u; i += 8)
+    {
+        const uint8_t *entry = &m_buffer.bytes[i];
+        uint64_t lba = 0;
+        for (int j = 5; j >= 0; j--)
+        {
+            lba = (lba << 8) | entry[j];
+        }
+        uint32_t count = entry[6] | ((uint32_t)entry[7] << 8);
+
+        if (count == 0) continue;
+
+        if (lba + count > capacity)
+        {
+            dbgmsg("-- TRIM range ", (uint32_t)lba, " + ", (int)count, " exceeds capacity ", (uint32_t)capacity);
+            count = (lba < capacity) ? (capacity - lba) : 0;
+        }
+
+        if (count > 0 && !m_image->discard(lba * m_devinfo.bytes_per_sector, (uint64_t)count * m_devinfo.bytes_per_sector))
+        {
+            // TRIM is only a hint, so a failed erase leaves the old data in place
+            dbgmsg("-- TRIM of ", (uint32_t)lba, " + ", (int)count, " failed");
+        }
+    }
+
+    ide_phy_get_regs(regs);
+    regs->error = 0;
+    regs->status = IDE_STATUS_DEVRDY;
+    ide_phy_set_regs(regs);
+    ide_phy_assert_irq(IDE_STATUS_DEVRDY);
+    return true;
+}
+
+// Write any data in the image write-back cache to the SD card
+bool IDERigidDevice::cmd_flush_cache(ide_registers_t *regs)
+{
+    if (m_image && !m_image->flush())
+    {
+        dbgmsg("-- FLUSH CACHE failed");
+        regs->error = IDE_ERROR_ABORT;
+        ide_phy_set_regs(regs);
+        ide_phy_assert_irq(IDE_STATUS_DEVRDY | IDE_STATUS_ERR);
+        return true;
+    }
+
+    regs->error = 0;
+    ide_phy_set_regs(regs);
+    ide_phy_assert_irq(IDE_STATUS_DEVRDY);
+    return true;
+}
 
 void IDERigidDevice::handle_event(ide_event_t evt)
 {
@@ -472,6 +749,7 @@ void IDERigidDevice::handle_event(ide_event_t evt)
         if (evt == IDE_EVENT_HWRST)
         {
             m_ata_state.udma_mode = -1;
+            m_ata_state.multiple_sectors = 0;
         }
 
         set_device_signature(0, true);
@@ -558,11 +836,13 @@ ssize_t IDERigidDevice::ata_send_data(const uint8_t *data, size_t blocksize, siz
 {
     if (m_ata_state.data_state == ATA_DATA_WRITE && blocksize == m_ata_state.blocksize)
     {
-        // Fast path, transfer size has already been set up
+        // Fast path, transfer size has already been set up.
+        // Data comes from image buffer that is not modified before the next PHY call,
+        // so the PHY can keep transferring it in the background.
         size_t blocks_sent = 0;
         while (blocks_sent < num_blocks && ide_phy_can_write_block())
         {
-            ide_phy_write_block(data, blocksize);
+            ide_phy_write_block_async(data, blocksize);
             data += blocksize;
             blocks_sent++;
         }
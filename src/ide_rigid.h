@@ -30,6 +30,16 @@
 // Number of simultaneous transfer requests to pass to ide_phy.
 #define ATAPI_TRANSFER_REQ_COUNT 2
 
+// Maximum number of 512 byte blocks of LBA range entries in DATA SET MANAGEMENT.
+// The entries are received to m_buffer.
+#define ATA_DSM_MAX_BLOCKS 4
+
+// Maximum number of sectors per DRQ block for READ/WRITE MULTIPLE.
+// Further limited by PHY max_blocksize.
+#ifndef ATA_MAX_MULTIPLE_SECTORS
+#define ATA_MAX_MULTIPLE_SECTORS 16
+#endif
+
 // Generic PATA rigid device implementation:)
 class IDERigidDevice: public IDEDevice, public IDEImage::Callback
 {
@@ -89,6 +99,7 @@ protected:
         int udma_mode;  // Negotiated udma mode, or negative if not enabled
         bool dma_requested; // Host requests to use DMA transfer for current command
         int crc_errors; // CRC errors in latest transfer
+        uint32_t multiple_sectors; // Sectors per DRQ block for READ/WRITE MULTIPLE, 0 if disabled
     } m_ata_state;
 
     struct
@@ -109,16 +120,27 @@ protected:
     // IDE command handlers
     virtual bool cmd_nop(ide_registers_t *regs);
     virtual bool cmd_set_features(ide_registers_t *regs);
-    virtual bool cmd_read(ide_registers_t *regs, bool dma_transfer);
-    virtual bool cmd_write(ide_registers_t *regs, bool dma_transfer);
+    virtual bool cmd_read(ide_registers_t *regs, bool dma_transfer, bool lba48 = false, bool multiple = false);
+    virtual bool cmd_write(ide_registers_t *regs, bool dma_transfer, bool lba48 = false, bool multiple = false);
+    virtual bool cmd_set_multiple_mode(ide_registers_t *regs);
     virtual bool cmd_init_dev_params(ide_registers_t *regs);
     virtual bool cmd_identify_device(ide_registers_t *regs);
+    virtual bool cmd_data_set_management(ide_registers_t *regs);
+    virtual bool cmd_flush_cache(ide_registers_t *regs);
+    virtual bool cmd_read_verify(ide_registers_t *regs, bool lba48);
+    virtual bool cmd_seek(ide_registers_t *regs);
 
 
 
     // Helper methods
     // convert lba to cylinder, head, sector values
     void lba2chs(const uint32_t lba, uint16_t &cylinder, uint8_t &head, uint8_t &sector);
+    // get start address and sector count of read/write command, set address of last sector
+    void ata_get_lba(const ide_registers_t *regs, bool lba48, uint64_t *lba, uint32_t *sector_count);
+    void ata_set_lba(ide_registers_t *regs, bool lba48, uint64_t lba);
+    // READ/WRITE MULTIPLE block size limits
+    uint32_t ata_max_multiple_sectors();
+    bool ata_get_sectors_per_block(ide_registers_t *regs, bool multiple, uint32_t *sectors_per_block);
     // Methods used by ATA command implementations
     // send data
     ssize_t ata_send_data(const uint8_t *data, size_t blocksize, size_t num_blocks);
@@ -0,0 +1,572 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Simulation model of the FPGA side of the QSPI bus.
+// Command semantics follow the description in rp2040_fpga.h.
+//
+// Data is copied with memmove() in this file so that ide_bench can count
+// the memcpy() traffic of the firmware code separately from the simulation.
+
+#include "fpga_sim.h"
+#include <rp2040_fpga.h>
+#include <ide_constants.h>
+#include <ZuluIDE_log.h>
+#include <Arduino.h>
+#include <string.h>
+#include <algorithm>
+
+// ICE5LP1K has 8 kB of RAM, used as 2x 4096 byte buffers
+#define FPGA_SIM_BUFSIZE 4096
+#define FPGA_SIM_CRC_FIFO 4
+
+static struct {
+    bool initialized;
+    ide_registers_t regs;
+    uint8_t phy_cfg;
+    uint8_t flags;          // FPGA_STATUS_IDE_RST .. FPGA_STATUS_IDE_WR
+    uint8_t signals;
+    bool irq;
+
+    // Data buffer state
+    bool dir_write;         // FPGA_STATUS_DATA_DIR
+    bool udma;
+    uint32_t blocklen;
+    uint8_t buf[2][FPGA_SIM_BUFSIZE];
+    int tx_first;           // Oldest buffer waiting to be read by host
+    int tx_count;           // Number of buffers waiting to be read by host
+    bool rx_armed;          // Waiting for host to write a block
+    bool rx_done;           // Block received, waiting to be read by device
+    uint32_t block_start_us;
+    uint16_t crc_fifo[FPGA_SIM_CRC_FIFO];
+    int crc_count;
+
+    // Host side of the bus
+    uint32_t bus_kbytes_per_sec;
+    const uint8_t *out_data;
+    size_t out_len;
+    size_t out_pos;
+    uint8_t *in_buf;
+    size_t in_max;
+    size_t in_len;
+
+    fpga_sim_stats_t stats;
+} g_fpga_sim;
+
+// ATA UltraDMA CRC: CRC-16-CCITT over 16-bit words, initial value 0x4ABA
+static uint16_t fpga_sim_udma_crc(const uint8_t *data, size_t len)
+{
+    uint16_t crc = 0x4ABA;
+    for (size_t i = 0; i + 1 < len; i += 2)
+    {
+        crc ^= (uint16_t)(data[i] | (data[i + 1] << 8));
+        for (int bit = 0; bit < 16; bit++)
+        {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+// The DMA sniffer on RP2040 only calculates CRC for word-aligned transfers
+static bool is_aligned(const void *buf, size_t len)
+{
+    return ((len & 3) == 0) && (((uintptr_t)buf & 3) == 0);
+}
+
+static void push_host_crc(const uint8_t *data, size_t len)
+{
+    if (!g_fpga_sim.udma) return;
+
+    if (g_fpga_sim.crc_count < FPGA_SIM_CRC_FIFO)
+    {
+        g_fpga_sim.crc_fifo[g_fpga_sim.crc_count++] = fpga_sim_udma_crc(data, len);
+    }
+}
+
+static uint16_t pop_host_crc()
+{
+    if (g_fpga_sim.crc_count == 0) return 0;
+
+    uint16_t crc = g_fpga_sim.crc_fifo[0];
+    g_fpga_sim.crc_count--;
+    memmove(&g_fpga_sim.crc_fifo[0], &g_fpga_sim.crc_fifo[1], g_fpga_sim.crc_count * sizeof(uint16_t));
+    return crc;
+}
+
+static void raise_irq()
+{
+    g_fpga_sim.irq = true;
+    g_fpga_sim.stats.irq_count++;
+}
+
+// Check if the host has had time to transfer the current block over the IDE bus
+static bool bus_time_elapsed()
+{
+    if (g_fpga_sim.bus_kbytes_per_sec == 0) return true;
+
+    uint32_t needed_us = (uint64_t)g_fpga_sim.blocklen * 1000 / g_fpga_sim.bus_kbytes_per_sec;
+    return (uint32_t)(micros() - g_fpga_sim.block_start_us) >= needed_us;
+}
+
+// Advance the host side of the bus.
+// In PIO mode host waits for DATAREQ, in UltraDMA mode it transfers whenever data is available.
+static void host_bus_update()
+{
+    bool host_ready = g_fpga_sim.udma || (g_fpga_sim.regs.status & IDE_STATUS_DATAREQ);
+
+    if (g_fpga_sim.dir_write)
+    {
+        if (g_fpga_sim.tx_count > 0 && host_ready && bus_time_elapsed())
+        {
+            const uint8_t *data = g_fpga_sim.buf[g_fpga_sim.tx_first];
+            size_t len = g_fpga_sim.blocklen;
+            if (g_fpga_sim.in_len < g_fpga_sim.in_max)
+            {
+                size_t copylen = std::min(len, g_fpga_sim.in_max - g_fpga_sim.in_len);
+                memmove(g_fpga_sim.in_buf + g_fpga_sim.in_len, data, copylen);
+            }
+            g_fpga_sim.in_len += len;
+            g_fpga_sim.stats.host_bytes_in += len;
+            push_host_crc(data, len);
+
+            g_fpga_sim.tx_first ^= 1;
+            g_fpga_sim.tx_count--;
+            g_fpga_sim.block_start_us = micros();
+
+            if (g_fpga_sim.tx_count > 0)
+            {
+                g_fpga_sim.regs.status = IDE_STATUS_DEVRDY | IDE_STATUS_DATAREQ;
+                if (!g_fpga_sim.udma) raise_irq();
+            }
+            else
+            {
+                g_fpga_sim.regs.status = IDE_STATUS_BSY;
+            }
+        }
+    }
+    else if (g_fpga_sim.rx_armed && !g_fpga_sim.rx_done && host_ready &&
+             g_fpga_sim.out_pos < g_fpga_sim.out_len && bus_time_elapsed())
+    {
+        uint8_t *data = g_fpga_sim.buf[0];
+        size_t len = std::min<size_t>(g_fpga_sim.blocklen, g_fpga_sim.out_len - g_fpga_sim.out_pos);
+        memmove(data, g_fpga_sim.out_data + g_fpga_sim.out_pos, len);
+        memset(data + len, 0, g_fpga_sim.blocklen - len);
+        g_fpga_sim.out_pos += len;
+        g_fpga_sim.stats.host_bytes_out += len;
+        push_host_crc(data, g_fpga_sim.blocklen);
+
+        g_fpga_sim.rx_done = true;
+        g_fpga_sim.regs.status = IDE_STATUS_BSY;
+    }
+}
+
+static uint8_t get_status()
+{
+    uint8_t status = g_fpga_sim.flags;
+    if (g_fpga_sim.dir_write)
+    {
+        status |= FPGA_STATUS_DATA_DIR;
+        if (g_fpga_sim.tx_count < 2) status |= FPGA_STATUS_TX_CANWRITE;
+        if (g_fpga_sim.tx_count == 0) status |= FPGA_STATUS_TX_DONE;
+    }
+    else if (g_fpga_sim.rx_done)
+    {
+        status |= FPGA_STATUS_RX_DONE;
+    }
+    return status;
+}
+
+static void start_transfer(bool dir_write, bool udma, uint16_t last_word_idx)
+{
+    g_fpga_sim.dir_write = dir_write;
+    g_fpga_sim.udma = udma;
+    g_fpga_sim.blocklen = ((uint32_t)last_word_idx + 1) * 2;
+    g_fpga_sim.tx_first = 0;
+    g_fpga_sim.tx_count = 0;
+    g_fpga_sim.rx_armed = !dir_write;
+    g_fpga_sim.rx_done = false;
+    g_fpga_sim.crc_count = 0;
+    g_fpga_sim.block_start_us = micros();
+
+    if (!dir_write && g_fpga_sim.blocklen > FPGA_SIM_BUFSIZE)
+    {
+        logmsg("fpga_sim: START_READ block length ", (int)g_fpga_sim.blocklen, " exceeds buffer size");
+        g_fpga_sim.rx_armed = false;
+    }
+}
+
+// Command started with fpga_wrcmd_async(). Like the DMA transfer on hardware,
+// the payload is only read when the next command starts or the command is
+// waited for, so buffers reused too early show up as data errors.
+static struct {
+    bool pending;
+    uint8_t cmd;
+    const uint8_t *payload;
+    size_t payload_len;
+    uint32_t *crc;
+    int polls;
+} g_fpga_sim_async;
+
+static void fpga_sim_finish_async()
+{
+    if (g_fpga_sim_async.pending)
+    {
+        g_fpga_sim_async.pending = false;
+        fpga_wrcmd(g_fpga_sim_async.cmd, g_fpga_sim_async.payload,
+                   g_fpga_sim_async.payload_len, g_fpga_sim_async.crc);
+    }
+}
+
+void fpga_sim_init()
+{
+    fpga_sim_stats_t stats = g_fpga_sim.stats;
+    uint32_t bus_speed = g_fpga_sim.bus_kbytes_per_sec;
+    memset(&g_fpga_sim, 0, sizeof(g_fpga_sim));
+    g_fpga_sim_async.pending = false;
+    g_fpga_sim.stats = stats;
+    g_fpga_sim.bus_kbytes_per_sec = bus_speed;
+    g_fpga_sim.dir_write = true;
+    g_fpga_sim.initialized = true;
+}
+
+bool fpga_init(bool force_reinit, bool do_auth)
+{
+    if (!g_fpga_sim.initialized || force_reinit)
+    {
+        fpga_sim_init();
+    }
+    return true;
+}
+
+void fpga_wrcmd(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint32_t *crc)
+{
+    fpga_sim_finish_async();
+    g_fpga_sim.stats.wrcmd_count++;
+    g_fpga_sim.stats.wrcmd_bytes += payload_len;
+    g_fpga_sim.stats.cmd_count[cmd]++;
+    host_bus_update();
+
+    switch (cmd)
+    {
+        case FPGA_CMD_SET_IDE_PHY_CFG:
+            g_fpga_sim.phy_cfg = payload[0];
+            break;
+
+        case FPGA_CMD_WRITE_IDE_REGS:
+            memmove(&g_fpga_sim.regs, payload, std::min(payload_len, sizeof(ide_registers_t)));
+            break;
+
+        case FPGA_CMD_START_WRITE:
+        case FPGA_CMD_START_READ:
+            start_transfer(cmd == FPGA_CMD_START_WRITE, false, payload[0] | (payload[1] << 8));
+            break;
+
+        case FPGA_CMD_START_UDMA_WRITE:
+        case FPGA_CMD_START_UDMA_READ:
+            start_transfer(cmd == FPGA_CMD_START_UDMA_WRITE, true, payload[1] | (payload[2] << 8));
+            break;
+
+        case FPGA_CMD_WRITE_DATABUF:
+        {
+            if (!g_fpga_sim.dir_write || g_fpga_sim.tx_count >= 2 || g_fpga_sim.blocklen > FPGA_SIM_BUFSIZE)
+            {
+                logmsg("fpga_sim: WRITE_DATABUF with no buffer available, FPGA status ", get_status());
+                break;
+            }
+
+            int idx = (g_fpga_sim.tx_first + g_fpga_sim.tx_count) & 1;
+            memmove(g_fpga_sim.buf[idx], payload, std::min<size_t>(payload_len, g_fpga_sim.blocklen));
+            g_fpga_sim.tx_count++;
+
+            if (g_fpga_sim.tx_count == 1)
+            {
+                g_fpga_sim.block_start_us = micros();
+                g_fpga_sim.regs.status = IDE_STATUS_DEVRDY | IDE_STATUS_DATAREQ;
+                if (!g_fpga_sim.udma) raise_irq();
+            }
+
+            if (crc && is_aligned(payload, payload_len))
+            {
+                *crc = fpga_sim_udma_crc(payload, payload_len);
+            }
+            break;
+        }
+
+        case FPGA_CMD_WRITE_IDE_SIGNALS:
+            g_fpga_sim.signals = payload[0];
+            break;
+
+        case FPGA_CMD_ASSERT_IRQ:
+            g_fpga_sim.regs.status = payload[0];
+            raise_irq();
+            break;
+
+        case FPGA_CMD_CLR_IRQ_FLAGS:
+            g_fpga_sim.flags &= ~(payload[0] & 0xF0);
+            break;
+
+        case FPGA_CMD_LICENSE_AUTH:
+            break;
+
+        default:
+            logmsg("fpga_sim: Unknown write command ", cmd);
+            break;
+    }
+
+    host_bus_update();
+}
+
+void fpga_rdcmd(uint8_t cmd, uint8_t *result, size_t result_len, uint32_t *crc, bool slow)
+{
+    fpga_sim_finish_async();
+    g_fpga_sim.stats.rdcmd_count++;
+    g_fpga_sim.stats.rdcmd_bytes += result_len;
+    g_fpga_sim.stats.cmd_count[cmd]++;
+    host_bus_update();
+
+    memset(result, 0, result_len);
+
+    switch (cmd)
+    {
+        case FPGA_CMD_READ_STATUS:
+            if (result_len >= 1) result[0] = get_status();
+            if (result_len >= 2) result[1] = g_fpga_sim.regs.status;
+            break;
+
+        case FPGA_CMD_READ_IDE_REGS:
+            memmove(result, &g_fpga_sim.regs, std::min(result_len, sizeof(ide_registers_t)));
+            break;
+
+        case FPGA_CMD_READ_DATABUF:
+        case FPGA_CMD_READ_DATABUF_CONT:
+        {
+            if (g_fpga_sim.dir_write || !g_fpga_sim.rx_done)
+            {
+                logmsg("fpga_sim: READ_DATABUF with no data received, FPGA status ", get_status());
+            }
+
+            memmove(result, g_fpga_sim.buf[0], std::min<size_t>(result_len, FPGA_SIM_BUFSIZE));
+            g_fpga_sim.rx_done = false;
+
+            if (cmd == FPGA_CMD_READ_DATABUF_CONT)
+            {
+                // Start reception of next block with same length
+                g_fpga_sim.block_start_us = micros();
+                if (!g_fpga_sim.udma)
+                {
+                    g_fpga_sim.regs.status = IDE_STATUS_DEVRDY | IDE_STATUS_DATAREQ;
+                    raise_irq();
+                }
+            }
+            else
+            {
+                g_fpga_sim.rx_armed = false;
+            }
+
+            if (crc && is_aligned(result, result_len))
+            {
+                *crc = fpga_sim_udma_crc(result, result_len);
+            }
+            break;
+        }
+
+        case FPGA_CMD_READ_UDMA_CRC:
+        {
+            uint16_t host_crc = pop_host_crc();
+            if (result_len >= 2)
+            {
+                result[0] = (uint8_t)host_crc;
+                result[1] = (uint8_t)(host_crc >> 8);
+            }
+            break;
+        }
+
+        case FPGA_CMD_PROTOCOL_VERSION:
+            if (result_len >= 1) result[0] = FPGA_PROTOCOL_VERSION;
+            break;
+
+        case FPGA_CMD_LICENSE_CHECK:
+            if (result_len >= 1) result[0] = 0x01;
+            break;
+
+        case FPGA_CMD_COMMUNICATION_CHECK:
+            for (size_t i = 0; i < result_len; i++) result[i] = (uint8_t)i;
+            break;
+
+        default:
+            logmsg("fpga_sim: Unknown read command ", cmd);
+            break;
+    }
+
+    host_bus_update();
+}
+
+uint8_t fpga_read_status()
+{
+    uint8_t status;
+    fpga_rdcmd(FPGA_CMD_READ_STATUS, &status, 1);
+    return status;
+}
+
+// Asynchronous writes are deferred, reads complete immediately
+fpga_cmd_handle_t fpga_wrcmd_async(uint8_t cmd, const uint8_t *payload, size_t payload_len, uint32_t *crc)
+{
+    fpga_sim_finish_async();
+    g_fpga_sim_async.pending = true;
+    g_fpga_sim_async.cmd = cmd;
+    g_fpga_sim_async.payload = payload;
+    g_fpga_sim_async.payload_len = payload_len;
+    g_fpga_sim_async.crc = crc;
+    g_fpga_sim_async.polls = 0;
+    return 0;
+}
+
+fpga_cmd_handle_t fpga_rdcmd_async(uint8_t cmd, uint8_t *result, size_t result_len, uint32_t *crc, bool slow)
+{
+    fpga_rdcmd(cmd, result, result_len, crc, slow);
+    return 0;
+}
+
+void fpga_wait_cmd(fpga_cmd_handle_t handle)
+{
+    fpga_sim_finish_async();
+}
+
+// The DMA is reported busy on the first poll and done after that.
+// The payload is still read only when the command ends.
+bool fpga_cmd_is_done(fpga_cmd_handle_t handle)
+{
+    return !g_fpga_sim_async.pending || g_fpga_sim_async.polls++ > 0;
+}
+
+void fpga_wait_buffer(const void *buf, size_t len)
+{
+    const uint8_t *payload = g_fpga_sim_async.payload;
+    if (g_fpga_sim_async.pending &&
+        (const uint8_t*)buf < payload + g_fpga_sim_async.payload_len &&
+        (const uint8_t*)buf + len > payload)
+    {
+        fpga_sim_finish_async();
+    }
+}
+
+void fpga_dump_ide_regs()
+{
+    dbgmsg("-- IDE registers:", bytearray((const uint8_t*)&g_fpga_sim.regs, sizeof(ide_registers_t)));
+}
+
+/*****************************/
+/* Host side of the IDE bus  */
+/*****************************/
+
+const fpga_sim_stats_t *fpga_sim_get_stats()
+{
+    return &g_fpga_sim.stats;
+}
+
+void fpga_sim_clear_stats()
+{
+    memset(&g_fpga_sim.stats, 0, sizeof(g_fpga_sim.stats));
+}
+
+void fpga_sim_set_bus_speed(uint32_t kbytes_per_sec)
+{
+    g_fpga_sim.bus_kbytes_per_sec = kbytes_per_sec;
+}
+
+void fpga_sim_host_reset()
+{
+    memset(&g_fpga_sim.regs, 0, sizeof(g_fpga_sim.regs));
+    g_fpga_sim.regs.status = IDE_STATUS_BSY;
+    g_fpga_sim.flags |= FPGA_STATUS_IDE_RST;
+    g_fpga_sim.irq = false;
+    start_transfer(true, false, 0xFFFF);
+}
+
+void fpga_sim_host_command(const ide_registers_t *regs)
+{
+    uint8_t status = g_fpga_sim.regs.status;
+    g_fpga_sim.regs = *regs;
+    g_fpga_sim.regs.status = status | IDE_STATUS_BSY;
+    g_fpga_sim.regs.error = 0;
+    g_fpga_sim.flags |= FPGA_STATUS_IDE_CMD | FPGA_STATUS_IDE_WR;
+    g_fpga_sim.irq = false;
+    g_fpga_sim.in_len = 0;
+
+    int dev = (regs->device & IDE_DEVICE_DEV) ? 1 : 0;
+    bool atapi = g_fpga_sim.phy_cfg & (dev ? 0x10 : 0x08);
+    if (regs->command == IDE_CMD_PACKET && atapi)
+    {
+        // FPGA receives the 12-byte command packet automatically
+        start_transfer(false, false, 5);
+        size_t len = std::min<size_t>(12, g_fpga_sim.out_len - g_fpga_sim.out_pos);
+        memset(g_fpga_sim.buf[0], 0, 12);
+        memmove(g_fpga_sim.buf[0], g_fpga_sim.out_data + g_fpga_sim.out_pos, len);
+        g_fpga_sim.out_pos += len;
+        g_fpga_sim.rx_done = true;
+    }
+}
+
+bool fpga_sim_host_command_pending()
+{
+    return g_fpga_sim.flags & FPGA_STATUS_IDE_CMD;
+}
+
+void fpga_sim_host_get_regs(ide_registers_t *regs)
+{
+    host_bus_update();
+    *regs = g_fpga_sim.regs;
+    g_fpga_sim.irq = false;
+}
+
+bool fpga_sim_host_irq_pending()
+{
+    return g_fpga_sim.irq;
+}
+
+void fpga_sim_host_set_data_out(const uint8_t *data, size_t len)
+{
+    g_fpga_sim.out_data = data;
+    g_fpga_sim.out_len = len;
+    g_fpga_sim.out_pos = 0;
+}
+
+size_t fpga_sim_host_data_out_remaining()
+{
+    return g_fpga_sim.out_len - g_fpga_sim.out_pos;
+}
+
+void fpga_sim_host_set_data_in(uint8_t *buf, size_t maxlen)
+{
+    g_fpga_sim.in_buf = buf;
+    g_fpga_sim.in_max = maxlen;
+    g_fpga_sim.in_len = 0;
+}
+
+size_t fpga_sim_host_data_in_len()
+{
+    return g_fpga_sim.in_len;
+}
+
+uint8_t fpga_sim_get_device_signals()
+{
+    return g_fpga_sim.signals;
+}
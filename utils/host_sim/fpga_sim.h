@@ -0,0 +1,87 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Simulation model of the ICE5LP1K FPGA for building the IDE stack on a Linux host.
+//
+// fpga_sim.cpp implements the rp2040_fpga.h command interface, so that
+// rp2040_ide_phy.cpp and everything above it runs unchanged. The model has
+// the same two 4096 byte data buffers and status bits as the real FPGA.
+// The functions below give access to the other side of the IDE bus,
+// where a scripted host writes registers and transfers data.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ide_phy.h>
+
+// Counters of QSPI transactions between RP2040 and FPGA
+struct fpga_sim_stats_t {
+    uint32_t wrcmd_count;       // Number of fpga_wrcmd() calls
+    uint32_t rdcmd_count;       // Number of fpga_rdcmd() calls
+    uint64_t wrcmd_bytes;       // Payload bytes written to FPGA
+    uint64_t rdcmd_bytes;       // Payload bytes read from FPGA
+    uint32_t cmd_count[256];    // Number of transactions per FPGA command byte
+    uint64_t host_bytes_in;     // Bytes transferred from device to host
+    uint64_t host_bytes_out;    // Bytes transferred from host to device
+    uint32_t irq_count;         // Number of IDE interrupts asserted
+};
+
+// Reset FPGA state, as if it was reloaded
+void fpga_sim_init();
+
+// Get and clear transaction counters
+const fpga_sim_stats_t *fpga_sim_get_stats();
+void fpga_sim_clear_stats();
+
+// Simulated IDE bus transfer rate in kilobytes per second.
+// Value 0 makes host transfers complete instantly.
+void fpga_sim_set_bus_speed(uint32_t kbytes_per_sec);
+
+// Host asserts IDE bus reset
+void fpga_sim_host_reset();
+
+// Host writes taskfile registers, the command register last.
+// For ATAPI PACKET command, the 12-byte command packet is taken from the
+// data set with fpga_sim_host_set_data_out().
+void fpga_sim_host_command(const ide_registers_t *regs);
+
+// Returns true while the command register write is still pending for the device
+bool fpga_sim_host_command_pending();
+
+// Read IDE registers as seen by the host.
+// Reading clears the interrupt, like reading STATUS does on a real bus.
+void fpga_sim_host_get_regs(ide_registers_t *regs);
+
+// Returns true if device has asserted interrupt since last register read
+bool fpga_sim_host_irq_pending();
+
+// Data to be sent by host for the following data-out phases
+void fpga_sim_host_set_data_out(const uint8_t *data, size_t len);
+size_t fpga_sim_host_data_out_remaining();
+
+// Buffer for data received by host in data-in phases.
+// Data exceeding maxlen is counted but discarded.
+void fpga_sim_host_set_data_in(uint8_t *buf, size_t maxlen);
+size_t fpga_sim_host_data_in_len();
+
+// Get IDE diagnostic signals driven by the device (IDE_SIGNAL_DASP etc.)
+uint8_t fpga_sim_get_device_signals();
@@ -0,0 +1,137 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Implementation of the platform functions used by the IDE emulation
+// when running on a Linux host.
+
+#include "ZuluIDE.h"
+#include "ZuluIDE_platform.h"
+#include <stdio.h>
+#include <time.h>
+
+const char *g_platform_name = PLATFORM_NAME " (host simulation)";
+
+SdFs SD;
+bool g_sdcard_present = true;
+
+// Print log messages to stdout, enabled by the test programs as needed
+bool g_host_log_stdout = false;
+
+static uint64_t host_time_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+extern "C" unsigned long millis()
+{
+    return (unsigned long)(uint32_t)(host_time_us() / 1000);
+}
+
+extern "C" unsigned long micros()
+{
+    return (unsigned long)(uint32_t)host_time_us();
+}
+
+extern "C" void delay(unsigned long ms)
+{
+    delayMicroseconds(ms * 1000);
+}
+
+extern "C" void delayMicroseconds(unsigned int us)
+{
+    uint64_t start = host_time_us();
+    while (host_time_us() - start < us);
+}
+
+void platform_log(const char *s)
+{
+    if (g_host_log_stdout)
+    {
+        fputs(s, stdout);
+    }
+}
+
+void platform_poll()
+{
+}
+
+uint8_t platform_get_buttons()
+{
+    return 0;
+}
+
+int platform_get_device_id(void)
+{
+    return 0;
+}
+
+void platform_reset_watchdog()
+{
+}
+
+void platform_write_led(bool state)
+{
+}
+
+// SD card transfers always run synchronously on the host
+void platform_sd_core1_request(bool enable) {}
+void platform_sd_core1_start() {}
+bool platform_sd_core1_active() { return false; }
+bool platform_sd_core1_busy() { return false; }
+bool platform_sd_core1_submit(bool write, uint32_t sector, uint8_t *buf, uint32_t count) { return false; }
+uint32_t platform_sd_core1_bytes_done(bool *error) { *error = true; return 0; }
+bool platform_sd_core1_reset() { return true; }
+
+// Callback used by IDE code for simultaneous processing,
+// works the same way as in sd_card_sdio.cpp.
+static sd_callback_t m_stream_callback;
+static const uint8_t *m_stream_buffer;
+static uint32_t m_stream_count;
+static uint32_t m_stream_count_start;
+static bool m_stream_active;
+
+void platform_set_sd_callback(sd_callback_t func, const uint8_t *buffer)
+{
+    m_stream_callback = func;
+    m_stream_buffer = buffer;
+    m_stream_count = 0;
+    m_stream_count_start = 0;
+}
+
+void host_sd_stream_start(const void *buf, uint32_t count)
+{
+    m_stream_count_start = m_stream_count;
+    m_stream_active = (m_stream_callback && (const uint8_t*)buf == m_stream_buffer + m_stream_count);
+    if (m_stream_active)
+    {
+        m_stream_count += count;
+    }
+}
+
+void host_sd_stream_progress(uint32_t bytes_done)
+{
+    if (m_stream_active && m_stream_callback)
+    {
+        m_stream_callback(m_stream_count_start + bytes_done);
+    }
+}
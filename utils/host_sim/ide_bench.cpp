@@ -0,0 +1,478 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Throughput and latency benchmark of the IDE device emulation over the
+// simulated FPGA bus. Used for comparing settings such as max_blocksize
+// in zuluide.ini, IDE_BUFFER_SIZE and UDMA mode before testing on hardware.
+//
+// For each workload the following are reported:
+//  - Throughput in MB/s of data transferred over the simulated IDE bus
+//  - Command latency percentiles, from taskfile write to command completion
+//  - Number of fpga_wrcmd() / fpga_rdcmd() transactions per command
+//  - Bytes copied with memcpy() by the firmware code per command
+//
+// Usage: ide_bench [-n commands] [-u udma_mode] [-k bus_kBps] [-i idle_us] [-p] [-v]
+//                  [-c cd.iso] [-r hdd.img] [-z zip.img]
+
+#include "fpga_sim.h"
+#include "sim_host.h"
+#include <ide_protocol.h>
+#include <ide_rigid.h>
+#include <ide_cdrom.h>
+#include <ide_zipdrive.h>
+#include <ide_imagefile.h>
+#include <rp2040_fpga.h>
+#include "ide_imagefile_posix.h"
+#include <ZuluIDE_log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+
+#ifndef IDE_BUFFER_SIZE
+#define IDE_BUFFER_SIZE 65536
+#endif
+
+#define ZIP100_IMAGE_SIZE (512 * 196608ULL)
+
+extern bool g_host_log_stdout;
+
+static uint32_t g_ide_buffer[IDE_BUFFER_SIZE / 4];
+
+// The benchmark binary is linked with -Wl,--wrap=memcpy so that all calls
+// to memcpy() from the firmware code are counted here.
+static struct {
+    uint64_t calls;
+    uint64_t bytes;
+} g_memcpy_stats;
+
+extern "C" void *__real_memcpy(void *dest, const void *src, size_t n);
+extern "C" void *__wrap_memcpy(void *dest, const void *src, size_t n)
+{
+    g_memcpy_stats.calls++;
+    g_memcpy_stats.bytes += n;
+    return __real_memcpy(dest, src, n);
+}
+
+static struct {
+    int command_count;
+    int udma_mode;
+    uint32_t idle_us;
+    bool use_posix;
+    const char *cd_image;
+    const char *rigid_image;
+    const char *zip_image;
+} g_bench_cfg = {200, -1, 0, false, nullptr, nullptr, nullptr};
+
+// Image opened with IDEImageFile backend, used for idle time read-ahead
+static IDEImageFile *g_bench_file_image;
+
+// Run the same idle processing as zuluide_main_loop() between commands
+static void bench_idle()
+{
+    uint32_t start = micros();
+    while ((uint32_t)(micros() - start) < g_bench_cfg.idle_us)
+    {
+        ide_protocol_poll();
+        if (g_bench_file_image && !ide_phy_is_command_interrupted())
+        {
+            g_bench_file_image->prefetch_poll();
+        }
+    }
+}
+
+// Accumulated measurements for one workload
+struct bench_result_t
+{
+    const char *name;
+    std::vector<uint32_t> latency_us;
+    uint64_t total_us;
+    uint64_t bus_bytes;
+    uint64_t wrcmd_count;
+    uint64_t rdcmd_count;
+    uint64_t memcpy_bytes;
+    int errors;
+};
+
+// Workload runs one command per call and returns number of data bytes
+// transferred over the bus, or negative on error.
+typedef ssize_t (*bench_command_t)(int index);
+
+static void run_workload(bench_result_t *result, bench_command_t command)
+{
+    result->latency_us.clear();
+    result->total_us = 0;
+    result->bus_bytes = 0;
+    result->wrcmd_count = 0;
+    result->rdcmd_count = 0;
+    result->memcpy_bytes = 0;
+    result->errors = 0;
+
+    for (int i = 0; i < g_bench_cfg.command_count; i++)
+    {
+        bench_idle();
+
+        fpga_sim_clear_stats();
+        uint64_t memcpy_start = g_memcpy_stats.bytes;
+        uint32_t start = micros();
+
+        ssize_t bytes = command(i);
+
+        uint32_t elapsed = micros() - start;
+        const fpga_sim_stats_t *stats = fpga_sim_get_stats();
+        result->latency_us.push_back(elapsed);
+        result->total_us += elapsed;
+        result->wrcmd_count += stats->wrcmd_count;
+        result->rdcmd_count += stats->rdcmd_count;
+        result->memcpy_bytes += g_memcpy_stats.bytes - memcpy_start;
+
+        if (bytes < 0)
+            result->errors++;
+        else
+            result->bus_bytes += bytes;
+    }
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, int pct)
+{
+    if (sorted.empty()) return 0;
+    size_t idx = (sorted.size() - 1) * pct / 100;
+    return sorted[idx];
+}
+
+static void print_header()
+{
+    printf("%-24s %8s %8s %8s %8s %8s %9s %9s %11s %6s\n",
+           "Workload", "MB/s", "p50 us", "p90 us", "p99 us", "max us",
+           "wrcmd/cmd", "rdcmd/cmd", "memcpy/cmd", "errors");
+}
+
+static void print_result(bench_result_t *result)
+{
+    std::vector<uint32_t> sorted = result->latency_us;
+    std::sort(sorted.begin(), sorted.end());
+    double count = std::max<size_t>(sorted.size(), 1);
+    double mbps = (result->total_us > 0) ? (double)result->bus_bytes / result->total_us : 0;
+
+    printf("%-24s %8.2f %8u %8u %8u %8u %9.1f %9.1f %11.0f %6d\n",
+           result->name, mbps,
+           percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+           sorted.empty() ? 0 : sorted.back(),
+           result->wrcmd_count / count, result->rdcmd_count / count,
+           result->memcpy_bytes / count, result->errors);
+}
+
+// Create image file filled with a byte pattern, unless it already exists
+static bool create_bench_image(const char *filename, uint64_t size)
+{
+    if (access(filename, F_OK) == 0) return true;
+
+    FILE *f = fopen(filename, "wb");
+    if (!f) return false;
+
+    static uint8_t chunk[65536];
+    for (size_t i = 0; i < sizeof(chunk); i++) chunk[i] = (uint8_t)(i * 7);
+    for (uint64_t pos = 0; pos < size; pos += sizeof(chunk))
+    {
+        size_t len = std::min<uint64_t>(sizeof(chunk), size - pos);
+        if (fwrite(chunk, 1, len, f) != len)
+        {
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+// Open image with the backend selected on command line.
+// Both objects are kept around so that the device can hold a pointer.
+static IDEImage *open_bench_image(const char *filename, bool read_only)
+{
+    static IDEImageFile file_image;
+    static IDEImagePosixFile posix_image((uint8_t*)g_ide_buffer, sizeof(g_ide_buffer));
+
+    file_image.close();
+    posix_image.close();
+    g_bench_file_image = nullptr;
+
+    if (g_bench_cfg.use_posix)
+    {
+        if (!posix_image.open_file(filename, read_only)) return nullptr;
+        return &posix_image;
+    }
+    else
+    {
+        file_image = IDEImageFile((uint8_t*)g_ide_buffer, sizeof(g_ide_buffer));
+        if (!file_image.open_file(filename, read_only)) return nullptr;
+        g_bench_file_image = &file_image;
+        return &file_image;
+    }
+}
+
+// Negotiate the transfer mode configured on command line
+static void set_transfer_mode()
+{
+    if (g_bench_cfg.udma_mode < 0) return;
+
+    ide_registers_t regs = {};
+    regs.command = IDE_CMD_SET_FEATURES;
+    regs.feature = IDE_SET_FEATURE_TRANSFER_MODE;
+    regs.sector_count = 0x40 | g_bench_cfg.udma_mode;
+    if (!sim_host_ata_command(&regs))
+    {
+        printf("Warning: UDMA mode %d was rejected, using PIO\n", g_bench_cfg.udma_mode);
+        g_bench_cfg.udma_mode = -1;
+    }
+}
+
+// Clear the unit attention condition reported after reset
+static void atapi_clear_unit_attention()
+{
+    uint8_t tur[12] = {0};
+    for (int i = 0; i < 3; i++)
+    {
+        if (sim_host_atapi_command(tur, 0, false)) break;
+    }
+}
+
+static uint8_t g_data[65536];
+static uint32_t g_capacity_lba;
+
+/*************************/
+/* CD-ROM workloads      */
+/*************************/
+
+#define CD_READ10_SECTORS 16
+#define CD_READCD_SECTORS 16
+#define CD_READCD_SECTORSIZE (2352 + 16)
+
+static ssize_t cd_read10(int index)
+{
+    uint32_t lba = (index * CD_READ10_SECTORS) % (g_capacity_lba - CD_READ10_SECTORS);
+    uint8_t cdb[12] = {0x28, 0,
+        (uint8_t)(lba >> 24), (uint8_t)(lba >> 16), (uint8_t)(lba >> 8), (uint8_t)lba,
+        0, 0, CD_READ10_SECTORS, 0};
+    size_t len = 0;
+    bool dma = (g_bench_cfg.udma_mode >= 0);
+    if (!sim_host_atapi_command(cdb, 0xFFFE, dma, nullptr, 0, g_data, sizeof(g_data), &len)) return -1;
+    return len;
+}
+
+// READ CD with sync, header, user data, EDC/ECC and Q subchannel
+static ssize_t cd_read_cd_raw(int index)
+{
+    uint32_t lba = (index * CD_READCD_SECTORS) % (g_capacity_lba - CD_READCD_SECTORS);
+    uint8_t cdb[12] = {0xBE, 0,
+        (uint8_t)(lba >> 24), (uint8_t)(lba >> 16), (uint8_t)(lba >> 8), (uint8_t)lba,
+        0, 0, CD_READCD_SECTORS, 0xF8, 0x02, 0};
+    size_t len = 0;
+    bool dma = (g_bench_cfg.udma_mode >= 0);
+    if (!sim_host_atapi_command(cdb, 0xFFFE, dma, nullptr, 0, g_data, sizeof(g_data), &len)) return -1;
+    if (len != CD_READCD_SECTORS * CD_READCD_SECTORSIZE) return -1;
+    return len;
+}
+
+static void bench_cdrom(const char *filename)
+{
+    static IDECDROMDevice device;
+    IDEImage *image = open_bench_image(filename, true);
+    if (!image)
+    {
+        printf("Failed to open %s\n", filename);
+        return;
+    }
+
+    ide_protocol_init(&device, NULL);
+    device.set_image(image);
+    sim_host_reset();
+    set_transfer_mode();
+    atapi_clear_unit_attention();
+    g_capacity_lba = image->capacity() / 2048;
+
+    bench_result_t result;
+    result.name = "CD READ(10) 2048";
+    run_workload(&result, cd_read10);
+    print_result(&result);
+
+    result.name = "CD READ CD 2352+Q";
+    run_workload(&result, cd_read_cd_raw);
+    print_result(&result);
+}
+
+/*************************/
+/* Rigid disk workloads  */
+/*************************/
+
+#define RIGID_READ_SECTORS 8
+
+static ssize_t rigid_read_dma(int index)
+{
+    uint32_t lba = (uint32_t)random() % (g_capacity_lba - RIGID_READ_SECTORS);
+    ide_registers_t regs = {};
+    regs.command = IDE_CMD_READ_DMA;
+    regs.device = 0x40 | ((lba >> 24) & 0x0F); // LBA mode
+    regs.lba_high = (uint8_t)(lba >> 16);
+    regs.lba_mid = (uint8_t)(lba >> 8);
+    regs.lba_low = (uint8_t)lba;
+    regs.sector_count = RIGID_READ_SECTORS;
+    size_t len = 0;
+    if (!sim_host_ata_command(&regs, nullptr, 0, g_data, sizeof(g_data), &len)) return -1;
+    return len;
+}
+
+static void bench_rigid(const char *filename)
+{
+    static IDERigidDevice device;
+    IDEImage *image = open_bench_image(filename, true);
+    if (!image)
+    {
+        printf("Failed to open %s\n", filename);
+        return;
+    }
+
+    ide_protocol_init(&device, NULL);
+    device.set_image(image);
+    sim_host_reset();
+    set_transfer_mode();
+    g_capacity_lba = image->capacity() / 512;
+
+    srandom(1234);
+    bench_result_t result;
+    result.name = "HDD READ DMA 4k random";
+    run_workload(&result, rigid_read_dma);
+    print_result(&result);
+}
+
+/*************************/
+/* Zip drive workloads   */
+/*************************/
+
+#define ZIP_WRITE_SECTORS 32
+
+static ssize_t zip_write10(int index)
+{
+    uint32_t lba = (index * ZIP_WRITE_SECTORS) % (g_capacity_lba - ZIP_WRITE_SECTORS);
+    uint8_t cdb[12] = {0x2A, 0,
+        (uint8_t)(lba >> 24), (uint8_t)(lba >> 16), (uint8_t)(lba >> 8), (uint8_t)lba,
+        0, 0, ZIP_WRITE_SECTORS, 0};
+    bool dma = (g_bench_cfg.udma_mode >= 0);
+    size_t len = ZIP_WRITE_SECTORS * 512;
+    if (!sim_host_atapi_command(cdb, 0xFFFE, dma, g_data, len)) return -1;
+    if (fpga_sim_host_data_out_remaining() != 0) return -1;
+    return len;
+}
+
+static void bench_zip(const char *filename)
+{
+    static IDEZipDrive device;
+    IDEImage *image = open_bench_image(filename, false);
+    if (!image)
+    {
+        printf("Failed to open %s\n", filename);
+        return;
+    }
+
+    ide_protocol_init(&device, NULL);
+    device.set_image(image);
+    sim_host_reset();
+    set_transfer_mode();
+    atapi_clear_unit_attention();
+    g_capacity_lba = image->capacity() / 512;
+
+    bench_result_t result;
+    result.name = "ZIP WRITE(10) 16k";
+    run_workload(&result, zip_write10);
+    print_result(&result);
+}
+
+static void usage()
+{
+    printf("Usage: ide_bench [-n commands] [-u udma_mode] [-k bus_kBps] [-i idle_us] [-p] [-v]\n"
+           "                 [-c cd.iso] [-r hdd.img] [-z zip.img]\n"
+           "  -n  Number of commands per workload (default 200)\n"
+           "  -u  Negotiate UDMA mode, default is PIO\n"
+           "  -k  Simulated host bus speed in kB/s\n"
+           "  -i  Host idle time between commands, used for read-ahead\n"
+           "  -p  Use IDEImagePosixFile backend instead of IDEImageFile\n"
+           "  -v  Print log messages\n"
+           "  -c/-r/-z  Image files to use, default is to create temporary images\n"
+           "Settings such as max_blocksize are read from zuluide.ini in current directory.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    g_log_debug = false;
+    while ((opt = getopt(argc, argv, "n:u:k:i:pvc:r:z:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': g_bench_cfg.command_count = atoi(optarg); break;
+            case 'u': g_bench_cfg.udma_mode = atoi(optarg); break;
+            case 'k': fpga_sim_set_bus_speed(atoi(optarg)); break;
+            case 'i': g_bench_cfg.idle_us = atoi(optarg); break;
+            case 'p': g_bench_cfg.use_posix = true; break;
+            case 'v': g_host_log_stdout = true; g_log_debug = true; break;
+            case 'c': g_bench_cfg.cd_image = optarg; break;
+            case 'r': g_bench_cfg.rigid_image = optarg; break;
+            case 'z': g_bench_cfg.zip_image = optarg; break;
+            default: usage(); return 1;
+        }
+    }
+
+    if (g_bench_cfg.command_count <= 0)
+    {
+        usage();
+        return 1;
+    }
+
+    const char *cd_image = g_bench_cfg.cd_image ? g_bench_cfg.cd_image : "cdrm_bench.iso";
+    const char *rigid_image = g_bench_cfg.rigid_image ? g_bench_cfg.rigid_image : "hddr_bench.img";
+    const char *zip_image = g_bench_cfg.zip_image ? g_bench_cfg.zip_image : "zipr_bench.img";
+
+    if (!create_bench_image(cd_image, 32 * 1024 * 1024) ||
+        !create_bench_image(rigid_image, 64 * 1024 * 1024) ||
+        !create_bench_image(zip_image, ZIP100_IMAGE_SIZE))
+    {
+        printf("Failed to create benchmark images\n");
+        return 1;
+    }
+
+    fpga_init();
+
+    printf("IDE_BUFFER_SIZE %d, %s backend, %s, %d commands per workload\n",
+           IDE_BUFFER_SIZE, g_bench_cfg.use_posix ? "POSIX" : "SdFat",
+           g_bench_cfg.udma_mode >= 0 ? "UDMA" : "PIO", g_bench_cfg.command_count);
+    print_header();
+
+    bench_cdrom(cd_image);
+    bench_rigid(rigid_image);
+    bench_zip(zip_image);
+
+    if (!g_bench_cfg.cd_image) unlink(cd_image);
+    if (!g_bench_cfg.rigid_image) unlink(rigid_image);
+    if (!g_bench_cfg.zip_image) unlink(zip_image);
+
+    return 0;
+}
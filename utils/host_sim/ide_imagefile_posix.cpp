@@ -0,0 +1,299 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "ide_imagefile_posix.h"
+#include <ZuluIDE.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+IDEImagePosixFile::IDEImagePosixFile(uint8_t *buffer, size_t buffer_size):
+    m_fd(-1), m_capacity(0), m_read_only(false),
+    m_buffer(buffer), m_buffer_size(buffer_size), m_chunk_size(FS_HOST_STREAM_CHUNK),
+    m_drive_type(DRIVE_TYPE_VIA_PREFIX)
+{
+    m_filename[0] = '\0';
+    memset(&m_cb_state, 0, sizeof(m_cb_state));
+}
+
+IDEImagePosixFile::~IDEImagePosixFile()
+{
+    close();
+}
+
+bool IDEImagePosixFile::open_file(const char *filename, bool read_only)
+{
+    close();
+
+    if (!read_only && access(filename, W_OK) != 0)
+    {
+        read_only = true;
+    }
+
+    m_fd = ::open(filename, read_only ? O_RDONLY : O_RDWR);
+    if (m_fd < 0)
+    {
+        logmsg("IDEImagePosixFile: failed to open ", filename);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0)
+    {
+        close();
+        return false;
+    }
+
+    const char *name = strrchr(filename, '/');
+    strlcpy(m_filename, name ? name + 1 : filename, sizeof(m_filename));
+    m_capacity = st.st_size;
+    m_read_only = read_only;
+    return true;
+}
+
+void IDEImagePosixFile::close()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+    }
+
+    m_fd = -1;
+    m_capacity = 0;
+    m_filename[0] = '\0';
+}
+
+void IDEImagePosixFile::set_chunk_size(size_t chunk_size)
+{
+    m_chunk_size = chunk_size;
+}
+
+bool IDEImagePosixFile::get_filename(char *buf, size_t buflen)
+{
+    strlcpy(buf, m_filename, buflen);
+    return m_fd >= 0;
+}
+
+uint64_t IDEImagePosixFile::capacity()
+{
+    return m_capacity;
+}
+
+bool IDEImagePosixFile::writable()
+{
+    return !m_read_only;
+}
+
+bool IDEImagePosixFile::load_next_image()
+{
+    return false;
+}
+
+void IDEImagePosixFile::set_drive_type(drive_type_t type)
+{
+    m_drive_type = type;
+}
+
+drive_type_t IDEImagePosixFile::get_drive_type()
+{
+    return m_drive_type;
+}
+
+/******************************/
+/* Data transfer from file    */
+/******************************/
+
+bool IDEImagePosixFile::read(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback)
+{
+    if (m_fd < 0) return false;
+
+    assert(blocksize <= m_buffer_size);
+
+    m_cb_state.callback = callback;
+    m_cb_state.error = false;
+    m_cb_state.num_blocks = num_blocks;
+    m_cb_state.blocksize = blocksize;
+    m_cb_state.blocks_done = 0;
+    m_cb_state.blocks_available = 0;
+    m_cb_state.bufsize_blocks = m_buffer_size / blocksize;
+
+    while (m_cb_state.blocks_done < num_blocks && !m_cb_state.error)
+    {
+        platform_poll();
+
+        // Check if we have buffer space to read more from file
+        if (m_cb_state.blocks_available < num_blocks &&
+            m_cb_state.blocks_available < m_cb_state.blocks_done + m_cb_state.bufsize_blocks)
+        {
+            // Limit by total transfer size, free slots in buffer and space until wrap point
+            size_t start_idx = m_cb_state.blocks_available % m_cb_state.bufsize_blocks;
+            size_t max_read = std::min({
+                num_blocks - m_cb_state.blocks_available,
+                m_cb_state.blocks_done + m_cb_state.bufsize_blocks - m_cb_state.blocks_available,
+                m_cb_state.bufsize_blocks - start_idx
+            });
+
+            // Read in chunks and let callback process data in between
+            uint8_t *buf = m_buffer + blocksize * start_idx;
+            uint64_t filepos = startpos + (uint64_t)blocksize * m_cb_state.blocks_available;
+            size_t len = blocksize * max_read;
+            size_t done = 0;
+            while (done < len)
+            {
+                size_t chunk = std::min(len - done, m_chunk_size);
+                if (pread(m_fd, buf + done, chunk, filepos + done) != (ssize_t)chunk)
+                {
+                    logmsg("IDEImagePosixFile: read failed at ", (uint64_t)(filepos + done));
+                    m_cb_state.error = true;
+                    break;
+                }
+                done += chunk;
+                read_callback(done);
+            }
+
+            if (!m_cb_state.error)
+                m_cb_state.blocks_available += max_read;
+        }
+
+        // Provide callbacks until all blocks have been processed
+        if (m_cb_state.blocks_done < m_cb_state.blocks_available)
+        {
+            read_callback(0);
+        }
+    }
+
+    return !m_cb_state.error;
+}
+
+void IDEImagePosixFile::read_callback(size_t bytes_complete)
+{
+    if (m_cb_state.error) return;
+
+    size_t blocks_available = m_cb_state.blocks_available + bytes_complete / m_cb_state.blocksize;
+
+    // Check how many contiguous blocks are available to process.
+    size_t start_idx = m_cb_state.blocks_done % m_cb_state.bufsize_blocks;
+    size_t max_write = std::min({
+        blocks_available - m_cb_state.blocks_done,
+        m_cb_state.bufsize_blocks - start_idx
+    });
+
+    if (max_write > 0)
+    {
+        uint8_t *data_start = m_buffer + start_idx * m_cb_state.blocksize;
+        ssize_t status = m_cb_state.callback->read_callback(data_start, m_cb_state.blocksize, max_write);
+        if (status < 0)
+            m_cb_state.error = true;
+        else
+            m_cb_state.blocks_done += status;
+    }
+}
+
+/******************************/
+/* Data transfer to file      */
+/******************************/
+
+bool IDEImagePosixFile::write(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback)
+{
+    if (m_fd < 0 || m_read_only) return false;
+
+    assert(blocksize <= m_buffer_size);
+
+    m_cb_state.callback = callback;
+    m_cb_state.error = false;
+    m_cb_state.num_blocks = num_blocks;
+    m_cb_state.blocksize = blocksize;
+    m_cb_state.blocks_done = 0;
+    m_cb_state.blocks_available = 0;
+    m_cb_state.bufsize_blocks = m_buffer_size / blocksize;
+
+    while (m_cb_state.blocks_done < num_blocks && !m_cb_state.error)
+    {
+        platform_poll();
+
+        // Check if callback can provide more data
+        write_callback(0);
+
+        // Check if there is data to be written to file
+        if (m_cb_state.blocks_done < m_cb_state.blocks_available)
+        {
+            size_t start_idx = m_cb_state.blocks_done % m_cb_state.bufsize_blocks;
+            size_t max_write = std::min({
+                m_cb_state.blocks_available - m_cb_state.blocks_done,
+                m_cb_state.bufsize_blocks - start_idx
+            });
+
+            // Write in chunks and let callback receive more data in between
+            uint8_t *buf = m_buffer + blocksize * start_idx;
+            uint64_t filepos = startpos + (uint64_t)blocksize * m_cb_state.blocks_done;
+            size_t len = blocksize * max_write;
+            size_t done = 0;
+            while (done < len)
+            {
+                size_t chunk = std::min(len - done, m_chunk_size);
+                if (pwrite(m_fd, buf + done, chunk, filepos + done) != (ssize_t)chunk)
+                {
+                    logmsg("IDEImagePosixFile: write failed at ", (uint64_t)(filepos + done));
+                    m_cb_state.error = true;
+                    break;
+                }
+                done += chunk;
+                write_callback(done);
+            }
+
+            if (!m_cb_state.error)
+                m_cb_state.blocks_done += max_write;
+        }
+    }
+
+    return !m_cb_state.error;
+}
+
+void IDEImagePosixFile::write_callback(size_t bytes_complete)
+{
+    if (m_cb_state.error) return;
+
+    size_t blocks_done = m_cb_state.blocks_done + bytes_complete / m_cb_state.blocksize;
+
+    if (m_cb_state.blocks_available < m_cb_state.num_blocks &&
+        m_cb_state.blocks_available < blocks_done + m_cb_state.bufsize_blocks)
+    {
+        // Limit by total transfer size, free slots in buffer and space until wrap point
+        size_t start_idx = m_cb_state.blocks_available % m_cb_state.bufsize_blocks;
+        size_t max_read = std::min({
+            m_cb_state.num_blocks - m_cb_state.blocks_available,
+            blocks_done + m_cb_state.bufsize_blocks - m_cb_state.blocks_available,
+            m_cb_state.bufsize_blocks - start_idx
+        });
+
+        if (max_read > 0)
+        {
+            uint8_t *data_start = m_buffer + start_idx * m_cb_state.blocksize;
+            ssize_t status = m_cb_state.callback->write_callback(data_start, m_cb_state.blocksize, max_read);
+            if (status < 0)
+                m_cb_state.error = true;
+            else
+                m_cb_state.blocks_available += status;
+        }
+    }
+}
@@ -0,0 +1,79 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Image file backend for Linux hosts, a sibling of IDEImageFile that
+// accesses ordinary files with pread() and pwrite().
+// Used for benchmarking the device data paths with large images
+// without the SdFat shim in between.
+
+#pragma once
+
+#include <ide_imagefile.h>
+#include <ZuluIDE_config.h>
+
+class IDEImagePosixFile: public IDEImage
+{
+public:
+    IDEImagePosixFile(uint8_t *buffer, size_t buffer_size);
+    virtual ~IDEImagePosixFile();
+
+    bool open_file(const char *filename, bool read_only = false);
+    void close();
+
+    // Size of individual pread()/pwrite() calls.
+    // The callback is given a chance to process data between calls,
+    // similar to the streaming callbacks from SD card driver.
+    void set_chunk_size(size_t chunk_size);
+
+    virtual bool get_filename(char *buf, size_t buflen);
+    virtual uint64_t capacity();
+    virtual bool writable();
+    virtual bool read(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback);
+    virtual bool write(uint64_t startpos, size_t blocksize, size_t num_blocks, Callback *callback);
+    virtual bool load_next_image();
+
+    virtual void set_drive_type(drive_type_t type);
+    virtual drive_type_t get_drive_type();
+
+protected:
+    int m_fd;
+    char m_filename[MAX_FILE_PATH];
+    uint64_t m_capacity;
+    bool m_read_only;
+    uint8_t *m_buffer;
+    size_t m_buffer_size;
+    size_t m_chunk_size;
+    drive_type_t m_drive_type;
+
+    // Same ring buffer bookkeeping as IDEImageFile::sd_cb_state
+    struct {
+        IDEImage::Callback *callback;
+        bool error;
+        size_t num_blocks;
+        size_t blocksize;
+        size_t bufsize_blocks;
+        size_t blocks_done;
+        size_t blocks_available;
+    } m_cb_state;
+
+    void read_callback(size_t bytes_complete);
+    void write_callback(size_t bytes_complete);
+};
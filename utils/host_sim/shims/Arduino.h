@@ -0,0 +1,60 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Minimal subset of the Arduino API for building the firmware on a Linux host.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <pico/mutex.h>
+
+extern "C" unsigned long millis();
+extern "C" unsigned long micros();
+extern "C" void delay(unsigned long ms);
+extern "C" void delayMicroseconds(unsigned int us);
+
+#if defined(__GLIBC__) && (__GLIBC__ == 2 && __GLIBC_MINOR__ < 38)
+// Provided by newlib on RP2040, but only by newer glibc versions
+static inline size_t strlcat(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(dst);
+    if (len + 1 < size)
+    {
+        strncat(dst, src, size - len - 1);
+    }
+    return len + strlen(src);
+}
+
+static inline size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    if (size > 0)
+    {
+        strncpy(dst, src, size - 1);
+        dst[size - 1] = '\0';
+    }
+    return strlen(src);
+}
+#endif
@@ -0,0 +1,426 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Subset of the SdFat API for building the firmware on a Linux host.
+// Files are accessed through POSIX file descriptors, with paths relative
+// to the current working directory acting as the SD card root.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+typedef int oflag_t;
+
+#define FS_ATTRIB_READ_ONLY 0x01
+#define FS_ATTRIB_DIRECTORY 0x10
+#define FAT_TYPE_EXFAT 64
+#define FAT_TYPE_FAT12 12
+#define FAT_TYPE_FAT16 16
+#define FAT_TYPE_FAT32 32
+
+struct fspos_t {
+    uint64_t position;
+    uint32_t cluster;
+};
+
+class FsVolume;
+
+// Progress reporting for platform_set_sd_callback(), implemented in host_platform.cpp.
+// File reads and writes are split into chunks with a progress report after each,
+// similar to how the SDIO driver reports progress during multi-sector transfers.
+#define FS_HOST_STREAM_CHUNK 4096
+void host_sd_stream_start(const void *buf, uint32_t count);
+void host_sd_stream_progress(uint32_t bytes_done);
+
+// Card specific data register, only the erase block fields are used
+struct csd_t {
+    uint8_t csd[16];
+    bool eraseSingleBlock() const { return csd[10] & 0x40; }
+    uint8_t eraseSize() const { return (((csd[10] & 0x3F) << 1) | (csd[11] >> 7)) + 1; }
+};
+
+// Base class of SD card block devices
+class SdCard
+{
+public:
+    virtual ~SdCard() {}
+    virtual bool readSectors(uint32_t sector, uint8_t *dst, size_t n) = 0;
+    virtual bool writeSectors(uint32_t sector, const uint8_t *src, size_t n) = 0;
+    virtual bool erase(uint32_t firstSector, uint32_t lastSector) { return false; }
+    virtual bool readCSD(csd_t *csd) { return false; }
+    virtual uint32_t sectorCount() = 0;
+};
+
+static inline const char *fs_host_path(const char *path)
+{
+    while (*path == '/') path++;
+    return (*path) ? path : ".";
+}
+
+// Like in SdFat, copying a FsFile copies the handle and destructor does not close it.
+class FsFile
+{
+public:
+    FsFile(): m_fd(-1), m_dir(nullptr), m_name{} {}
+
+    bool open(const char *path, oflag_t oflag = O_RDONLY)
+    {
+        close();
+        const char *hostpath = fs_host_path(path);
+        struct stat st;
+        if (stat(hostpath, &st) == 0 && S_ISDIR(st.st_mode))
+        {
+            m_dir = opendir(hostpath);
+            if (!m_dir) return false;
+            snprintf(m_path, sizeof(m_path), "%s", hostpath);
+        }
+        else
+        {
+            m_fd = ::open(hostpath, oflag, 0644);
+            if (m_fd < 0) return false;
+        }
+
+        const char *name = strrchr(path, '/');
+        snprintf(m_name, sizeof(m_name), "%s", name ? name + 1 : path);
+        return true;
+    }
+
+    bool open(FsVolume *vol, const char *path, oflag_t oflag = O_RDONLY);
+
+    bool openNext(FsFile *dir, oflag_t oflag = O_RDONLY)
+    {
+        close();
+        if (!dir->m_dir) return false;
+
+        struct dirent *entry;
+        while ((entry = readdir(dir->m_dir)) != nullptr)
+        {
+            if (entry->d_name[0] == '.') continue;
+
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", dir->m_path, entry->d_name);
+            return open(path, oflag);
+        }
+        return false;
+    }
+
+    bool close()
+    {
+        if (m_fd >= 0) ::close(m_fd);
+        if (m_dir) closedir(m_dir);
+        m_fd = -1;
+        m_dir = nullptr;
+        m_first_sector = 0;
+        m_card_vol = nullptr;
+        return true;
+    }
+
+    bool isOpen() const { return m_fd >= 0 || m_dir != nullptr; }
+    bool isDirectory() const { return m_dir != nullptr; }
+    operator bool() const { return isOpen(); }
+
+    size_t getName(char *name, size_t len)
+    {
+        snprintf(name, len, "%s", m_name);
+        return strlen(name);
+    }
+
+    uint64_t size() const
+    {
+        struct stat st;
+        if (m_fd < 0 || fstat(m_fd, &st) != 0) return 0;
+        return st.st_size;
+    }
+    uint64_t fileSize() const { return size(); }
+
+    uint64_t position() const { return (m_fd >= 0) ? lseek(m_fd, 0, SEEK_CUR) : 0; }
+    uint64_t curPosition() const { return position(); }
+    bool seek(uint64_t pos) { return m_fd >= 0 && lseek(m_fd, pos, SEEK_SET) == (off_t)pos; }
+    bool seekSet(uint64_t pos) { return seek(pos); }
+
+    int read(void *buf, size_t count)
+    {
+        if (m_fd < 0) return -1;
+        if (m_card_vol) return card_read(buf, count);
+
+        host_sd_stream_start(buf, count);
+        size_t done = 0;
+        while (done < count)
+        {
+            size_t len = count - done;
+            if (len > FS_HOST_STREAM_CHUNK) len = FS_HOST_STREAM_CHUNK;
+            ssize_t status = ::read(m_fd, (uint8_t*)buf + done, len);
+            if (status <= 0) break;
+            done += status;
+            host_sd_stream_progress(done);
+        }
+        return (done == 0 && count > 0) ? -1 : (int)done;
+    }
+
+    size_t write(const void *buf, size_t count)
+    {
+        if (m_fd < 0) return 0;
+        if (m_card_vol) return card_write(buf, count);
+
+        host_sd_stream_start(buf, count);
+        size_t done = 0;
+        while (done < count)
+        {
+            size_t len = count - done;
+            if (len > FS_HOST_STREAM_CHUNK) len = FS_HOST_STREAM_CHUNK;
+            ssize_t status = ::write(m_fd, (const uint8_t*)buf + done, len);
+            if (status <= 0) break;
+            done += status;
+            host_sd_stream_progress(done);
+        }
+        return done;
+    }
+    bool sync();
+    bool flush() { return sync(); }
+
+    // Host files have no sector mapping, so they are only reported contiguous
+    // when the volume layout places them on the SD card.
+    bool contiguousRange(uint32_t *bgnSector, uint32_t *endSector)
+    {
+        if (!m_card_vol) return false;
+        *bgnSector = m_first_sector;
+        *endSector = m_first_sector + (size() + 511) / 512 - 1;
+        return true;
+    }
+
+    uint32_t firstSector() const { return m_first_sector; }
+
+    int fgets(char *str, int num, const char *delim = nullptr)
+    {
+        (void)delim;
+        int n = 0;
+        char c;
+        while (n < num - 1 && read(&c, 1) == 1)
+        {
+            str[n++] = c;
+            if (c == '\n') break;
+        }
+        str[n] = '\0';
+        return n;
+    }
+
+    void fgetpos(fspos_t *pos) const { pos->position = position(); pos->cluster = 0; }
+    void fsetpos(const fspos_t *pos) { seek(pos->position); }
+
+protected:
+    int card_read(void *buf, size_t count);
+    size_t card_write(const void *buf, size_t count);
+
+    int m_fd;
+    uint32_t m_first_sector = 0;
+    FsVolume *m_card_vol = nullptr; // Set when file data is on the SD card
+    DIR *m_dir;
+    char m_path[512];
+    char m_name[256];
+};
+
+// Simulated FAT filesystem layout, for testing code that walks the FAT through
+// SdCard sector reads. File contents still come from the host file, only
+// accesses that go directly to SD card sectors see the layout.
+struct FsHostFatLayout {
+    uint8_t fat_type;
+    uint32_t fat_start;
+    uint32_t data_start;
+    uint32_t cluster_count;
+    uint32_t sectors_per_cluster;
+    uint32_t file_first_sector; // Returned by firstSector() of files opened from the volume
+
+    // File data is read and written on the SD card from file_first_sector on,
+    // with partial sectors going through a single sector cache like in SdFat.
+    bool file_on_card;
+};
+
+class FsVolume
+{
+public:
+    FsFile open(const char *path, oflag_t oflag = O_RDONLY)
+    {
+        FsFile file;
+        file.open(this, path, oflag);
+        return file;
+    }
+
+    bool exists(const char *path)
+    {
+        return access(fs_host_path(path), F_OK) == 0;
+    }
+
+    uint8_t attrib(const char *path)
+    {
+        struct stat st;
+        if (stat(fs_host_path(path), &st) != 0) return 0;
+        uint8_t attr = 0;
+        if (access(fs_host_path(path), W_OK) != 0) attr |= FS_ATTRIB_READ_ONLY;
+        if (S_ISDIR(st.st_mode)) attr |= FS_ATTRIB_DIRECTORY;
+        return attr;
+    }
+
+    bool remove(const char *path) { return unlink(fs_host_path(path)) == 0; }
+
+    // Host filesystem has no FAT, fatType() 0 disables code that parses it
+    uint8_t fatType() const { return m_layout.fat_type; }
+    uint32_t sectorsPerCluster() const { return m_layout.sectors_per_cluster; }
+    uint32_t bytesPerCluster() const { return m_layout.sectors_per_cluster * 512; }
+    uint32_t clusterCount() const { return m_layout.cluster_count; }
+    uint32_t dataStartSector() const { return m_layout.data_start; }
+    uint32_t fatStartSector() const { return m_layout.fat_start; }
+
+    void set_fat_layout(const FsHostFatLayout &layout) { m_layout = layout; }
+    void clear_fat_layout() { m_layout = FsHostFatLayout{0, 0, 0, 0, 1, 0, false}; m_cache_sector = 0xFFFFFFFF; }
+
+    SdCard *card() { return m_card; }
+    void set_card(SdCard *card) { m_card = card; }
+
+    // Write back and invalidate the sector cache
+    uint8_t *cacheClear()
+    {
+        if (!cacheSync()) return nullptr;
+        m_cache_sector = 0xFFFFFFFF;
+        return m_cache;
+    }
+
+protected:
+    friend class FsFile;
+    FsHostFatLayout m_layout = {0, 0, 0, 0, 1, 0, false};
+    SdCard *m_card = nullptr;
+
+    uint8_t m_cache[512];
+    uint32_t m_cache_sector = 0xFFFFFFFF;
+    bool m_cache_dirty = false;
+
+    bool cacheSync()
+    {
+        if (m_cache_dirty && !m_card->writeSectors(m_cache_sector, m_cache, 1)) return false;
+        m_cache_dirty = false;
+        return true;
+    }
+
+    uint8_t *cacheSector(uint32_t sector)
+    {
+        if (sector != m_cache_sector)
+        {
+            if (!cacheSync() || !m_card->readSectors(sector, m_cache, 1))
+            {
+                m_cache_sector = 0xFFFFFFFF;
+                return nullptr;
+            }
+            m_cache_sector = sector;
+        }
+        return m_cache;
+    }
+};
+
+inline bool FsFile::open(FsVolume *vol, const char *path, oflag_t oflag)
+{
+    if (!open(path, oflag)) return false;
+    m_first_sector = vol->fatType() ? vol->m_layout.file_first_sector : 0;
+    if (vol->fatType() && vol->m_layout.file_on_card && vol->m_card) m_card_vol = vol;
+    return true;
+}
+
+inline bool FsFile::sync()
+{
+    if (m_card_vol && !m_card_vol->cacheSync()) return false;
+    return m_fd >= 0 && fsync(m_fd) == 0;
+}
+
+// Whole sectors are transferred directly unless the sector is in the cache,
+// like SdFat does. The host file only keeps track of size and position.
+inline int FsFile::card_read(void *buf, size_t count)
+{
+    uint64_t pos = position();
+    if (pos + count > size()) count = (pos < size()) ? size() - pos : 0;
+
+    uint8_t *dst = (uint8_t*)buf;
+    size_t done = 0;
+    while (done < count)
+    {
+        uint32_t sector = m_first_sector + (pos + done) / 512;
+        size_t offset = (pos + done) % 512;
+        size_t len = (count - done < 512 - offset) ? count - done : 512 - offset;
+        if (len == 512 && sector != m_card_vol->m_cache_sector)
+        {
+            if (!m_card_vol->m_card->readSectors(sector, dst + done, 1)) break;
+        }
+        else
+        {
+            const uint8_t *cache = m_card_vol->cacheSector(sector);
+            if (!cache) break;
+            memcpy(dst + done, cache + offset, len);
+        }
+        done += len;
+    }
+
+    lseek(m_fd, pos + done, SEEK_SET);
+    return (done == 0 && count > 0) ? -1 : (int)done;
+}
+
+inline size_t FsFile::card_write(const void *buf, size_t count)
+{
+    uint64_t pos = position();
+    const uint8_t *src = (const uint8_t*)buf;
+    size_t done = 0;
+    while (done < count)
+    {
+        uint32_t sector = m_first_sector + (pos + done) / 512;
+        size_t offset = (pos + done) % 512;
+        size_t len = (count - done < 512 - offset) ? count - done : 512 - offset;
+        if (len == 512)
+        {
+            if (sector == m_card_vol->m_cache_sector)
+            {
+                m_card_vol->m_cache_sector = 0xFFFFFFFF;
+                m_card_vol->m_cache_dirty = false;
+            }
+            if (!m_card_vol->m_card->writeSectors(sector, src + done, 1)) break;
+        }
+        else
+        {
+            uint8_t *cache = m_card_vol->cacheSector(sector);
+            if (!cache) break;
+            memcpy(cache + offset, src + done, len);
+            m_card_vol->m_cache_dirty = true;
+        }
+        done += len;
+    }
+
+    if (pos + done > size() && ftruncate(m_fd, pos + done) != 0) return 0;
+    lseek(m_fd, pos + done, SEEK_SET);
+    return done;
+}
+
+class SdFs: public FsVolume
+{
+public:
+    FsVolume *vol() { return this; }
+};
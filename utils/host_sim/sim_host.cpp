@@ -0,0 +1,111 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+#include "sim_host.h"
+#include "fpga_sim.h"
+#include <ide_protocol.h>
+#include <ide_constants.h>
+#include <ZuluIDE_log.h>
+#include <ZuluIDE_config.h>
+#include <Arduino.h>
+#include <string.h>
+
+// Copies use memmove() to keep them out of the ide_bench memcpy() statistics.
+
+// Commands that take longer than this are considered hung
+#define SIM_HOST_COMMAND_TIMEOUT 20000
+
+void sim_host_poll(uint32_t ms)
+{
+    uint32_t start = millis();
+    do
+    {
+        ide_protocol_poll();
+        log_deferred_poll(LOG_DEFERRED_POLL_RECORDS);
+    } while ((uint32_t)(millis() - start) < ms);
+}
+
+void sim_host_reset()
+{
+    fpga_sim_host_reset();
+
+    // Protocol layer monitors the presence of secondary drive for 500 ms after reset
+    sim_host_poll(600);
+}
+
+bool sim_host_ata_command(ide_registers_t *regs,
+                          const uint8_t *data_out, size_t out_len,
+                          uint8_t *data_in, size_t in_max, size_t *in_len)
+{
+    fpga_sim_host_set_data_out(data_out, out_len);
+    fpga_sim_host_set_data_in(data_in, in_max);
+    fpga_sim_host_command(regs);
+
+    uint32_t start = millis();
+    while (fpga_sim_host_command_pending())
+    {
+        if ((uint32_t)(millis() - start) > SIM_HOST_COMMAND_TIMEOUT)
+        {
+            logmsg("sim_host_ata_command(", regs->command, ") timeout");
+            return false;
+        }
+
+        // Command handler runs to completion inside the poll call
+        // that clears the command flag.
+        ide_protocol_poll();
+    }
+
+    // Main loop formats debug messages after the command has finished
+    log_deferred_flush();
+
+    if (in_len) *in_len = fpga_sim_host_data_in_len();
+    fpga_sim_host_set_data_out(nullptr, 0);
+    fpga_sim_host_set_data_in(nullptr, 0);
+
+    fpga_sim_host_get_regs(regs);
+    return !(regs->status & IDE_STATUS_ERR);
+}
+
+bool sim_host_atapi_command(const uint8_t cdb[12], uint16_t bytecount, bool dma,
+                            const uint8_t *data_out, size_t out_len,
+                            uint8_t *data_in, size_t in_max, size_t *in_len,
+                            ide_registers_t *result_regs)
+{
+    // Command packet is sent before the data-out phase
+    static uint8_t packet_and_data[12 + 65536];
+    if (out_len > sizeof(packet_and_data) - 12)
+    {
+        logmsg("sim_host_atapi_command(): data-out length ", (int)out_len, " too large");
+        return false;
+    }
+    memmove(packet_and_data, cdb, 12);
+    if (out_len > 0) memmove(packet_and_data + 12, data_out, out_len);
+
+    ide_registers_t regs = {};
+    regs.command = IDE_CMD_PACKET;
+    regs.feature = dma ? 0x01 : 0x00;
+    regs.lba_mid = (uint8_t)bytecount;
+    regs.lba_high = (uint8_t)(bytecount >> 8);
+
+    bool status = sim_host_ata_command(&regs, packet_and_data, 12 + out_len, data_in, in_max, in_len);
+    if (result_regs) *result_regs = regs;
+    return status;
+}
@@ -0,0 +1,54 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Scripted IDE host for driving the emulated devices over the simulated bus.
+// All functions run ide_protocol_poll() until the device has finished
+// processing the request.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ide_phy.h>
+
+// Keep polling the protocol layer for the given time
+void sim_host_poll(uint32_t ms);
+
+// Assert IDE bus reset and wait for the reset sequence to finish
+void sim_host_reset();
+
+// Execute an ATA command.
+// regs:      Taskfile written by host, updated with final register values.
+// data_out:  Data sent to device in data-out phases.
+// data_in:   Buffer for data received from device in data-in phases.
+// in_len:    Receives the total number of bytes sent by the device.
+// returns:   true if command completed without ERR status.
+bool sim_host_ata_command(ide_registers_t *regs,
+                          const uint8_t *data_out = nullptr, size_t out_len = 0,
+                          uint8_t *data_in = nullptr, size_t in_max = 0, size_t *in_len = nullptr);
+
+// Execute an ATAPI PACKET command.
+// bytecount: Byte count limit for PIO transfers
+// dma:       Request DMA transfer for the data phase
+bool sim_host_atapi_command(const uint8_t cdb[12], uint16_t bytecount, bool dma,
+                            const uint8_t *data_out = nullptr, size_t out_len = 0,
+                            uint8_t *data_in = nullptr, size_t in_max = 0, size_t *in_len = nullptr,
+                            ide_registers_t *result_regs = nullptr);
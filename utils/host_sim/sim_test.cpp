@@ -0,0 +1,1018 @@
+/**
+ * ZuluIDE™ - Copyright (c) 2024 Rabbit Hole Computing™
+ *
+ * ZuluIDE™ firmware is licensed under the GPL version 3 or any later version.
+ *
+ * https://www.gnu.org/licenses/gpl-3.0.html
+ * ----
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+**/
+
+// Basic tests of the IDE device emulation over the simulated FPGA bus
+
+#include "fpga_sim.h"
+#include "sim_host.h"
+#include <ide_protocol.h>
+#include <ide_rigid.h>
+#include <ide_cdrom.h>
+#include <ide_imagefile.h>
+#include <rp2040_fpga.h>
+#include "ide_imagefile_posix.h"
+#include <ZuluIDE_log.h>
+#include <ZuluIDE_config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+/* Unit test helpers */
+#define COMMENT(x) printf("\n----" x "----\n");
+#define TEST(x) \
+    if (!(x)) { \
+        fprintf(stderr, "\033[31;1mFAILED:\033[22;39m %s:%d %s\n", __FILE__, __LINE__, #x); \
+        status = false; \
+    } else { \
+        printf("\033[32;1mOK:\033[22;39m %s\n", #x); \
+    }
+
+extern bool g_host_log_stdout;
+extern SdFs SD;
+
+static uint32_t g_ide_buffer[65536 / 4];
+
+// Create image file where each 512-byte sector is filled with its index
+static bool create_test_image(const char *filename, uint32_t sectors)
+{
+    FILE *f = fopen(filename, "wb");
+    if (!f) return false;
+
+    uint32_t sector[128];
+    for (uint32_t i = 0; i < sectors; i++)
+    {
+        for (int j = 0; j < 128; j++) sector[j] = i;
+        fwrite(sector, 1, sizeof(sector), f);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool sector_matches(const uint8_t *data, uint32_t lba)
+{
+    const uint32_t *words = (const uint32_t*)data;
+    for (int j = 0; j < 128; j++)
+    {
+        if (words[j] != lba) return false;
+    }
+    return true;
+}
+
+// Read a sector directly from the image file, bypassing IDEImageFile
+static bool file_sector_matches(const char *filename, uint32_t sector, uint32_t value)
+{
+    uint8_t data[512];
+    FILE *f = fopen(filename, "rb");
+    if (!f) return false;
+    fseek(f, sector * 512, SEEK_SET);
+    size_t len = fread(data, 1, 512, f);
+    fclose(f);
+    return len == 512 && sector_matches(data, value);
+}
+
+bool test_rigid()
+{
+    bool status = true;
+    COMMENT("test_rigid()");
+
+    IDEImageFile image((uint8_t*)g_ide_buffer, sizeof(g_ide_buffer));
+    IDERigidDevice device;
+    TEST(create_test_image("hddr_simtest.img", 2048));
+    TEST(image.open_file("hddr_simtest.img"));
+    ide_protocol_init(&device, NULL);
+    device.set_image(&image);
+    sim_host_reset();
+
+    COMMENT("IDENTIFY DEVICE");
+    uint16_t ident[256] = {0};
+    size_t len = 0;
+    ide_registers_t regs = {};
+    regs.command = IDE_CMD_IDENTIFY_DEVICE;
+    TEST(sim_host_ata_command(&regs, nullptr, 0, (uint8_t*)ident, sizeof(ident), &len));
+    TEST(len == 512);
+    TEST((ident[60] | ((uint32_t)ident[61] << 16)) == 2048);
+
+    COMMENT("READ SECTORS");
+    static uint8_t data[16 * 512];
+    regs = {};
+    regs.command = IDE_CMD_READ_SECTORS;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 16;
+    regs.lba_low = 100;
+    TEST(sim_host_ata_command(&regs, nullptr, 0, data, sizeof(data), &len));
+    TEST(len == sizeof(data));
+    TEST(sector_matches(data, 100));
+    TEST(sector_matches(data + 15 * 512, 115));
+
+    COMMENT("48-bit commands are rejected when PHY does not support them");
+    TEST(!ide_phy_get_capabilities()->supports_lba48);
+    TEST(!(ident[83] & (1 << 10)));
+    regs = {};
+    regs.command = IDE_CMD_READ_SECTORS_EXT;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 1;
+    regs.lba_low = 100;
+    TEST(!sim_host_ata_command(&regs, nullptr, 0, data, sizeof(data), &len));
+
+    COMMENT("WRITE SECTORS");
+    for (int i = 0; i < 4; i++)
+    {
+        for (int j = 0; j < 128; j++) ((uint32_t*)data)[i * 128 + j] = 5000 + i;
+    }
+    regs = {};
+    regs.command = IDE_CMD_WRITE_SECTORS;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 4;
+    regs.lba_low = 10;
+    TEST(sim_host_ata_command(&regs, data, 4 * 512));
+    TEST(fpga_sim_host_data_out_remaining() == 0);
+
+    regs = {};
+    regs.command = IDE_CMD_READ_SECTORS;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 5;
+    regs.lba_low = 10;
+    memset(data, 0, sizeof(data));
+    TEST(sim_host_ata_command(&regs, nullptr, 0, data, sizeof(data), &len));
+    TEST(sector_matches(data, 5000));
+    TEST(sector_matches(data + 3 * 512, 5003));
+    TEST(sector_matches(data + 4 * 512, 14));
+
+    COMMENT("DATA SET MANAGEMENT");
+    TEST(ident[169] & 1);
+    TEST(!(ident[80] & 0x0080)); // ATA8-ACS is not claimed
+    memset(data, 0, 512);
+    data[0] = 20; // LBA
+    data[6] = 8;  // Sector count
+    regs = {};
+    regs.command = IDE_CMD_DATA_SET_MANAGEMENT;
+    regs.feature = IDE_DSM_FEATURE_TRIM;
+    regs.sector_count = 1;
+    TEST(sim_host_ata_command(&regs, data, 512));
+    TEST(fpga_sim_host_data_out_remaining() == 0);
+
+    regs = {};
+    regs.command = IDE_CMD_READ_SECTORS;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 1;
+    regs.lba_low = 28;
+    TEST(sim_host_ata_command(&regs, nullptr, 0, data, sizeof(data), &len));
+    TEST(sector_matches(data, 28));
+
+    COMMENT("READ DMA");
+    regs = {};
+    regs.command = IDE_CMD_READ_DMA;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 16;
+    regs.lba_low = 200;
+    memset(data, 0, sizeof(data));
+    TEST(sim_host_ata_command(&regs, nullptr, 0, data, sizeof(data), &len));
+    TEST(len == sizeof(data));
+    TEST(sector_matches(data + 15 * 512, 215));
+
+    COMMENT("READ MULTIPLE");
+    TEST(ident[47] == 0x8008);
+    regs = {};
+    regs.command = IDE_CMD_SET_MULTIPLE_MODE;
+    regs.sector_count = 8;
+    TEST(sim_host_ata_command(&regs));
+    fpga_sim_clear_stats();
+    regs = {};
+    regs.command = IDE_CMD_READ_MULTIPLE;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 12;
+    regs.lba_low = 44;
+    memset(data, 0, sizeof(data));
+    TEST(sim_host_ata_command(&regs, nullptr, 0, data, sizeof(data), &len));
+    TEST(len == 12 * 512);
+    TEST(sector_matches(data, 44));
+    TEST(sector_matches(data + 11 * 512, 55));
+    TEST(fpga_sim_get_stats()->cmd_count[0x84] == 2); // 8 + 4 sector DRQ blocks
+
+    COMMENT("READ VERIFY SECTORS and SEEK");
+    fpga_sim_clear_stats();
+    regs = {};
+    regs.command = IDE_CMD_READ_VERIFY_SECTORS;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 0; // 256 sectors
+    regs.lba_low = 1;
+    TEST(sim_host_ata_command(&regs));
+    TEST(fpga_sim_get_stats()->cmd_count[0x84] == 0);
+    regs = {};
+    regs.command = IDE_CMD_READ_VERIFY_SECTORS;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 2;
+    regs.lba_mid = 2047 >> 8;
+    regs.lba_low = 2047 & 0xFF;
+    TEST(!sim_host_ata_command(&regs));
+    TEST(regs.error == IDE_ERROR_IDNF);
+    regs = {};
+    regs.command = IDE_CMD_SEEK;
+    regs.device = 0x40; // LBA mode
+    regs.lba_mid = 3;
+    TEST(sim_host_ata_command(&regs));
+
+    COMMENT("Write cache is not offered unless allowed in config");
+    TEST(!(ident[82] & (1 << 5)));
+    regs = {};
+    regs.command = IDE_CMD_SET_FEATURES;
+    regs.feature = IDE_SET_FEATURE_ENABLE_WRITE_CACHE;
+    TEST(!sim_host_ata_command(&regs));
+    TEST(!image.get_write_cache());
+
+    COMMENT("SET FEATURES write cache and FLUSH CACHE");
+    IDEImageFile::set_write_cache_allowed(true);
+    regs = {};
+    regs.command = IDE_CMD_IDENTIFY_DEVICE;
+    TEST(sim_host_ata_command(&regs, nullptr, 0, (uint8_t*)ident, sizeof(ident), &len));
+    TEST(ident[82] & (1 << 5));
+    TEST(!(ident[85] & (1 << 5)));
+    regs = {};
+    regs.command = IDE_CMD_SET_FEATURES;
+    regs.feature = IDE_SET_FEATURE_ENABLE_WRITE_CACHE;
+    TEST(sim_host_ata_command(&regs));
+    TEST(image.get_write_cache());
+    regs = {};
+    regs.command = IDE_CMD_FLUSH_CACHE;
+    TEST(sim_host_ata_command(&regs));
+    regs = {};
+    regs.command = IDE_CMD_SET_FEATURES;
+    regs.feature = IDE_SET_FEATURE_DISABLE_WRITE_CACHE;
+    TEST(sim_host_ata_command(&regs));
+    TEST(!image.get_write_cache());
+    IDEImageFile::set_write_cache_allowed(false);
+
+    COMMENT("Image buffer reused while PHY is sending");
+    {
+        // With single sector buffer every SD card read goes to the block
+        // that was just given to ide_phy_write_block_async().
+        static uint32_t small_buffer[512 / 4];
+        IDEImageFile small((uint8_t*)small_buffer, sizeof(small_buffer));
+        TEST(small.open_file("hddr_simtest.img"));
+        device.set_image(&small);
+        regs = {};
+        regs.command = IDE_CMD_READ_SECTORS;
+        regs.device = 0x40; // LBA mode
+        regs.sector_count = 8;
+        regs.lba_mid = 400 >> 8;
+        regs.lba_low = 400 & 0xFF;
+        TEST(sim_host_ata_command(&regs, nullptr, 0, data, sizeof(data), &len));
+        TEST(len == 8 * 512);
+        bool all_match = true;
+        for (int i = 0; i < 8; i++) all_match = all_match && sector_matches(data + i * 512, 400 + i);
+        TEST(all_match);
+        device.set_image(&image);
+        small.close();
+    }
+
+    COMMENT("Transaction counters");
+    fpga_sim_clear_stats();
+    regs = {};
+    regs.command = IDE_CMD_READ_SECTORS;
+    regs.device = 0x40; // LBA mode
+    regs.sector_count = 1;
+    TEST(sim_host_ata_command(&regs, nullptr, 0, data, sizeof(data), &len));
+    const fpga_sim_stats_t *stats = fpga_sim_get_stats();
+    TEST(stats->cmd_count[0x84] == 1);
+    TEST(stats->host_bytes_in == 512);
+
+    image.close();
+    unlink("hddr_simtest.img");
+    return status;
+}
+
+// Exposes the track lookup of the CD-ROM device for tests
+class TestCDROMDevice: public IDECDROMDevice
+{
+public:
+    using IDECDROMDevice::getTrackFromLBA;
+};
+
+bool test_cdrom()
+{
+    bool status = true;
+    COMMENT("test_cdrom()");
+
+    IDEImageFile image((uint8_t*)g_ide_buffer, sizeof(g_ide_buffer));
+    IDECDROMDevice device;
+    TEST(create_test_image("cdrm_simtest.iso", 4096));
+    TEST(image.open_file("cdrm_simtest.iso"));
+    ide_protocol_init(&device, NULL);
+    device.set_image(&image);
+    sim_host_reset();
+
+    COMMENT("INQUIRY");
+    uint8_t cdb[12] = {0x12, 0, 0, 0, 36, 0};
+    uint8_t inquiry[36] = {0};
+    size_t len = 0;
+    TEST(sim_host_atapi_command(cdb, 36, false, nullptr, 0, inquiry, sizeof(inquiry), &len));
+    TEST(len == 36);
+    TEST(inquiry[0] == 0x05);
+
+    // First command after reset reports unit attention
+    uint8_t tur[12] = {0};
+    sim_host_atapi_command(tur, 0, false);
+
+    COMMENT("READ(10)");
+    static uint8_t data[8 * 2048];
+    uint8_t read10[12] = {0x28, 0, 0, 0, 0, 10, 0, 0, 8, 0};
+    TEST(sim_host_atapi_command(read10, 0xFFFE, false, nullptr, 0, data, sizeof(data), &len));
+    TEST(len == sizeof(data));
+    TEST(sector_matches(data, 40));
+    TEST(sector_matches(data + 7 * 2048 + 1536, 40 + 7 * 4 + 3));
+
+    image.close();
+    unlink("cdrm_simtest.iso");
+
+    COMMENT("Track lookup in multi-track CUE/BIN image");
+    FILE *f = fopen("cdmt_simtest.cue", "w");
+    TEST(f != nullptr);
+    fputs("FILE \"cdmt_simtest.bin\" BINARY\n"
+          "  TRACK 01 MODE1/2048\n"
+          "    INDEX 01 00:00:00\n"
+          "  TRACK 02 AUDIO\n"
+          "    PREGAP 00:02:00\n"
+          "    INDEX 01 00:02:00\n"
+          "  TRACK 03 AUDIO\n"
+          "    INDEX 00 00:04:00\n"
+          "    INDEX 01 00:04:30\n", f);
+    fclose(f);
+
+    // 150 data sectors, 150 audio sectors of track 2 and 100 of track 3
+    uint64_t track3_offset = 150 * 2048 + 150 * 2352;
+    f = fopen("cdmt_simtest.bin", "wb");
+    TEST(f != nullptr);
+    TEST(fseek(f, track3_offset + 100 * 2352 - 1, SEEK_SET) == 0 && fputc(0, f) == 0);
+    fclose(f);
+
+    TestCDROMDevice cddevice;
+    TEST(image.open_file("cdmt_simtest.bin"));
+    cddevice.set_image(&image);
+    TEST(cddevice.capacity_lba() == 400);
+
+    CUETrackInfo track = cddevice.getTrackFromLBA(0);
+    TEST(track.track_number == 1 && track.track_mode == CUETrack_MODE1_2048);
+    TEST(cddevice.getTrackFromLBA(149).track_number == 1);
+    track = cddevice.getTrackFromLBA(150);
+    TEST(track.track_number == 2 && track.track_mode == CUETrack_AUDIO);
+    TEST(track.data_start == 150 && track.unstored_pregap_length == 150);
+    TEST(track.file_offset == 150 * 2048);
+    TEST(cddevice.getTrackFromLBA(299).track_number == 2);
+    track = cddevice.getTrackFromLBA(300);
+    TEST(track.track_number == 3);
+    TEST(track.track_start == 300 && track.data_start == 330);
+    TEST(track.file_offset == track3_offset);
+    TEST(cddevice.getTrackFromLBA(329).track_number == 3);
+    TEST(cddevice.getTrackFromLBA(399).track_number == 3);
+
+    cddevice.set_image(nullptr);
+    image.close();
+    unlink("cdmt_simtest.cue");
+    unlink("cdmt_simtest.bin");
+    return status;
+}
+
+// Callback that accepts at most 2 blocks per call and every other call none,
+// to exercise partial processing and ring buffer wrap in image backends.
+class PartialCallback: public IDEImage::Callback
+{
+public:
+    uint8_t data[64 * 512];
+    size_t pos = 0;
+    int calls = 0;
+
+    virtual ssize_t read_callback(const uint8_t *src, size_t blocksize, size_t num_blocks)
+    {
+        if (calls++ & 1) return 0;
+        size_t count = std::min<size_t>(num_blocks, 2);
+        memcpy(data + pos, src, count * blocksize);
+        pos += count * blocksize;
+        return count;
+    }
+
+    virtual ssize_t write_callback(uint8_t *dst, size_t blocksize, size_t num_blocks)
+    {
+        if (calls++ & 1) return 0;
+        size_t count = std::min<size_t>(num_blocks, 2);
+        memcpy(dst, data + pos, count * blocksize);
+        pos += count * blocksize;
+        return count;
+    }
+};
+
+bool test_posix_image()
+{
+    bool status = true;
+    COMMENT("test_posix_image()");
+
+    static uint8_t buffer[3 * 512];
+    static PartialCallback cb;
+    IDEImagePosixFile image(buffer, sizeof(buffer));
+    image.set_chunk_size(1024);
+    TEST(create_test_image("posix_simtest.img", 256));
+    TEST(image.open_file("posix_simtest.img"));
+    TEST(image.capacity() == 256 * 512);
+
+    COMMENT("Read with ring buffer wrap");
+    cb.pos = 0;
+    TEST(image.read(20 * 512, 512, 41, &cb));
+    TEST(cb.pos == 41 * 512);
+    TEST(sector_matches(cb.data, 20));
+    TEST(sector_matches(cb.data + 40 * 512, 60));
+
+    COMMENT("Write with ring buffer wrap");
+    for (int i = 0; i < 17; i++)
+    {
+        for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[i * 128 + j] = 1000 + i;
+    }
+    cb.pos = 0;
+    TEST(image.write(100 * 512, 512, 17, &cb));
+    TEST(cb.pos == 17 * 512);
+    cb.pos = 0;
+    TEST(image.read(99 * 512, 512, 19, &cb));
+    TEST(sector_matches(cb.data, 99));
+    TEST(sector_matches(cb.data + 1 * 512, 1000));
+    TEST(sector_matches(cb.data + 17 * 512, 1016));
+    TEST(sector_matches(cb.data + 18 * 512, 117));
+
+    image.close();
+    unlink("posix_simtest.img");
+    return status;
+}
+
+// SD card backed by a host file, for raw image access
+class FileSdCard: public SdCard
+{
+public:
+    FILE *f = nullptr;
+    uint32_t sectors = 0;
+    bool fail_writes = false;
+    uint32_t fail_reads_from = 0xFFFFFFFF;
+
+    virtual bool readSectors(uint32_t sector, uint8_t *dst, size_t n)
+    {
+        if (sector + n > fail_reads_from) return false;
+        return fseek(f, (long)sector * 512, SEEK_SET) == 0 && fread(dst, 512, n, f) == n;
+    }
+
+    virtual bool writeSectors(uint32_t sector, const uint8_t *src, size_t n)
+    {
+        return !fail_writes && fseek(f, (long)sector * 512, SEEK_SET) == 0 &&
+               fwrite(src, 512, n, f) == n && fflush(f) == 0;
+    }
+
+    virtual uint32_t sectorCount() { return sectors; }
+};
+
+// SD card that reports an erase block size and records erase commands
+class EraseSdCard: public FileSdCard
+{
+public:
+    uint8_t erase_size = 8;
+    int erase_count = 0;
+    uint32_t erase_first = 0;
+    uint32_t erase_last = 0;
+
+    virtual bool erase(uint32_t firstSector, uint32_t lastSector)
+    {
+        erase_count++;
+        erase_first = firstSector;
+        erase_last = lastSector;
+        return true;
+    }
+
+    virtual bool readCSD(csd_t *csd)
+    {
+        memset(csd, 0, sizeof(csd_t));
+        csd->csd[10] = (erase_size - 1) >> 1;
+        csd->csd[11] = ((erase_size - 1) & 1) << 7;
+        return true;
+    }
+};
+
+bool test_raw_image()
+{
+    bool status = true;
+    COMMENT("test_raw_image()");
+
+    static PartialCallback cb;
+    FileSdCard card;
+    TEST(create_test_image("raw_simtest.img", 256));
+    card.f = fopen("raw_simtest.img", "r+b");
+    card.sectors = 256;
+    TEST(card.f != nullptr);
+
+    IDEImageFile image((uint8_t*)g_ide_buffer, 8 * 512);
+    TEST(!image.open_raw(&card, 200, 100));
+    TEST(image.open_raw(&card, 100, 50));
+    TEST(image.is_open());
+    TEST(image.capacity() == 50 * 512);
+
+    COMMENT("Read and write at sector offset");
+    cb.pos = 0;
+    TEST(image.read(10 * 512, 512, 12, &cb));
+    TEST(sector_matches(cb.data, 110));
+    TEST(sector_matches(cb.data + 11 * 512, 121));
+
+    for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[j] = 8080;
+    cb.pos = 0;
+    TEST(image.write(0, 512, 1, &cb));
+    TEST(file_sector_matches("raw_simtest.img", 100, 8080));
+    TEST(!image.read(49 * 512, 512, 2, &cb));
+
+    COMMENT("Verify reads from SD card, not from RAM");
+    uint64_t failed_pos = 0;
+    cb.pos = 0;
+    TEST(image.read(20 * 512, 512, 4, &cb));
+    TEST(image.verify(20 * 512, 16 * 512, &failed_pos));
+    card.fail_reads_from = 100 + 30;
+    TEST(!image.verify(20 * 512, 16 * 512, &failed_pos));
+    TEST(failed_pos == 28 * 512);
+    card.fail_reads_from = 100 + 20;
+    TEST(!image.verify(20 * 512, 4 * 512, &failed_pos));
+    TEST(failed_pos == 20 * 512);
+    card.fail_reads_from = 0xFFFFFFFF;
+
+    image.close();
+    TEST(!image.is_open());
+    fclose(card.f);
+
+    COMMENT("Discard erases only whole erase blocks");
+    EraseSdCard ecard;
+    TEST(create_test_image("raw_simtest.img", 256));
+    ecard.f = fopen("raw_simtest.img", "r+b");
+    ecard.sectors = 256;
+    TEST(ecard.f != nullptr);
+    TEST(image.open_raw(&ecard, 100, 50));
+    TEST(image.discard(5 * 512, 26 * 512));
+    TEST(ecard.erase_count == 1);
+    TEST(ecard.erase_first == 112);
+    TEST(ecard.erase_last == 127);
+
+    ecard.erase_count = 0;
+    TEST(image.discard(13 * 512, 6 * 512));
+    TEST(ecard.erase_count == 0);
+
+    COMMENT("Erase size does not need to be a power of 2");
+    ecard.erase_size = 6;
+    TEST(image.discard(5 * 512, 26 * 512));
+    TEST(ecard.erase_count == 1);
+    TEST(ecard.erase_first == 108);
+    TEST(ecard.erase_last == 125);
+    ecard.erase_size = 8;
+
+    COMMENT("Discard drops cached writes instead of writing them");
+    IDEImageFile::set_write_cache_allowed(true);
+    TEST(image.set_write_cache(true));
+    for (int i = 0; i < 2; i++)
+    {
+        for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[i * 128 + j] = 9000 + i;
+    }
+    cb.pos = 0;
+    TEST(image.write(19 * 512, 512, 2, &cb));
+    TEST(image.discard(20 * 512, 8 * 512));
+    TEST(image.flush());
+    TEST(file_sector_matches("raw_simtest.img", 119, 9000));
+    TEST(file_sector_matches("raw_simtest.img", 120, 120));
+    TEST(image.set_write_cache(false));
+    IDEImageFile::set_write_cache_allowed(false);
+
+    image.close();
+    fclose(ecard.f);
+    unlink("raw_simtest.img");
+    return status;
+}
+
+// Cluster chain of the fragmented image file in test_fragmented_image()
+static const uint32_t g_frag_chain[10] = {10, 11, 12, 150, 151, 5, 60, 61, 62, 63};
+
+// SD card sector of a file sector, with 4 sectors per cluster and data area at sector 32
+static uint32_t frag_sd_sector(uint32_t file_sector)
+{
+    return 32 + (g_frag_chain[file_sector / 4] - 2) * 4 + file_sector % 4;
+}
+
+bool test_fragmented_image()
+{
+    bool status = true;
+    COMMENT("test_fragmented_image()");
+
+    static PartialCallback cb;
+    const uint8_t fat_types[3] = {FAT_TYPE_FAT16, FAT_TYPE_FAT32, FAT_TYPE_EXFAT};
+    for (int t = 0; t < 3; t++)
+    {
+        uint8_t fat_type = fat_types[t];
+        printf("\nFAT type %d\n", (int)fat_type);
+
+        // FAT starts at sector 8. Entry of cluster 150 is in the second
+        // FAT sector for FAT32 and exFAT. The upper 4 bits of FAT32 entries
+        // are reserved and must be ignored.
+        FileSdCard card;
+        TEST(create_test_image("frag_card_simtest.img", 1024));
+        card.f = fopen("frag_card_simtest.img", "r+b");
+        card.sectors = 1024;
+        TEST(card.f != nullptr);
+        for (int i = 0; i < 10; i++)
+        {
+            uint32_t next = (i < 9) ? g_frag_chain[i + 1] : 0xFFFFFFFF;
+            if (fat_type == FAT_TYPE_FAT16)
+            {
+                uint16_t entry = next;
+                fseek(card.f, 8 * 512 + g_frag_chain[i] * 2, SEEK_SET);
+                fwrite(&entry, 2, 1, card.f);
+            }
+            else
+            {
+                uint32_t entry = (fat_type == FAT_TYPE_FAT32) ? (next | 0xF0000000) : next;
+                fseek(card.f, 8 * 512 + g_frag_chain[i] * 4, SEEK_SET);
+                fwrite(&entry, 4, 1, card.f);
+            }
+        }
+        fflush(card.f);
+
+        // Contents of the host file differ from the SD card sectors,
+        // so the checks below only pass if the extent map is used.
+        TEST(create_test_image("frag_simtest.img", 40));
+        SD.set_card(&card);
+        SD.set_fat_layout(FsHostFatLayout{fat_type, 8, 32, 200, 4, frag_sd_sector(0)});
+
+        IDEImageFile image((uint8_t*)g_ide_buffer, 8 * 512);
+        TEST(image.open_file("frag_simtest.img"));
+
+        cb.pos = 0;
+        TEST(image.read(0, 512, 40, &cb));
+        bool all_match = true;
+        for (int i = 0; i < 40; i++) all_match = all_match && sector_matches(cb.data + i * 512, frag_sd_sector(i));
+        TEST(all_match);
+
+        cb.pos = 0;
+        TEST(image.read(22 * 512, 512, 4, &cb));
+        TEST(sector_matches(cb.data, frag_sd_sector(22)));
+        TEST(sector_matches(cb.data + 3 * 512, frag_sd_sector(25)));
+
+        // Write over two fragment boundaries
+        for (int i = 0; i < 12; i++)
+        {
+            for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[i * 128 + j] = 9000 + i;
+        }
+        cb.pos = 0;
+        TEST(image.write(10 * 512, 512, 12, &cb));
+        TEST(file_sector_matches("frag_card_simtest.img", frag_sd_sector(9), frag_sd_sector(9)));
+        TEST(file_sector_matches("frag_card_simtest.img", frag_sd_sector(10), 9000));
+        TEST(file_sector_matches("frag_card_simtest.img", frag_sd_sector(12), 9002));
+        TEST(file_sector_matches("frag_card_simtest.img", frag_sd_sector(21), 9011));
+        TEST(file_sector_matches("frag_card_simtest.img", frag_sd_sector(22), frag_sd_sector(22)));
+
+        image.close();
+        SD.clear_fat_layout();
+        SD.set_card(nullptr);
+        fclose(card.f);
+        unlink("frag_simtest.img");
+        unlink("frag_card_simtest.img");
+    }
+
+    COMMENT("Raw sector write of data in SdFat cache");
+    {
+        // Image file is contiguous from SD card sector 100 and accessed through
+        // the shim's SdFat cache model. The unaligned read leaves sector 6
+        // in the cache, and the next read starts from it.
+        FileSdCard card;
+        TEST(create_test_image("contig_card_simtest.img", 1024));
+        card.f = fopen("contig_card_simtest.img", "r+b");
+        card.sectors = 1024;
+        TEST(card.f != nullptr);
+        TEST(create_test_image("contig_simtest.img", 64));
+        SD.set_card(&card);
+        SD.set_fat_layout(FsHostFatLayout{FAT_TYPE_FAT32, 8, 32, 200, 4, 100, true});
+
+        IDEImageFile image((uint8_t*)g_ide_buffer, 8 * 512);
+        TEST(image.open_file("contig_simtest.img"));
+
+        cb.pos = 0;
+        TEST(image.read(5 * 512 + 256, 512, 1, &cb));
+        TEST(((uint32_t*)cb.data)[0] == 105 && ((uint32_t*)cb.data)[127] == 106);
+
+        for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[j] = 7777;
+        cb.pos = 0;
+        TEST(image.write(6 * 512, 512, 1, &cb));
+        TEST(file_sector_matches("contig_card_simtest.img", 106, 7777));
+
+        cb.pos = 0;
+        TEST(image.read(6 * 512 + 256, 512, 1, &cb));
+        TEST(((uint32_t*)cb.data)[0] == 7777 && ((uint32_t*)cb.data)[127] == 107);
+
+        image.close();
+        SD.clear_fat_layout();
+        SD.set_card(nullptr);
+        fclose(card.f);
+        unlink("contig_simtest.img");
+        unlink("contig_card_simtest.img");
+    }
+
+    return status;
+}
+
+bool test_readahead()
+{
+    bool status = true;
+    COMMENT("test_readahead()");
+
+    static PartialCallback cb;
+    IDEImageFile image((uint8_t*)g_ide_buffer, 8 * 512);
+    TEST(create_test_image("readahead_simtest.img", 256));
+    TEST(image.open_file("readahead_simtest.img"));
+
+    COMMENT("Sequential reads with prefetch");
+    cb.pos = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        TEST(image.read((10 + i * 2) * 512, 512, 2, &cb));
+        for (int j = 0; j < 3; j++) image.prefetch_poll();
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        TEST(image.read((18 + i * 3) * 512, 512, 3, &cb));
+        image.prefetch_poll();
+    }
+    TEST(cb.pos == 32 * 512);
+    TEST(sector_matches(cb.data, 10));
+    TEST(sector_matches(cb.data + 16 * 512, 26));
+    TEST(sector_matches(cb.data + 31 * 512, 41));
+
+    COMMENT("Write invalidates prefetched data");
+    for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[j] = 7777;
+    cb.pos = 0;
+    TEST(image.write(42 * 512, 512, 1, &cb));
+    cb.pos = 0;
+    TEST(image.read(42 * 512, 512, 2, &cb));
+    TEST(sector_matches(cb.data, 7777));
+    TEST(sector_matches(cb.data + 512, 43));
+
+    image.close();
+    unlink("readahead_simtest.img");
+    return status;
+}
+
+bool test_write_pipeline()
+{
+    bool status = true;
+    COMMENT("test_write_pipeline()");
+
+    static PartialCallback cb;
+    IDEImageFile image((uint8_t*)g_ide_buffer, 16 * 512);
+    TEST(create_test_image("pipeline_simtest.img", 256));
+    TEST(image.open_file("pipeline_simtest.img"));
+
+    COMMENT("Write with receive during SD card write");
+    for (int i = 0; i < 57; i++)
+    {
+        for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[i * 128 + j] = 3000 + i;
+    }
+    cb.pos = 0;
+    TEST(image.write(30 * 512, 512, 57, &cb));
+    TEST(cb.pos == 57 * 512);
+
+    cb.pos = 0;
+    TEST(image.read(29 * 512, 512, 59, &cb));
+    TEST(sector_matches(cb.data, 29));
+    TEST(sector_matches(cb.data + 1 * 512, 3000));
+    TEST(sector_matches(cb.data + 20 * 512, 3019));
+    TEST(sector_matches(cb.data + 57 * 512, 3056));
+    TEST(sector_matches(cb.data + 58 * 512, 87));
+
+    image.close();
+    unlink("pipeline_simtest.img");
+    return status;
+}
+
+bool test_sector_cache()
+{
+    bool status = true;
+    COMMENT("test_sector_cache()");
+
+    static PartialCallback cb;
+    IDEImageFile image((uint8_t*)g_ide_buffer, sizeof(g_ide_buffer));
+    TEST(create_test_image("cache_simtest.img", 256));
+    TEST(image.open_file("cache_simtest.img"));
+
+    COMMENT("Repeated reads of same sectors");
+    for (int round = 0; round < 3; round++)
+    {
+        cb.pos = 0;
+        TEST(image.read(0, 512, 1, &cb));
+        TEST(image.read(64 * 512, 2048, 2, &cb));
+        TEST(image.read(16 * 512, 512, 1, &cb));
+        TEST(cb.pos == 10 * 512);
+        TEST(sector_matches(cb.data, 0));
+        TEST(sector_matches(cb.data + 512, 64));
+        TEST(sector_matches(cb.data + 8 * 512, 71));
+        TEST(sector_matches(cb.data + 9 * 512, 16));
+    }
+
+    COMMENT("Write invalidates cached sectors");
+    for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[j] = 4242;
+    cb.pos = 0;
+    TEST(image.write(66 * 512, 512, 1, &cb));
+    cb.pos = 0;
+    TEST(image.read(64 * 512, 2048, 2, &cb));
+    TEST(sector_matches(cb.data + 1 * 512, 65));
+    TEST(sector_matches(cb.data + 2 * 512, 4242));
+    TEST(sector_matches(cb.data + 3 * 512, 67));
+
+    image.close();
+    unlink("cache_simtest.img");
+    return status;
+}
+
+bool test_write_cache()
+{
+    bool status = true;
+    COMMENT("test_write_cache()");
+
+    static PartialCallback cb;
+    IDEImageFile image((uint8_t*)g_ide_buffer, sizeof(g_ide_buffer));
+    TEST(create_test_image("wcache_simtest.img", 256));
+    TEST(image.open_file("wcache_simtest.img"));
+    TEST(!image.set_write_cache(true));
+    IDEImageFile::set_write_cache_allowed(true);
+    TEST(image.set_write_cache(true));
+
+    COMMENT("Write completes to RAM");
+    for (int i = 0; i < 3; i++)
+    {
+        for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[i * 128 + j] = 6000 + i;
+    }
+    cb.pos = 0;
+    TEST(image.write(50 * 512, 512, 3, &cb));
+    TEST(cb.pos == 3 * 512);
+    TEST(file_sector_matches("wcache_simtest.img", 51, 51));
+
+    COMMENT("Read sees cached data");
+    cb.pos = 0;
+    TEST(image.read(49 * 512, 512, 5, &cb));
+    TEST(sector_matches(cb.data, 49));
+    TEST(sector_matches(cb.data + 1 * 512, 6000));
+    TEST(sector_matches(cb.data + 3 * 512, 6002));
+    TEST(sector_matches(cb.data + 4 * 512, 53));
+    TEST(file_sector_matches("wcache_simtest.img", 51, 6001));
+
+    COMMENT("Flush writes cached data");
+    for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[j] = 6100;
+    cb.pos = 0;
+    TEST(image.write(80 * 512, 512, 1, &cb));
+    TEST(file_sector_matches("wcache_simtest.img", 80, 80));
+    TEST(image.flush());
+    TEST(file_sector_matches("wcache_simtest.img", 80, 6100));
+    image.close();
+
+    COMMENT("Failed idle drain is reported by next flush");
+    FileSdCard card;
+    card.f = fopen("wcache_simtest.img", "r+b");
+    card.sectors = 256;
+    TEST(card.f != nullptr);
+    TEST(image.open_raw(&card, 0, 256));
+    for (int j = 0; j < 128; j++) ((uint32_t*)cb.data)[j] = 6200;
+    cb.pos = 0;
+    TEST(image.write(90 * 512, 512, 1, &cb));
+    card.fail_writes = true;
+    usleep((IMAGE_WRITE_CACHE_DELAY_MS + 10) * 1000);
+    image.write_cache_poll();
+    card.fail_writes = false;
+    TEST(!image.flush());
+    TEST(image.flush());
+    TEST(file_sector_matches("wcache_simtest.img", 90, 90));
+
+    TEST(image.set_write_cache(false));
+    IDEImageFile::set_write_cache_allowed(false);
+    image.close();
+    fclose(card.f);
+    unlink("wcache_simtest.img");
+    return status;
+}
+
+// Read text written to log since *pos
+static void read_log(uint32_t *pos, char *dest, size_t max_len)
+{
+    size_t len = 0;
+    uint32_t available;
+    do
+    {
+        const char *data = log_get_buffer(pos, &available);
+        for (uint32_t i = 0; i < available && len < max_len - 1; i++)
+        {
+            dest[len++] = data[i];
+        }
+    } while (available > 0);
+    dest[len] = '\0';
+}
+
+bool test_deferred_log()
+{
+    bool status = true;
+    COMMENT("test_deferred_log()");
+
+    bool old_debug = g_log_debug;
+    bool old_stdout = g_host_log_stdout;
+    g_log_debug = true;
+    g_host_log_stdout = false;
+
+    char tmpstr[16] = "temporary";
+    uint8_t bytes[40];
+    for (int i = 0; i < 40; i++) bytes[i] = i;
+
+    COMMENT("Immediate formatting");
+    static char expected[1024], result[1024];
+    uint32_t pos = log_get_buffer_len();
+    g_log_deferred = false;
+    dbgmsg("Values ", (uint8_t)0x12, " ", (uint16_t)0x3456, " ", (uint32_t)0x789ABCDE, " ",
+           (uint64_t)0x123456789ULL, " ", -42, " ", tmpstr);
+    dbgmsg("Bytes ", bytearray(bytes, 40), bytearray(bytes, 3));
+    read_log(&pos, expected, sizeof(expected));
+
+    COMMENT("Deferred formatting");
+    g_log_deferred = true;
+    dbgmsg("Values ", (uint8_t)0x12, " ", (uint16_t)0x3456, " ", (uint32_t)0x789ABCDE, " ",
+           (uint64_t)0x123456789ULL, " ", -42, " ", tmpstr);
+    strcpy(tmpstr, "overwritten");
+    dbgmsg("Bytes ", bytearray(bytes, 40), bytearray(bytes, 3));
+    TEST(log_deferred_pending());
+    TEST(log_get_buffer_len() == pos);
+    log_deferred_poll(LOG_DEFERRED_POLL_RECORDS);
+    TEST(!log_deferred_pending());
+    read_log(&pos, result, sizeof(result));
+    TEST(strcmp(expected, result) == 0);
+
+    COMMENT("Buffer overflow drops messages");
+    for (int i = 0; i < LOG_DEFERRED_BUFSIZE; i++)
+    {
+        dbgmsg("Overflow test ", i);
+    }
+
+    COMMENT("Regular message formats a bounded number of records first");
+    logmsg("Logged after oldest records");
+    TEST(log_deferred_pending());
+    read_log(&pos, result, sizeof(result));
+    TEST(strstr(result, "Overflow test 0\r\n") != NULL);
+    char line[32];
+    snprintf(line, sizeof(line), "Overflow test %d\r\n", LOG_DEFERRED_POLL_RECORDS - 1);
+    TEST(strstr(result, line) != NULL);
+    snprintf(line, sizeof(line), "Overflow test %d\r\n", LOG_DEFERRED_POLL_RECORDS);
+    TEST(strstr(result, line) == NULL);
+    TEST(strstr(result, "Logged after oldest records") != NULL);
+
+    log_deferred_flush();
+    TEST(!log_deferred_pending());
+    static char tail[256];
+    uint32_t tailpos = log_get_buffer_len() - 128;
+    read_log(&tailpos, tail, sizeof(tail));
+    TEST(strstr(tail, "debug messages dropped") != NULL);
+
+    g_log_debug = old_debug;
+    g_host_log_stdout = old_stdout;
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "-v") == 0)
+    {
+        g_host_log_stdout = true;
+    }
+    else
+    {
+        g_log_debug = false;
+    }
+
+    fpga_init();
+
+    if (test_rigid() && test_cdrom() && test_posix_image() && test_raw_image() && test_fragmented_image() && test_readahead() && test_write_pipeline() && test_sector_cache() && test_write_cache() && test_deferred_log())
+    {
+        printf("\n\nAll tests passed.\n");
+        return 0;
+    }
+    else
+    {
+        printf("\n\nSome tests failed.\n");
+        return 1;
+    }
+}